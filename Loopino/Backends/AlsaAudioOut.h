@@ -240,10 +240,13 @@ public:
                 uiPtr->position = uiPtr->loopPoint_l;
                 memset(stereo.data(), 0.0, framesPerBuffer * 2 * sizeof(float));
             }
-            for (uint32_t i = 0; i < framesPerBuffer; ++i) {
-                float s = uiPtr->synth.process();
-                stereo[i * 2 + 0] += s;
-                stereo[i * 2 + 1] += s;
+            {
+                Reclaimer::Guard g;
+                for (uint32_t i = 0; i < framesPerBuffer; ++i) {
+                    float s = uiPtr->synth.process();
+                    stereo[i * 2 + 0] += s;
+                    stereo[i * 2 + 1] += s;
+                }
             }
 
             snd_pcm_sframes_t written =
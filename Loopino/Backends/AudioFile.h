@@ -11,15 +11,26 @@
 #include <iostream>
 #include <cstring>
 #include <new>
+#include <vector>
+#include <algorithm>
+#include <atomic>
 #include <sndfile.hh>
 
 #include "CheckResample.h"
+#include "DecodeCache.h"
+#include "Downmix.h"
 
 #pragma once
 
 #ifndef AUDIOFILE_H
 #define AUDIOFILE_H
 
+// progress and cancel request of a load running in a other thread
+struct LoadProgress {
+    std::atomic<float> value { 0.0f };      // decoded part, 0..1
+    std::atomic<bool> cancel { false };
+};
+
 /****************************************************************
         class AudioFile - load a Audio File into buffer
                           and resample when needed
@@ -33,6 +44,12 @@ public:
     uint32_t samplerate;
     float*   samples;
     float* saveBuffer;
+    float peak;           // of samples, the stream gain follow it
+    DecodeCache cache;
+    Downmix downmixMode = Downmix::Left;
+    LoadProgress* watch = nullptr;
+
+    static constexpr sf_count_t CHUNK = 16384;
     
     AudioFile() {
         channels   = 0;
@@ -40,6 +57,7 @@ public:
         samplerate = 0;
         samples    = nullptr;
         saveBuffer = nullptr;
+        peak       = 0.0f;
     }
     
     ~AudioFile() {
@@ -47,62 +65,171 @@ public:
         delete[] saveBuffer;
     }
 
-    inline bool convertToMono() {
+    // load a Audio File into the buffer, decode chunk wise straight
+    // into the mono buffer, any channel count get folded down
+    inline bool getAudioFile(const char* file, const uint32_t expectedSampleRate = 0) {
+        SF_INFO info;
+        info.format = 0;
+
+        channels = 0;
+        samplesize = 0;
+        samplerate = 0;
+        peak = 0.0f;
+        delete[] saveBuffer;
+        saveBuffer = nullptr;
+        // decoded before, read it from the cache
+        if (expectedSampleRate) {
+            float* cached = nullptr;
+            uint32_t frames = 0;
+            uint32_t rate = 0;
+            if (cache.load(file, expectedSampleRate, (uint32_t)downmixMode, cached, frames, rate, peak)) {
+                delete[] samples;
+                samples = cached;
+                samplesize = frames;
+                samplerate = rate;
+                channels = 1;
+                return true;
+            }
+        }
+        // Open the wave file for reading
+        SNDFILE *sndfile = sf_open(file, SFM_READ, &info);
+
+        if (!sndfile) {
+            std::cerr << "Error: could not open file " << sf_error (sndfile) << std::endl;
+            return false;
+        }
+        if (info.channels < 1 || info.frames <= 0 || info.frames > UINT32_MAX) {
+            std::cerr << "Error: unsupported file layout" << std::endl;
+            sf_close(sndfile);
+            return false;
+        }
         delete[] samples;
         samples = nullptr;
         try {
-            samples = new float[samplesize];
+            samples = new float[info.frames];
         } catch (...) {
             std::cerr << "Error: could not load file" << std::endl;
+            sf_close(sndfile);
             return false;
         }
-        std::memset(samples, 0, samplesize * sizeof(float));
-        for (uint32_t i = 0; i < samplesize; i++) {
-            samples[i] = saveBuffer[i * channels] ;
+        std::vector<float> chunk(CHUNK * info.channels);
+        sf_count_t pos = 0;
+        sf_count_t n;
+        while (pos < info.frames && (n = sf_readf_float(sndfile, chunk.data(),
+                                std::min<sf_count_t>(CHUNK, info.frames - pos))) > 0) {
+            downmix(chunk.data(), samples + pos, (size_t)n, info.channels, downmixMode);
+            pos += n;
+            if (watch) {
+                watch->value.store((float)pos / (float)info.frames, std::memory_order_relaxed);
+                if (watch->cancel.load(std::memory_order_relaxed)) break;
+            }
         }
-        delete[] saveBuffer;
-        saveBuffer = nullptr;
+        sf_close(sndfile);
+        if (watch && watch->cancel.load(std::memory_order_relaxed)) {
+            delete[] samples;
+            samples = nullptr;
+            return false;
+        }
+        if (pos < info.frames)
+            std::memset(samples + pos, 0, (info.frames - pos) * sizeof(float));
+        samplesize = pos ? (uint32_t)pos : (uint32_t)info.frames;
         channels = 1;
+        samplerate = info.samplerate;
+        if (expectedSampleRate)
+            samples = checkSampleRate(&samplesize, channels, samples, samplerate, expectedSampleRate);
+        if (!samples) return false;
+        for (uint32_t i = 0; i < samplesize; ++i) peak = std::max(peak, std::fabs(samples[i]));
+        if (expectedSampleRate)
+            cache.store(file, expectedSampleRate, (uint32_t)downmixMode, samplerate, samples, samplesize, peak);
         return true;
     }
 
-    // load a Audio File into the buffer
-    inline bool getAudioFile(const char* file, const uint32_t expectedSampleRate = 0) {
+    // frames and rate of a file, without decoding it
+    static bool probe(const char* file, uint64_t& frames, uint32_t& rate) {
+        SF_INFO info;
+        info.format = 0;
+        SNDFILE *sndfile = sf_open(file, SFM_READ, &info);
+        if (!sndfile) return false;
+        sf_close(sndfile);
+        if (info.channels < 1 || info.frames <= 0 || info.samplerate <= 0) return false;
+        frames = (uint64_t)info.frames;
+        rate = (uint32_t)info.samplerate;
+        return true;
+    }
+
+    // load a mono overview of a long file, the mean of each decimate
+    // frames, decimate is the smallest divider of the file rate which
+    // keep the overview within maxFrames. The full file never stay in
+    // memory, the peak is taken from the full rate signal.
+    // samplerate is then the rate of the overview.
+    inline bool getOverview(const char* file, size_t maxFrames) {
         SF_INFO info;
         info.format = 0;
 
         channels = 0;
         samplesize = 0;
         samplerate = 0;
+        peak = 0.0f;
         delete[] saveBuffer;
         saveBuffer = nullptr;
-        // Open the wave file for reading
         SNDFILE *sndfile = sf_open(file, SFM_READ, &info);
-
         if (!sndfile) {
             std::cerr << "Error: could not open file " << sf_error (sndfile) << std::endl;
             return false;
         }
-        if (info.channels > 2) {
-            std::cerr << "Error: only two channels maximum are supported!" << std::endl;
+        if (info.channels < 1 || info.frames <= 0 || info.samplerate <= 0 || !maxFrames) {
+            std::cerr << "Error: unsupported file layout" << std::endl;
+            sf_close(sndfile);
             return false;
         }
+        uint32_t decimate = (uint32_t)std::max<sf_count_t>(1, (info.frames + maxFrames - 1) / maxFrames);
+        while ((uint32_t)info.samplerate % decimate) ++decimate;
+        const size_t size = (size_t)(info.frames / decimate);
+        delete[] samples;
+        samples = nullptr;
         try {
-            saveBuffer = new float[info.frames * info.channels];
+            samples = new float[std::max<size_t>(size, 1)];
         } catch (...) {
             std::cerr << "Error: could not load file" << std::endl;
+            sf_close(sndfile);
             return false;
         }
-        std::memset(saveBuffer, 0, info.frames * info.channels * sizeof(float));
-        samplesize = (uint32_t) sf_readf_float(sndfile, &saveBuffer[0], info.frames);
-        if (!samplesize ) samplesize = info.frames;
-        channels = info.channels;
-        samplerate = info.samplerate;
+        std::vector<float> chunk(CHUNK * info.channels);
+        std::vector<float> mono(CHUNK);
+        const float scale = 1.0f / (float)decimate;
+        float sum = 0.0f;
+        uint32_t count = 0;
+        size_t out = 0;
+        sf_count_t pos = 0;
+        sf_count_t n;
+        while (pos < info.frames && (n = sf_readf_float(sndfile, chunk.data(),
+                                std::min<sf_count_t>(CHUNK, info.frames - pos))) > 0) {
+            downmix(chunk.data(), mono.data(), (size_t)n, info.channels, downmixMode);
+            for (sf_count_t i = 0; i < n; ++i) {
+                peak = std::max(peak, std::fabs(mono[i]));
+                sum += mono[i];
+                if (++count == decimate) {
+                    if (out < size) samples[out++] = sum * scale;
+                    sum = 0.0f;
+                    count = 0;
+                }
+            }
+            pos += n;
+            if (watch) {
+                watch->value.store((float)pos / (float)info.frames, std::memory_order_relaxed);
+                if (watch->cancel.load(std::memory_order_relaxed)) break;
+            }
+        }
         sf_close(sndfile);
-        if (!convertToMono()) return false;
-        if (expectedSampleRate)
-            samples = checkSampleRate(&samplesize, channels, samples, samplerate, expectedSampleRate);
-        return samples ? true : false;
+        if ((watch && watch->cancel.load(std::memory_order_relaxed)) || !out) {
+            delete[] samples;
+            samples = nullptr;
+            return false;
+        }
+        samplesize = (uint32_t)out;
+        channels = 1;
+        samplerate = (uint32_t)info.samplerate / decimate;
+        return true;
     }
 
     // save a audio file from buffer to file
@@ -121,20 +248,24 @@ public:
         sf_close(sf);
     }
 
-    // save a audio file from buffer to file
-    void saveAudioFile(std::string name, const float* buffer, const uint32_t size, const uint32_t SampleRate) {
+    // save a audio file from buffer to file, integer formats get clipped
+    bool saveAudioFile(std::string name, const float* buffer, const uint32_t size, const uint32_t SampleRate,
+                                            int format = SF_FORMAT_WAV | SF_FORMAT_FLOAT) {
         SF_INFO sfinfo ;
         sfinfo.channels = 1;
         sfinfo.samplerate = SampleRate;
-        sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+        sfinfo.format = format;
         SNDFILE * sf = sf_open(name.c_str(), SFM_WRITE, &sfinfo);
         if (!sf) {
             std::cerr << "fail to open " << name << std::endl;
-            return;
+            return false;
         }
-        sf_writef_float(sf,&buffer[0], size);
+        if ((format & SF_FORMAT_SUBMASK) != SF_FORMAT_FLOAT)
+            sf_command(sf, SFC_SET_CLIPPING, nullptr, SF_TRUE);
+        const bool ok = sf_writef_float(sf,&buffer[0], size) == (sf_count_t)size;
         sf_write_sync(sf);
         sf_close(sf);
+        return ok;
     }
 
 };
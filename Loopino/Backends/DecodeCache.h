@@ -0,0 +1,215 @@
+
+/*
+ * DecodeCache.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+        DecodeCache.h - keep decoded, mono, target rate float
+                        data of large files in sidecar files,
+                        keyed by path, size, mtime, rate
+                        and downmix, with the peak level,
+                        so a stream could open without a scan.
+                        It is a plain read cache, a hit read
+                        the stored floats in one go instead of
+                        decode and resample the file again.
+****************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+#ifndef DECODECACHE_H
+#define DECODECACHE_H
+
+/****************************************************************
+        DecodeCache - the sidecar store
+****************************************************************/
+
+class DecodeCache {
+public:
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t MIN_SECONDS = 10;   // shorter files decode fast enough
+
+    void setDir(const std::string& d) { dir = d; }
+    const std::string& getDir() const { return dir; }
+    void setMaxBytes(uint64_t b) { maxBytes = b; }
+    void setEnabled(bool on) { enabled = on; }
+
+    // on a hit, out get a new[] buffer holding frames mono samples at rate,
+    // variant tell apart different decodes of the same file (the downmix)
+    bool load(const char* file, uint32_t rate, uint32_t variant, float*& out,
+                            uint32_t& frames, uint32_t& sourceRate, float& peak) {
+        Key k;
+        if (!enabled || dir.empty() || !makeKey(file, rate, variant, k)) return false;
+        const std::string path = sidecar(k);
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+        std::error_code ec;
+        const uint64_t size = std::filesystem::file_size(path, ec);
+        Header h;
+        if (ec || !in.read(reinterpret_cast<char*>(&h), sizeof(Header))) return false;
+        if (std::memcmp(h.magic, "LPDCACHE", 8) != 0 || h.version != VERSION ||
+            h.rate != rate || h.fileSize != k.fileSize || h.mtime != k.mtime ||
+            h.pathLen != k.path.size() || h.variant != variant ||
+            size < h.dataOffset + (uint64_t)h.frames * sizeof(float))
+            return false;
+        std::string stored(h.pathLen, '\0');
+        if (!in.read(&stored[0], h.pathLen) || stored != k.path) return false;
+        try {
+            out = new float[h.frames];
+        } catch (...) {
+            return false;
+        }
+        in.seekg((std::streamoff)h.dataOffset);
+        if (!in.read(reinterpret_cast<char*>(out), (std::streamsize)h.frames * sizeof(float))) {
+            delete[] out;
+            out = nullptr;
+            return false;
+        }
+        frames = h.frames;
+        sourceRate = h.sourceRate;
+        peak = h.peak;
+        return true;
+    }
+
+    // write the decoded data once, then keep the store within maxBytes
+    void store(const char* file, uint32_t rate, uint32_t variant, uint32_t sourceRate,
+                                    const float* data, uint32_t frames, float peak) {
+        Key k;
+        if (!enabled || dir.empty() || !data || frames < MIN_SECONDS * rate) return;
+        if (!makeKey(file, rate, variant, k)) return;
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        Header h;
+        std::memcpy(h.magic, "LPDCACHE", 8);
+        h.version = VERSION;
+        h.rate = rate;
+        h.sourceRate = sourceRate;
+        h.frames = frames;
+        h.fileSize = k.fileSize;
+        h.mtime = k.mtime;
+        h.pathLen = (uint32_t)k.path.size();
+        h.variant = variant;
+        h.peak = peak;
+        h.reserved = 0;
+        // the float data start on a 4k boundary
+        h.dataOffset = (sizeof(Header) + h.pathLen + 4095) & ~uint64_t(4095);
+
+        const std::string target = sidecar(k);
+        const std::string tmp = target + ".tmp";
+        {
+            std::ofstream o(tmp, std::ios::binary | std::ios::trunc);
+            if (!o) return;
+            o.write(reinterpret_cast<const char*>(&h), sizeof(Header));
+            o.write(k.path.data(), h.pathLen);
+            std::vector<char> pad(h.dataOffset - sizeof(Header) - h.pathLen, 0);
+            o.write(pad.data(), pad.size());
+            o.write(reinterpret_cast<const char*>(data), (std::streamsize)frames * sizeof(float));
+            if (!o) {
+                o.close();
+                std::filesystem::remove(tmp, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(tmp, target, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            return;
+        }
+        prune();
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t rate;
+        uint32_t sourceRate;
+        uint32_t frames;
+        uint64_t fileSize;
+        int64_t mtime;
+        uint32_t pathLen;
+        uint32_t variant;
+        uint64_t dataOffset;
+        float peak;             // of the stored data
+        uint32_t reserved;
+    };
+
+    struct Key {
+        std::string path;
+        uint64_t fileSize;
+        int64_t mtime;
+        uint32_t rate;
+        uint32_t variant;
+    };
+
+    std::string dir;
+    uint64_t maxBytes = 2ull << 30;
+    bool enabled = true;
+
+    static bool makeKey(const char* file, uint32_t rate, uint32_t variant, Key& k) {
+        std::error_code ec;
+        std::filesystem::path p = std::filesystem::absolute(file, ec);
+        if (ec) return false;
+        k.path = p.lexically_normal().u8string();
+        k.fileSize = std::filesystem::file_size(p, ec);
+        if (ec) return false;
+        k.mtime = (int64_t)std::filesystem::last_write_time(p, ec).time_since_epoch().count();
+        if (ec) return false;
+        k.rate = rate;
+        k.variant = variant;
+        return true;
+    }
+
+    // FNV-1a over the key
+    std::string sidecar(const Key& k) const {
+        uint64_t h = 1469598103934665603ull;
+        auto mix = [&h](const void* d, size_t n) {
+            const uint8_t* b = static_cast<const uint8_t*>(d);
+            for (size_t i = 0; i < n; ++i) { h ^= b[i]; h *= 1099511628211ull; }
+        };
+        mix(k.path.data(), k.path.size());
+        mix(&k.fileSize, sizeof(k.fileSize));
+        mix(&k.mtime, sizeof(k.mtime));
+        mix(&k.rate, sizeof(k.rate));
+        mix(&k.variant, sizeof(k.variant));
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.lpdc", (unsigned long long)h);
+        return (std::filesystem::path(dir) / name).u8string();
+    }
+
+    // drop the least recently written sidecars when the store grow to big
+    void prune() {
+        struct Item { std::filesystem::path p; uint64_t size; std::filesystem::file_time_type t; };
+        std::vector<Item> items;
+        uint64_t total = 0;
+        std::error_code ec;
+        for (auto& e : std::filesystem::directory_iterator(dir, ec)) {
+            if (e.path().extension() != ".lpdc") continue;
+            Item i { e.path(), e.file_size(ec), e.last_write_time(ec) };
+            total += i.size;
+            items.push_back(std::move(i));
+        }
+        if (total <= maxBytes) return;
+        std::sort(items.begin(), items.end(),
+            [](const Item& a, const Item& b) { return a.t < b.t; });
+        for (auto& i : items) {
+            if (total <= maxBytes) break;
+            if (std::filesystem::remove(i.p, ec)) total -= i.size;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,61 @@
+
+/*
+ * Downmix.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+        Downmix.h - fold interleaved frames of any channel
+                    count into mono
+****************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#ifndef DOWNMIX_H
+#define DOWNMIX_H
+
+enum class Downmix : uint8_t {
+    Left = 0,   // first channel only
+    Mid  = 1,   // mean of all channels
+    Sum  = 2    // sum of all channels
+};
+
+inline const char* downmixName(Downmix m) {
+    switch (m) {
+        case Downmix::Mid: return "mid";
+        case Downmix::Sum: return "sum";
+        default:           return "left";
+    }
+}
+
+inline bool parseDownmix(const char* s, Downmix& m) {
+    if (std::strcmp(s, "left") == 0) m = Downmix::Left;
+    else if (std::strcmp(s, "mid") == 0) m = Downmix::Mid;
+    else if (std::strcmp(s, "sum") == 0) m = Downmix::Sum;
+    else return false;
+    return true;
+}
+
+inline void downmix(const float* in, float* out, size_t frames,
+                    uint32_t channels, Downmix m, float gain = 1.0f) {
+    if (channels <= 1 || m == Downmix::Left) {
+        for (size_t i = 0; i < frames; ++i) out[i] = in[i * channels] * gain;
+        return;
+    }
+    const float g = m == Downmix::Mid ? gain / (float)channels : gain;
+    for (size_t i = 0; i < frames; ++i) {
+        const float* f = in + i * channels;
+        float s = 0.0f;
+        for (uint32_t c = 0; c < channels; ++c) s += f[c];
+        out[i] = s * g;
+    }
+}
+
+#endif
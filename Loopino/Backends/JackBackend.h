@@ -254,10 +254,13 @@ int JackBackend::process(jack_nframes_t nframes, void* arg) {
         jb->ui->position = jb->ui->loopPoint_l;
     }
 
-    for (uint32_t i = 0; i<jb->split; i++) {
-        float out = jb->ui->synth.process();
-        output[i+pframes] += out;
-        output1[i+pframes] += out;
+    {
+        Reclaimer::Guard g;
+        for (uint32_t i = 0; i<jb->split; i++) {
+            float out = jb->ui->synth.process();
+            output[i+pframes] += out;
+            output1[i+pframes] += out;
+        }
     }
 
     jb->engine.process(pframes, output, output1);
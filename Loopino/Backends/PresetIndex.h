@@ -0,0 +1,379 @@
+
+/*
+ * PresetIndex.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+        PresetIndex.h - a on disk index of the preset folder
+                        name, header version, sample length,
+                        stored rate, detected root key, rack
+                        order and mtime of each preset. The
+                        menu and the MIDI program mapping read
+                        the index instead of the folder.
+                        refresh() run in background, the folder
+                        is only listed when its mtime changed,
+                        a preset is only parsed when its mtime
+                        or size changed. The root key need the
+                        samples, it is only detected when asked
+                        for, after the list is published, one
+                        preset at a time with a pause between.
+****************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+
+#include "PresetLoader.h"
+#include "PresetValues.h"
+#include "PitchTracker.h"
+
+#ifndef PRESETINDEX_H
+#define PRESETINDEX_H
+
+class PresetIndex {
+public:
+    struct Entry {
+        std::string name;                   // file stem
+        int64_t mtime = 0;
+        uint64_t size = 0;
+        uint32_t version = 0;
+        uint32_t frames = 0;
+        uint32_t rate = 0;                  // 0 before version 13
+        int16_t rootkey = -1;               // -1 until detected, 128 when there is none
+        int32_t filterOrder[5] = {-1, -1, -1, -1, -1};      // -1 before version 15
+        int32_t machineOrder[6] = {-1, -1, -1, -1, -1, -1};
+
+        float seconds() const { return rate ? float(frames) / float(rate) : 0.0f; }
+    };
+    static_assert(sizeof(Entry::filterOrder) == PresetValues::fields[PresetValues::FILTERORDER].bytes &&
+                sizeof(Entry::machineOrder) == PresetValues::fields[PresetValues::MACHINEORDER].bytes,
+                "rack order as stored");
+
+    using List = std::vector<Entry>;
+
+    ~PresetIndex() {
+        stop.store(true, std::memory_order_relaxed);
+        if (worker.joinable()) worker.join();
+    }
+
+    // GUI thread, read the stored index and bring it up to date
+    void open(const std::string& presetDir, const std::string& indexFile) {
+        stop.store(true, std::memory_order_relaxed);
+        if (worker.joinable()) worker.join();
+        stop.store(false, std::memory_order_relaxed);
+        dir = presetDir;
+        file = indexFile;
+        auto l = std::make_shared<List>();
+        if (!readIndex(*l, dirTime)) dirTime = 0;
+        publish(std::move(l));
+        refresh();
+    }
+
+    // GUI thread, check the folder in background
+    void refresh() {
+        if (dir.empty()) return;
+        again.store(true, std::memory_order_relaxed);
+        if (running.exchange(true)) return;
+        if (worker.joinable()) worker.join();
+        worker = std::thread(&PresetIndex::run, this);
+    }
+
+    // GUI thread, a preset was just written, list it at once
+    void update(const std::string& path) {
+        auto l = std::make_shared<List>(*entries());
+        Entry e;
+        if (parse(path, e)) {
+            auto it = std::find_if(l->begin(), l->end(),
+                                [&](const Entry& x) { return x.name == e.name; });
+            if (it != l->end()) *it = e;
+            else l->push_back(e);
+            sortList(*l);
+            publish(std::move(l));
+        }
+        refresh();
+    }
+
+    std::shared_ptr<const List> entries() const {
+        std::lock_guard<std::mutex> g(m);
+        return current;
+    }
+
+    std::vector<std::string> names() const {
+        auto l = entries();
+        std::vector<std::string> n;
+        n.reserve(l->size());
+        for (const auto& e : *l) n.push_back(e.name);
+        return n;
+    }
+
+    // decode each preset once to find its root key, off by default,
+    // a large folder would keep a core busy for a long time
+    void detectKeys(bool on) {
+        keys.store(on, std::memory_order_relaxed);
+        if (on) refresh();
+    }
+
+    // true once after the list changed
+    bool takeFresh() {
+        return fresh.exchange(false, std::memory_order_acq_rel);
+    }
+
+    static std::string keyName(int key) {
+        static const char* names[] = {"C","C#","D","D#","E","F","F#","G","G#","A","A#","B"};
+        if (key < 0 || key > 127) return "";
+        return std::string(names[key % 12]) + std::to_string(key / 12 - 1);
+    }
+
+private:
+    static constexpr uint32_t INDEX_VERSION = 1;
+
+    mutable std::mutex m;
+    std::shared_ptr<const List> current = std::make_shared<List>();
+    std::string dir;
+    std::string file;
+    int64_t dirTime = 0;
+    std::thread worker;
+    std::atomic<bool> running { false };
+    std::atomic<bool> again { false };
+    std::atomic<bool> stop { false };
+    std::atomic<bool> fresh { false };
+    std::atomic<bool> keys { false };
+
+    void publish(std::shared_ptr<const List> l) {
+        std::lock_guard<std::mutex> g(m);
+        current = std::move(l);
+        fresh.store(true, std::memory_order_release);
+    }
+
+    static void sortList(List& l) {
+        std::sort(l.begin(), l.end(), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+    }
+
+    static int64_t timeOf(const std::filesystem::path& p) {
+        std::error_code ec;
+        auto t = std::filesystem::last_write_time(p, ec);
+        return ec ? 0 : (int64_t)t.time_since_epoch().count();
+    }
+
+    // header, rack order and sample length, without reading the samples
+    static bool parse(const std::filesystem::path& path, Entry& e) {
+        std::error_code ec;
+        e = Entry();
+        e.name = path.stem().u8string();
+        e.mtime = timeOf(path);
+        e.size = std::filesystem::file_size(path, ec);
+        if (ec) return false;
+        std::ifstream in(path, std::ios::binary);
+        PresetHeader h{};
+        if (!in.read(reinterpret_cast<char*>(&h), sizeof(h))) return false;
+        if (std::strncmp(h.magic, "LOOPINO", 7) != 0 || h.version > PresetLoader::VERSION) return false;
+        e.version = h.version;
+        const size_t values = sizeof(h) + PresetValues::size(h.version);
+        if (PresetValues::has(PresetValues::FILTERORDER, h.version)) {
+            in.seekg(sizeof(h) + PresetValues::offset(PresetValues::FILTERORDER, h.version));
+            in.read(reinterpret_cast<char*>(e.filterOrder), sizeof(e.filterOrder));
+            in.seekg(sizeof(h) + PresetValues::offset(PresetValues::MACHINEORDER, h.version));
+            in.read(reinterpret_cast<char*>(e.machineOrder), sizeof(e.machineOrder));
+        }
+        in.seekg(values);
+        uint64_t section = 0;
+        if (h.version > 16) {
+            // section size, then "LPSM" and the frame count
+            char s[16];
+            if (in.read(s, sizeof(s)) && std::memcmp(s + 8, "LPSM", 4) == 0) {
+                std::memcpy(&section, s, sizeof(section));
+                std::memcpy(&e.frames, s + 12, sizeof(e.frames));
+            }
+        } else {
+            in.read(reinterpret_cast<char*>(&e.frames), sizeof(e.frames));
+        }
+        if (h.version > 17) {
+            // the zones follow the rate
+            in.clear();
+            in.seekg(values + sizeof(section) + section);
+            in.read(reinterpret_cast<char*>(&e.rate), sizeof(e.rate));
+        } else if (h.version > 12 && e.size >= values + 4) {
+            in.clear();
+            in.seekg(e.size - 4);
+            in.read(reinterpret_cast<char*>(&e.rate), sizeof(e.rate));
+        }
+        return (bool)in;
+    }
+
+    static int16_t detectKey(const std::string& path) {
+        PresetLoader::Request req;
+        req.file = path;
+        auto r = PresetLoader::load(req);
+        if (!r->ok || !r->sample.samples) return 128;
+        float freq = 0.0f;
+        int16_t cor = 0;
+        const float sr = (float)(r->storedRate ? r->storedRate : 48000);
+        const int key = PitchTracker::getPitch(r->sample.samples, r->sample.frames, 1, sr, &cor, &freq);
+        return freq > 0.0f ? (int16_t)key : 128;
+    }
+
+    bool stopped() const {
+        return stop.load(std::memory_order_relaxed);
+    }
+
+    void run() {
+        for (;;) {
+            while (again.exchange(false) && !stopped()) scan();
+            running.store(false);
+            // a refresh() could come in between the loop end and here
+            if (!again.load() || stopped() || running.exchange(true)) return;
+        }
+    }
+
+    void scan() {
+        bool changed = false;
+        auto l = std::make_shared<List>(*entries());
+        const int64_t t = timeOf(dir);
+        if (t != dirTime) {
+            // the folder changed, pick up new and removed presets
+            std::error_code ec;
+            List found;
+            for (auto& f : std::filesystem::directory_iterator(dir, ec)) {
+                if (f.path().extension() != ".presets") continue;
+                const std::string name = f.path().stem().u8string();
+                auto it = std::find_if(l->begin(), l->end(),
+                                    [&](const Entry& x) { return x.name == name; });
+                if (it != l->end()) found.push_back(*it);
+                else found.push_back(Entry{ name });
+            }
+            changed = found.size() != l->size();
+            *l = std::move(found);
+            dirTime = t;
+        }
+        // parse the new and the rewritten ones
+        for (auto it = l->begin(); it != l->end();) {
+            if (stopped()) return;
+            const std::filesystem::path p = path(it->name);
+            std::error_code ec;
+            const uint64_t size = std::filesystem::file_size(p, ec);
+            if (!ec && it->mtime == timeOf(p) && it->size == size) {
+                ++it;
+                continue;
+            }
+            changed = true;
+            if (!parse(p, *it)) it = l->erase(it);
+            else ++it;
+        }
+        sortList(*l);
+        if (changed) publish(std::make_shared<List>(*l));
+
+        // root keys, the slow part, published in batches
+        int pending = 0;
+        for (auto& e : *l) {
+            if (stopped() || !keys.load(std::memory_order_relaxed)) break;
+            if (e.rootkey >= 0) continue;
+            e.rootkey = detectKey(path(e.name).u8string());
+            changed = true;
+            if (++pending == 16) {
+                publish(std::make_shared<List>(*l));
+                pending = 0;
+            }
+            // leave the cores to the audio and the GUI
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        if (stopped()) return;
+        if (pending) publish(std::make_shared<List>(*l));
+        if (changed) writeIndex(*l, dirTime);
+    }
+
+    std::filesystem::path path(const std::string& name) const {
+        return std::filesystem::path(dir) / (name + ".presets");
+    }
+
+/****************************************************************
+        the index file
+****************************************************************/
+
+    template <typename T>
+    static void put(std::ofstream& out, const T& v) {
+        out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+
+    template <typename T>
+    static void get(std::ifstream& in, T& v) {
+        in.read(reinterpret_cast<char*>(&v), sizeof(T));
+    }
+
+    void writeIndex(const List& l, int64_t folderTime) const {
+        const std::string tmp = file + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) return;
+            out.write("LPIX", 4);
+            put(out, INDEX_VERSION);
+            put(out, folderTime);
+            put(out, (uint32_t)l.size());
+            for (const auto& e : l) {
+                put(out, (uint16_t)e.name.size());
+                out.write(e.name.data(), e.name.size());
+                put(out, e.mtime);
+                put(out, e.size);
+                put(out, e.version);
+                put(out, e.frames);
+                put(out, e.rate);
+                put(out, e.rootkey);
+                put(out, e.filterOrder);
+                put(out, e.machineOrder);
+            }
+            if (!out) return;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, file, ec);
+    }
+
+    bool readIndex(List& l, int64_t& folderTime) const {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) return false;
+        char magic[4];
+        uint32_t version = 0;
+        uint32_t count = 0;
+        in.read(magic, 4);
+        get(in, version);
+        get(in, folderTime);
+        get(in, count);
+        if (!in || std::memcmp(magic, "LPIX", 4) != 0 || version != INDEX_VERSION) return false;
+        for (uint32_t i = 0; i < count; ++i) {
+            Entry e;
+            uint16_t n = 0;
+            get(in, n);
+            e.name.resize(n);
+            in.read(&e.name[0], n);
+            get(in, e.mtime);
+            get(in, e.size);
+            get(in, e.version);
+            get(in, e.frames);
+            get(in, e.rate);
+            get(in, e.rootkey);
+            get(in, e.filterOrder);
+            get(in, e.machineOrder);
+            if (!in) {
+                l.clear();
+                return false;
+            }
+            l.push_back(std::move(e));
+        }
+        sortList(l);
+        return true;
+    }
+};
+
+#endif
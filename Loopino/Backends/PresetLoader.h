@@ -0,0 +1,389 @@
+
+/*
+ * PresetLoader.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+        PresetLoader.h - load a preset in a background thread
+                         read -> decode samples -> resample ->
+                         pitch -> loop. The controller values
+                         are handed over as raw block, the GUI
+                         read them into the widgets when it swap
+                         the preset in. A new start() cancel the
+                         running load, a cancelled load never
+                         deliver.
+                         prefetch() keep a list of presets decoded
+                         in memory, a start() for one of them
+                         deliver at once.
+                         Since version 18 the stored rate is
+                         followed by the key/velocity zones:
+                         uint32 count, then for each zone the
+                         key and velocity range (4 uint8), loop
+                         start and end (uint32), root frequency
+                         (float), rate (uint32) and a sample
+                         section like the main one.
+****************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <map>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+#include "CheckResample.h"
+#include "PresetSamples.h"
+#include "PresetValues.h"
+#include "SampleLoader.h"
+
+#ifndef PRESETLOADER_H
+#define PRESETLOADER_H
+
+struct PresetHeader {
+    char magic[8];
+    uint32_t version;
+    uint64_t dataSize;
+};
+
+class PresetLoader {
+public:
+    static constexpr uint32_t VERSION = 18;     // the newest we could read
+    static constexpr uint32_t MAX_ZONES = 15;   // beside the main sample
+
+    struct Request {
+        std::string file;
+        uint32_t rate = 0;                      // 0 keep the stored rate
+    };
+
+    // a key/velocity zone, since version 18
+    struct Zone {
+        uint8_t loKey = 0;
+        uint8_t hiKey = 127;
+        uint8_t loVel = 0;
+        uint8_t hiVel = 127;
+        uint32_t loopStart = 0;                 // at rate, no loop when end <= start
+        uint32_t loopEnd = 0;
+        float rootFreq = 0.0f;
+        uint32_t rate = 0;                      // the requested one, or the stored one
+        std::vector<float> samples;
+    };
+
+    struct Result {
+        std::string file;
+        std::filesystem::file_time_type mtime{};
+        uint32_t rate = 0;                      // the requested one
+        bool ok = false;
+        PresetHeader header{};
+        std::string values;                     // the controller values
+        uint32_t storedRate = 0;                // 0 for presets before version 13
+        bool analysed = false;                  // pitch and loop are in sample
+        SampleLoader::Result sample;            // at the requested rate, or the stored one
+        std::vector<Zone> zones;
+    };
+
+    // the whole load in the calling thread, the worker run it too
+    static std::unique_ptr<Result> load(const Request& req, const std::atomic<bool>* cancel = nullptr) {
+        auto r = std::make_unique<Result>();
+        r->file = req.file;
+        r->rate = req.rate;
+        std::error_code ec;
+        r->mtime = std::filesystem::last_write_time(req.file, ec);
+        std::vector<char> data;
+        if (!readFile(req.file, data) || data.size() < sizeof(PresetHeader)) {
+            std::cerr << "Error: could not read preset " << req.file << std::endl;
+            return r;
+        }
+        std::memcpy(&r->header, data.data(), sizeof(PresetHeader));
+        if (std::strncmp(r->header.magic, "LOOPINO", 7) != 0) {
+            std::cerr << "Invalid preset file\n";
+            return r;
+        }
+        // we need to update VERSION when change the preset format
+        if (r->header.version > VERSION) {
+            std::cerr << "Warning: newer preset version (" << r->header.version << ")\n";
+            return r;
+        }
+        size_t pos = sizeof(PresetHeader);
+        const size_t vsize = PresetValues::size(r->header.version);
+        if (pos + vsize > data.size()) return r;
+        r->values.assign(data.data() + pos, vsize);
+        pos += vsize;
+        r->ok = true;
+
+        SampleLoader::Result& s = r->sample;
+        const bool haveSamples = r->header.version > 16 ?
+                readSampleSection(data, pos, s.samples, s.frames) :
+                readSampleBuffer(data, pos, s.samples, s.frames);
+        if (haveSamples && r->header.version > 12 && pos + sizeof(uint32_t) <= data.size()) {
+            std::memcpy(&r->storedRate, data.data() + pos, sizeof(uint32_t));
+            pos += sizeof(uint32_t);
+        }
+        if (haveSamples && r->header.version > 17)
+            readZones(data, pos, req.rate, r->zones, cancel);
+        if (!haveSamples || !req.rate || cancelled(cancel)) return r;
+
+        s.fileRate = r->storedRate ? r->storedRate : req.rate;
+        if (s.fileRate != req.rate) {
+            CheckResample rs;
+            s.samples = rs.checkSampleRate(&s.frames, 1, s.samples, s.fileRate, req.rate);
+        }
+        if (!s.samples || cancelled(cancel)) return r;
+
+        float loopSize = 1.0f;
+        std::memcpy(&loopSize, r->values.data() +
+            PresetValues::offset(PresetValues::LOOPSIZE, r->header.version), sizeof(float));
+        s.rootkey = PitchTracker::getPitch(s.samples, s.frames, 1, (float)req.rate,
+                                                    &s.pitchCorrection, &s.freq);
+        if (s.freq > 0.0f && !cancelled(cancel))
+            s.haveLoop = s.lg.generateLoop(s.samples, 0, s.frames, s.frames, 1, req.rate,
+                        s.freq, s.loopBuffer, s.loop, std::max(1, (int)loopSize));
+        s.ok = true;
+        r->analysed = !cancelled(cancel);
+        return r;
+    }
+
+    ~PresetLoader() {
+        cancel();
+        cancelPrefetch();
+        for (auto& r : running)
+            if (r.thread.joinable()) r.thread.join();
+    }
+
+    // GUI thread
+    void start(const Request& req) {
+        reap();
+        cancel();
+        auto job = std::make_shared<Job>();
+        std::lock_guard<std::mutex> g(m);
+        current = job;
+        result.reset();
+        auto it = cache.find(req.file);
+        if (it != cache.end()) {
+            std::unique_ptr<Result> hit = std::move(it->second);
+            cache.erase(it);
+            std::error_code ec;
+            if (hit->rate == req.rate &&
+                    std::filesystem::last_write_time(req.file, ec) == hit->mtime) {
+                result = std::move(hit);
+                return;
+            }
+        }
+        running.push_back({ job, std::thread(&PresetLoader::run, this, job, req) });
+    }
+
+    // GUI thread, keep files decoded at rate, nearest first,
+    // drop every other cached preset
+    void prefetch(const std::vector<std::string>& files, uint32_t rate) {
+        reap();
+        cancelPrefetch();
+        std::vector<std::string> missing;
+        auto job = std::make_shared<Job>();
+        {
+            std::lock_guard<std::mutex> g(m);
+            std::map<std::string, std::unique_ptr<Result>> keep;
+            for (const auto& f : files) {
+                auto it = cache.find(f);
+                if (it != cache.end() && it->second->rate == rate) {
+                    keep[f] = std::move(it->second);
+                } else if (!keep.count(f) &&
+                        std::find(missing.begin(), missing.end(), f) == missing.end()) {
+                    missing.push_back(f);
+                }
+            }
+            cache.swap(keep);
+            prefetchJob = job;
+        }
+        if (missing.empty() || !rate) return;
+        running.push_back({ job, std::thread(&PresetLoader::runPrefetch, this, job,
+                                                        std::move(missing), rate) });
+    }
+
+    void cancelPrefetch() {
+        std::lock_guard<std::mutex> g(m);
+        if (prefetchJob) prefetchJob->cancel.store(true, std::memory_order_relaxed);
+        prefetchJob.reset();
+    }
+
+    void clearCache() {
+        cancelPrefetch();
+        std::lock_guard<std::mutex> g(m);
+        cache.clear();
+    }
+
+    void cancel() {
+        std::lock_guard<std::mutex> g(m);
+        if (current) current->cancel.store(true, std::memory_order_relaxed);
+        current.reset();
+    }
+
+    bool busy() const {
+        std::lock_guard<std::mutex> g(m);
+        return current != nullptr;
+    }
+
+    // GUI thread, the finished load of the latest request, if any
+    std::unique_ptr<Result> take() {
+        reap();
+        std::lock_guard<std::mutex> g(m);
+        if (result) current.reset();
+        return std::move(result);
+    }
+
+private:
+    struct Job {
+        std::atomic<bool> cancel { false };
+        std::atomic<bool> finished { false };
+    };
+
+    struct Running {
+        std::shared_ptr<Job> job;
+        std::thread thread;
+    };
+
+    mutable std::mutex m;
+    std::shared_ptr<Job> current;
+    std::shared_ptr<Job> prefetchJob;
+    std::unique_ptr<Result> result;
+    std::map<std::string, std::unique_ptr<Result>> cache;
+    std::vector<Running> running;
+
+    static bool cancelled(const std::atomic<bool>* c) {
+        return c && c->load(std::memory_order_relaxed);
+    }
+
+    static bool readFile(const std::string& file, std::vector<char>& data) {
+        std::ifstream in(file, std::ios::binary | std::ios::ate);
+        if (!in) return false;
+        const std::streamoff size = in.tellg();
+        if (size <= 0) return false;
+        data.resize((size_t)size);
+        in.seekg(0);
+        in.read(data.data(), size);
+        return (bool)in;
+    }
+
+    // since version 17 the samples are one coded block (see PresetSamples.h)
+    static bool readSampleSection(const std::vector<char>& data, size_t& pos,
+                                            float*& samples, uint32_t& frames) {
+        uint64_t size = 0;
+        if (pos + sizeof(size) > data.size()) return false;
+        std::memcpy(&size, data.data() + pos, sizeof(size));
+        pos += sizeof(size);
+        if (!size || size > MAX_SAMPLE_SECTION || pos + size > data.size()) return false;
+        const uint8_t* block = reinterpret_cast<const uint8_t*>(data.data() + pos);
+        pos += size;
+        return PresetSamples::decode(block, size, samples, frames);
+    }
+
+    // since version 18, behind the stored rate, brought to rate when given
+    static void readZones(const std::vector<char>& data, size_t& pos, uint32_t rate,
+                            std::vector<Zone>& zones, const std::atomic<bool>* cancel) {
+        uint32_t count = 0;
+        if (!readRaw(data, pos, count)) return;
+        for (uint32_t i = 0; i < std::min(count, MAX_ZONES) && !cancelled(cancel); ++i) {
+            Zone z;
+            uint32_t storedRate = 0;
+            if (!readRaw(data, pos, z.loKey) || !readRaw(data, pos, z.hiKey) ||
+                !readRaw(data, pos, z.loVel) || !readRaw(data, pos, z.hiVel) ||
+                !readRaw(data, pos, z.loopStart) || !readRaw(data, pos, z.loopEnd) ||
+                !readRaw(data, pos, z.rootFreq) || !readRaw(data, pos, storedRate)) return;
+            float* samples = nullptr;
+            uint32_t frames = 0;
+            if (!readSampleSection(data, pos, samples, frames)) return;
+            z.rate = storedRate;
+            if (rate && storedRate && storedRate != rate) {
+                CheckResample rs;
+                samples = rs.checkSampleRate(&frames, 1, samples, storedRate, rate);
+                const double f = double(rate) / double(storedRate);
+                z.loopStart = (uint32_t)(z.loopStart * f);
+                z.loopEnd = (uint32_t)(z.loopEnd * f);
+                z.rate = rate;
+            }
+            if (!samples || !z.rate) {
+                delete[] samples;
+                continue;
+            }
+            z.samples.assign(samples, samples + frames);
+            delete[] samples;
+            if (z.loopEnd > z.samples.size()) z.loopStart = z.loopEnd = 0;
+            zones.push_back(std::move(z));
+        }
+    }
+
+    template <typename T>
+    static bool readRaw(const std::vector<char>& data, size_t& pos, T& v) {
+        if (pos + sizeof(T) > data.size()) return false;
+        std::memcpy(&v, data.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    // up to version 16, one int16 per sample
+    static bool readSampleBuffer(const std::vector<char>& data, size_t& pos,
+                                            float*& samples, uint32_t& frames) {
+        uint32_t n = 0;
+        if (pos + sizeof(n) > data.size()) return false;
+        std::memcpy(&n, data.data() + pos, sizeof(n));
+        pos += sizeof(n);
+        if (!n || pos + size_t(n) * sizeof(int16_t) > data.size()) return false;
+        std::vector<int16_t> pcm(n);
+        std::memcpy(pcm.data(), data.data() + pos, n * sizeof(int16_t));
+        pos += n * sizeof(int16_t);
+        samples = new float[n];
+        for (uint32_t i = 0; i < n; ++i)
+            samples[i] = static_cast<float>(pcm[i]) / 32767.0f;
+        frames = n;
+        return true;
+    }
+
+    // join the threads which are done
+    void reap() {
+        for (auto it = running.begin(); it != running.end();) {
+            if (it->job->finished.load(std::memory_order_acquire)) {
+                if (it->thread.joinable()) it->thread.join();
+                it = running.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void run(std::shared_ptr<Job> job, Request req) {
+        auto r = load(req, &job->cancel);
+        {
+            std::lock_guard<std::mutex> g(m);
+            if (job == current && !cancelled(&job->cancel)) result = std::move(r);
+        }
+        job->finished.store(true, std::memory_order_release);
+    }
+
+    // one after the other, a program change could need the first soon
+    void runPrefetch(std::shared_ptr<Job> job, std::vector<std::string> files, uint32_t rate) {
+        for (const auto& f : files) {
+            if (cancelled(&job->cancel)) break;
+            Request req;
+            req.file = f;
+            req.rate = rate;
+            auto r = load(req, &job->cancel);
+            if (!r->ok || !r->analysed) continue;
+            std::lock_guard<std::mutex> g(m);
+            if (job != prefetchJob || cancelled(&job->cancel)) break;
+            cache[f] = std::move(r);
+        }
+        job->finished.store(true, std::memory_order_release);
+    }
+};
+
+#endif
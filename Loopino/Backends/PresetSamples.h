@@ -0,0 +1,280 @@
+
+/*
+ * PresetSamples.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+        PresetSamples.h - the sample section of a preset (version 17)
+                          encoded into one memory block, so a
+                          preset or state write it with one call.
+                          The sample get cut in chunks, each chunk
+                          is block converted to int16 (peak scaled)
+                          and optional FLAC compressed by libsndfile
+                          in memory, or stored as raw float32.
+                          Chunks are coded in parallel.
+
+        section:  Header, then per chunk a ChunkHeader + payload
+****************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <sndfile.h>
+
+#include "SampleFormat.h"
+
+#ifndef PRESETSAMPLES_H
+#define PRESETSAMPLES_H
+
+// upper bound for a stored section, guard against damaged sizes
+#define MAX_SAMPLE_SECTION  (uint64_t(1) << 34)
+
+class PresetSamples {
+public:
+    enum Storage : uint8_t {
+        FLAC16 = 0,     // int16, lossless compressed
+        INT16,          // int16, raw
+        FLOAT32         // float, raw
+    };
+
+    static constexpr uint32_t CHUNK = 1 << 18;   // frames per chunk
+
+    // the whole section as one block
+    static std::vector<uint8_t> encode(const float* samples, uint32_t frames, Storage storage) {
+        std::vector<uint8_t> out;
+        Header h;
+        std::memcpy(h.magic, "LPSM", 4);
+        h.frames = samples ? frames : 0;
+        h.chunkFrames = CHUNK;
+        h.storage = storage;
+        h.scale = (storage == FLOAT32 || !h.frames) ? 1.0f : SampleCodec::int16Scale(samples, frames);
+        put(out, &h, sizeof(h));
+        if (!h.frames) return out;
+
+        const size_t chunks = (h.frames + CHUNK - 1) / CHUNK;
+        std::vector<std::vector<uint8_t>> coded(chunks);
+        forEachChunk(chunks, [&](size_t c) {
+            const uint32_t from = uint32_t(c * CHUNK);
+            const uint32_t n = std::min(CHUNK, h.frames - from);
+            encodeChunk(samples + from, n, storage, h.scale, coded[c]);
+        });
+        size_t total = out.size();
+        for (auto& c : coded) total += c.size();
+        out.reserve(total);
+        for (auto& c : coded) put(out, c.data(), c.size());
+        return out;
+    }
+
+    // samples get a new[] buffer, false on a damaged section
+    static bool decode(const uint8_t* data, size_t size, float*& samples, uint32_t& frames) {
+        Header h;
+        if (size < sizeof(h)) return false;
+        std::memcpy(&h, data, sizeof(h));
+        if (std::memcmp(h.magic, "LPSM", 4) != 0 || !h.chunkFrames) return false;
+        frames = h.frames;
+        if (!frames) return false;
+
+        // find the chunks first, then decode them in parallel
+        struct Span { size_t offset; ChunkHeader ch; };
+        const size_t chunks = (h.frames + h.chunkFrames - 1) / h.chunkFrames;
+        std::vector<Span> spans;
+        size_t pos = sizeof(h);
+        for (size_t c = 0; c < chunks; ++c) {
+            Span s;
+            if (pos + sizeof(ChunkHeader) > size) return false;
+            std::memcpy(&s.ch, data + pos, sizeof(ChunkHeader));
+            s.offset = pos + sizeof(ChunkHeader);
+            if (s.offset + s.ch.bytes > size || s.ch.frames > h.chunkFrames) return false;
+            pos = s.offset + s.ch.bytes;
+            spans.push_back(s);
+        }
+        try {
+            samples = new float[frames];
+        } catch (...) {
+            return false;
+        }
+        std::atomic<bool> ok { true };
+        forEachChunk(chunks, [&](size_t c) {
+            const uint32_t from = uint32_t(c * h.chunkFrames);
+            const uint32_t n = std::min(h.chunkFrames, h.frames - from);
+            if (spans[c].ch.frames != n ||
+                !decodeChunk(data + spans[c].offset, spans[c].ch, h.scale, samples + from))
+                ok.store(false, std::memory_order_relaxed);
+        });
+        if (!ok.load(std::memory_order_relaxed)) {
+            delete[] samples;
+            samples = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct Header {
+        char magic[4];
+        uint32_t frames;
+        uint32_t chunkFrames;
+        float scale;            // int16 step
+        uint8_t storage;
+        uint8_t reserved[3];
+    };
+
+    struct ChunkHeader {
+        uint8_t codec;          // Storage of this chunk
+        uint8_t reserved[3];
+        uint32_t frames;
+        uint32_t bytes;
+    };
+
+    static void put(std::vector<uint8_t>& out, const void* p, size_t n) {
+        const uint8_t* b = static_cast<const uint8_t*>(p);
+        out.insert(out.end(), b, b + n);
+    }
+
+    template <typename F>
+    static void forEachChunk(size_t chunks, F fn) {
+        const size_t threads = std::min<size_t>(chunks,
+                        std::max(1u, std::min(8u, std::thread::hardware_concurrency())));
+        if (threads < 2) {
+            for (size_t c = 0; c < chunks; ++c) fn(c);
+            return;
+        }
+        std::atomic<size_t> next { 0 };
+        std::vector<std::thread> pool;
+        for (size_t t = 0; t < threads; ++t)
+            pool.emplace_back([&]() {
+                for (size_t c; (c = next.fetch_add(1)) < chunks;) fn(c);
+            });
+        for (auto& t : pool) t.join();
+    }
+
+    static void encodeChunk(const float* in, uint32_t n, Storage storage, float scale,
+                                                        std::vector<uint8_t>& out) {
+        ChunkHeader ch{};
+        ch.frames = n;
+        ch.codec = storage;
+        std::vector<uint8_t> payload;
+        if (storage == FLOAT32) {
+            payload.resize(n * sizeof(float));
+            std::memcpy(payload.data(), in, payload.size());
+        } else {
+            std::vector<int16_t> pcm(n);
+            SampleCodec::toInt16(in, pcm.data(), n, scale);
+            // keep it raw when the codec isn't there
+            if (storage != FLAC16 || !flacEncode(pcm.data(), n, payload)) {
+                ch.codec = INT16;
+                payload.resize(n * sizeof(int16_t));
+                std::memcpy(payload.data(), pcm.data(), payload.size());
+            }
+        }
+        ch.bytes = (uint32_t)payload.size();
+        out.reserve(sizeof(ch) + payload.size());
+        put(out, &ch, sizeof(ch));
+        put(out, payload.data(), payload.size());
+    }
+
+    static bool decodeChunk(const uint8_t* p, const ChunkHeader& ch, float scale, float* out) {
+        switch (ch.codec) {
+            case FLOAT32:
+                if (ch.bytes != ch.frames * sizeof(float)) return false;
+                std::memcpy(out, p, ch.bytes);
+                return true;
+            case INT16: {
+                if (ch.bytes != ch.frames * sizeof(int16_t)) return false;
+                std::vector<int16_t> pcm(ch.frames);
+                std::memcpy(pcm.data(), p, ch.bytes);
+                SampleCodec::fromInt16(pcm.data(), out, ch.frames, scale);
+                return true;
+            }
+            case FLAC16: {
+                std::vector<int16_t> pcm(ch.frames);
+                if (!flacDecode(p, ch.bytes, pcm.data(), ch.frames)) return false;
+                SampleCodec::fromInt16(pcm.data(), out, ch.frames, scale);
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+/****************************************************************
+        libsndfile virtual io on a memory buffer
+****************************************************************/
+
+    struct MemIO {
+        std::vector<uint8_t>* buf = nullptr;    // write target
+        const uint8_t* data = nullptr;          // read source
+        sf_count_t size = 0;
+        sf_count_t pos = 0;
+    };
+
+    static SF_VIRTUAL_IO& vio() {
+        static SF_VIRTUAL_IO io = {
+            [](void* u) -> sf_count_t { return static_cast<MemIO*>(u)->size; },
+            [](sf_count_t off, int whence, void* u) -> sf_count_t {
+                MemIO* m = static_cast<MemIO*>(u);
+                sf_count_t p = whence == SEEK_SET ? off : whence == SEEK_CUR ? m->pos + off : m->size + off;
+                m->pos = std::max<sf_count_t>(0, p);
+                return m->pos;
+            },
+            [](void* ptr, sf_count_t count, void* u) -> sf_count_t {
+                MemIO* m = static_cast<MemIO*>(u);
+                const sf_count_t n = std::max<sf_count_t>(0, std::min(count, m->size - m->pos));
+                std::memcpy(ptr, m->data + m->pos, (size_t)n);
+                m->pos += n;
+                return n;
+            },
+            [](const void* ptr, sf_count_t count, void* u) -> sf_count_t {
+                MemIO* m = static_cast<MemIO*>(u);
+                if (m->pos + count > (sf_count_t)m->buf->size()) m->buf->resize((size_t)(m->pos + count));
+                std::memcpy(m->buf->data() + m->pos, ptr, (size_t)count);
+                m->pos += count;
+                m->size = std::max(m->size, m->pos);
+                m->data = m->buf->data();
+                return count;
+            },
+            [](void* u) -> sf_count_t { return static_cast<MemIO*>(u)->pos; }
+        };
+        return io;
+    }
+
+    static bool flacEncode(const int16_t* pcm, uint32_t n, std::vector<uint8_t>& out) {
+        out.clear();
+        out.reserve(n);
+        MemIO m;
+        m.buf = &out;
+        SF_INFO info{};
+        info.channels = 1;
+        info.samplerate = 48000;    // FLAC need one, the preset store the real rate
+        info.format = SF_FORMAT_FLAC | SF_FORMAT_PCM_16;
+        SNDFILE* sf = sf_open_virtual(&vio(), SFM_WRITE, &info, &m);
+        if (!sf) return false;
+        const bool ok = sf_write_short(sf, pcm, n) == (sf_count_t)n;
+        sf_close(sf);
+        out.resize((size_t)m.size);
+        return ok && !out.empty();
+    }
+
+    static bool flacDecode(const uint8_t* p, uint32_t bytes, int16_t* pcm, uint32_t n) {
+        MemIO m;
+        m.data = p;
+        m.size = bytes;
+        SF_INFO info{};
+        SNDFILE* sf = sf_open_virtual(&vio(), SFM_READ, &info, &m);
+        if (!sf) return false;
+        const bool ok = info.channels == 1 && sf_read_short(sf, pcm, n) == (sf_count_t)n;
+        sf_close(sf);
+        return ok;
+    }
+};
+
+#endif
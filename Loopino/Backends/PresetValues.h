@@ -0,0 +1,251 @@
+
+/*
+ * PresetValues.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+        PresetValues.h - the layout of the controller values
+                         behind the preset header. One entry
+                         per stored value, in file order, with
+                         the version which added it and its
+                         size. Loopino::savePreset() and
+                         Loopino::readPresetValues() walk this
+                         list, PresetLoader and PresetIndex take
+                         sizes and offsets from it. New values
+                         only get appended, with a new version.
+****************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef PRESETVALUES_H
+#define PRESETVALUES_H
+
+namespace PresetValues {
+
+enum Id : int {
+    // since version 1
+    LOOP,                // int16 loop index
+    ATTACK,
+    DECAY,
+    SUSTAIN,
+    RELEASE,
+    FREQUENCY,
+    SETLOOP,
+    LOOPSIZE,
+    // since version 3
+    RESONANCE,
+    CUTOFF,
+    // since version 4
+    SHARP,
+    // since version 5
+    SAW,
+    // since version 6
+    FADEOUT,
+    // since version 7
+    PMFREQ,
+    PMDEPTH,
+    PMMODE,
+    // since version 8
+    VIBDEPTH,
+    VIBRATE,
+    TREMDEPTH,
+    TREMRATE,
+    // since version 9
+    HPRESONANCE,
+    HPCUTOFF,
+    // since version 10
+    LPKEYTRACKING,
+    HPKEYTRACKING,
+    VELMODE,
+    // since version 11
+    VOLUME,
+    OBFMODE,
+    OBFKEYTRACKING,
+    OBFRESONANCE,
+    OBFCUTOFF,
+    OBFONOFF,
+    LPONOFF,
+    HPONOFF,
+    VIBONOFF,
+    TREMONOFF,
+    CHORUSONOFF,
+    CHORUSLEV,
+    CHORUSDELAY,
+    CHORUSDEPTH,
+    CHORUSFREQ,
+    REVONOFF,
+    REVROOMSIZE,
+    REVDAMP,
+    REVMIX,
+    // since version 12
+    WASPONOFF,
+    WASPMIX,
+    WASPRESONANCE,
+    WASPCUTOFF,
+    WASPKEYTRACKING,
+    // since version 14
+    TBONOFF,
+    TBVINTAGE,
+    TBRESONANCE,
+    TBCUTOFF,
+    TONE,
+    LM_MIR8ONOFF,
+    LM_MIR8DRIVE,
+    LM_MIR8AMOUNT,
+    EMU_12ONOFF,
+    EMU_12DRIVE,
+    EMU_12AMOUNT,
+    LM_CMP12ONOFF,
+    LM_CMP12DRIVE,
+    LM_CMP12RATIO,
+    STUDIO_16ONOFF,
+    STUDIO_16DRIVE,
+    STUDIO_16WARMTH,
+    STUDIO_16HFTILT,
+    EPSONOFF,
+    EPSDRIVE,
+    // since version 15
+    TMONOFF,
+    TMTIME,
+    REVERSE,
+    FILTERORDER,         // 5 int32, the filter rack order
+    MACHINEORDER,        // 6 int32, the machine rack order
+    // since version 16
+    GENKEYCACHE,
+    COUNT
+};
+
+struct Field {
+    uint8_t since;      // first preset version holding it
+    uint8_t bytes;
+};
+
+// indexed by Id
+inline constexpr Field fields[] = {
+    // since version 1
+    { 1, 2 },    // LOOP
+    { 1, 4 },    // ATTACK
+    { 1, 4 },    // DECAY
+    { 1, 4 },    // SUSTAIN
+    { 1, 4 },    // RELEASE
+    { 1, 4 },    // FREQUENCY
+    { 1, 4 },    // SETLOOP
+    { 1, 4 },    // LOOPSIZE
+    // since version 3
+    { 3, 4 },    // RESONANCE
+    { 3, 4 },    // CUTOFF
+    // since version 4
+    { 4, 4 },    // SHARP
+    // since version 5
+    { 5, 4 },    // SAW
+    // since version 6
+    { 6, 4 },    // FADEOUT
+    // since version 7
+    { 7, 4 },    // PMFREQ
+    { 7, 4 },    // PMDEPTH
+    { 7, 4 },    // PMMODE
+    // since version 8
+    { 8, 4 },    // VIBDEPTH
+    { 8, 4 },    // VIBRATE
+    { 8, 4 },    // TREMDEPTH
+    { 8, 4 },    // TREMRATE
+    // since version 9
+    { 9, 4 },    // HPRESONANCE
+    { 9, 4 },    // HPCUTOFF
+    // since version 10
+    { 10, 4 },   // LPKEYTRACKING
+    { 10, 4 },   // HPKEYTRACKING
+    { 10, 4 },   // VELMODE
+    // since version 11
+    { 11, 4 },   // VOLUME
+    { 11, 4 },   // OBFMODE
+    { 11, 4 },   // OBFKEYTRACKING
+    { 11, 4 },   // OBFRESONANCE
+    { 11, 4 },   // OBFCUTOFF
+    { 11, 4 },   // OBFONOFF
+    { 11, 4 },   // LPONOFF
+    { 11, 4 },   // HPONOFF
+    { 11, 4 },   // VIBONOFF
+    { 11, 4 },   // TREMONOFF
+    { 11, 4 },   // CHORUSONOFF
+    { 11, 4 },   // CHORUSLEV
+    { 11, 4 },   // CHORUSDELAY
+    { 11, 4 },   // CHORUSDEPTH
+    { 11, 4 },   // CHORUSFREQ
+    { 11, 4 },   // REVONOFF
+    { 11, 4 },   // REVROOMSIZE
+    { 11, 4 },   // REVDAMP
+    { 11, 4 },   // REVMIX
+    // since version 12
+    { 12, 4 },   // WASPONOFF
+    { 12, 4 },   // WASPMIX
+    { 12, 4 },   // WASPRESONANCE
+    { 12, 4 },   // WASPCUTOFF
+    { 12, 4 },   // WASPKEYTRACKING
+    // since version 14
+    { 14, 4 },   // TBONOFF
+    { 14, 4 },   // TBVINTAGE
+    { 14, 4 },   // TBRESONANCE
+    { 14, 4 },   // TBCUTOFF
+    { 14, 4 },   // TONE
+    { 14, 4 },   // LM_MIR8ONOFF
+    { 14, 4 },   // LM_MIR8DRIVE
+    { 14, 4 },   // LM_MIR8AMOUNT
+    { 14, 4 },   // EMU_12ONOFF
+    { 14, 4 },   // EMU_12DRIVE
+    { 14, 4 },   // EMU_12AMOUNT
+    { 14, 4 },   // LM_CMP12ONOFF
+    { 14, 4 },   // LM_CMP12DRIVE
+    { 14, 4 },   // LM_CMP12RATIO
+    { 14, 4 },   // STUDIO_16ONOFF
+    { 14, 4 },   // STUDIO_16DRIVE
+    { 14, 4 },   // STUDIO_16WARMTH
+    { 14, 4 },   // STUDIO_16HFTILT
+    { 14, 4 },   // EPSONOFF
+    { 14, 4 },   // EPSDRIVE
+    // since version 15
+    { 15, 4 },   // TMONOFF
+    { 15, 4 },   // TMTIME
+    { 15, 4 },   // REVERSE
+    { 15, 20 },  // FILTERORDER
+    { 15, 24 },  // MACHINEORDER
+    // since version 16
+    { 16, 4 },   // GENKEYCACHE
+};
+
+static_assert(sizeof(fields) / sizeof(fields[0]) == COUNT, "one field per Id");
+
+constexpr bool has(int id, uint32_t version) {
+    return id >= 0 && id < COUNT && fields[id].since <= version;
+}
+
+// bytes of the values of a version
+constexpr size_t size(uint32_t version) {
+    size_t n = 0;
+    for (int i = 0; i < COUNT; ++i)
+        if (has(i, version)) n += fields[i].bytes;
+    return n;
+}
+
+// where a value start in the values of a version
+constexpr size_t offset(int id, uint32_t version) {
+    size_t n = 0;
+    for (int i = 0; i < id && i < COUNT; ++i)
+        if (has(i, version)) n += fields[i].bytes;
+    return n;
+}
+
+// stored presets must keep reading
+static_assert(size(1) == 30 && size(11) == 174 && size(14) == 274 && size(16) == 334,
+                                                "the stored layout changed");
+
+} // namespace PresetValues
+
+#endif
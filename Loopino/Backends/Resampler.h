@@ -0,0 +1,182 @@
+
+/*
+ * Resampler.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+        Resampler.h - polyphase windowed sinc sample rate
+                      conversion for whole buffers.
+                      Kaiser windowed filter bank, the cutoff
+                      follow the lower of both rates, so down
+                      sampling don't alias.
+                      Long buffers get split into segments
+                      which run in parallel, each segment
+                      read the filter length over its borders.
+****************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <numeric>
+#include <algorithm>
+
+#ifdef __SSE__
+ #include <xmmintrin.h>
+#endif
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+class Resampler {
+public:
+    static constexpr int ZERO_CROSSINGS = 16;       // per side, at the cutoff
+    static constexpr uint32_t MAX_PHASES = 1024;
+    static constexpr double KAISER_BETA = 8.6;      // about -90 dB stop band
+    static constexpr size_t SEGMENT = 1 << 16;      // output frames per job
+
+    bool setup(uint32_t fsIn, uint32_t fsOut) {
+        if (!fsIn || !fsOut) return false;
+        const uint32_t g = std::gcd(fsIn, fsOut);
+        L = fsOut / g;
+        M = fsIn / g;
+        // very odd ratios use the nearest of MAX_PHASES phases
+        phases = std::min(L, MAX_PHASES);
+        ratio = double(fsIn) / double(fsOut);
+        const double fc = std::min(1.0, double(L) / double(M)) * 0.97;
+        half = (int)std::ceil(ZERO_CROSSINGS / fc);
+        taps = ((2 * half) + 3) & ~3;               // multiple of 4 for SSE
+        bank.assign((size_t)phases * taps, 0.0f);
+        const double i0b = besselI0(KAISER_BETA);
+        for (uint32_t p = 0; p < phases; ++p) {
+            const double frac = double(p) / double(phases);
+            float* h = &bank[(size_t)p * taps];
+            double sum = 0.0;
+            for (int k = 0; k < 2 * half; ++k) {
+                // tap k weight input sample ip - half + 1 + k
+                const double x = double(k - half + 1) - frac;
+                const double r = x / double(half);
+                if (std::fabs(r) >= 1.0) continue;
+                const double w = besselI0(KAISER_BETA * std::sqrt(1.0 - r * r)) / i0b;
+                const double v = fc * sinc(fc * x) * w;
+                h[k] = (float)v;
+                sum += v;
+            }
+            // unity gain at DC for every phase
+            if (sum != 0.0)
+                for (int k = 0; k < 2 * half; ++k) h[k] = (float)(h[k] / sum);
+        }
+        return true;
+    }
+
+    size_t outputFrames(size_t inFrames) const {
+        return (size_t)std::ceil(double(inFrames) * double(L) / double(M));
+    }
+
+    // resample interleaved input into out (outputFrames(count) * chan)
+    void process(const float* in, size_t count, uint32_t chan, float* out) const {
+        const size_t outFrames = outputFrames(count);
+        if (!outFrames) return;
+        const size_t jobs = (outFrames + SEGMENT - 1) / SEGMENT;
+        const size_t threads = std::min<size_t>(jobs,
+                        std::max(1u, std::min(8u, std::thread::hardware_concurrency())));
+        if (threads <= 1) {
+            run(in, count, chan, out, 0, outFrames);
+            return;
+        }
+        std::vector<std::thread> pool;
+        pool.reserve(threads);
+        const size_t per = ((outFrames + threads - 1) / threads + 3) & ~size_t(3);
+        for (size_t t = 0; t < threads; ++t) {
+            const size_t n0 = t * per;
+            const size_t n1 = std::min(outFrames, n0 + per);
+            if (n0 >= n1) break;
+            pool.emplace_back([=]() { run(in, count, chan, out, n0, n1); });
+        }
+        for (auto& th : pool) th.join();
+    }
+
+private:
+    uint32_t L = 1;
+    uint32_t M = 1;
+    uint32_t phases = 1;
+    double ratio = 1.0;
+    int half = ZERO_CROSSINGS;
+    int taps = 2 * ZERO_CROSSINGS;
+    std::vector<float> bank;
+
+    static double sinc(double x) {
+        if (std::fabs(x) < 1e-9) return 1.0;
+        const double px = M_PI * x;
+        return std::sin(px) / px;
+    }
+
+    static double besselI0(double x) {
+        double sum = 1.0, term = 1.0;
+        const double q = x * x * 0.25;
+        for (int k = 1; k < 64; ++k) {
+            term *= q / double(k * k);
+            sum += term;
+            if (term < sum * 1e-12) break;
+        }
+        return sum;
+    }
+
+    // output frames n0 .. n1
+    void run(const float* in, size_t count, uint32_t chan, float* out,
+                                            size_t n0, size_t n1) const {
+        for (size_t n = n0; n < n1; ++n) {
+            size_t ip;
+            uint32_t p;
+            if (phases == L) {
+                const uint64_t num = (uint64_t)n * M;
+                ip = (size_t)(num / L);
+                p = (uint32_t)(num % L);
+            } else {
+                const double pos = double(n) * ratio;
+                ip = (size_t)pos;
+                p = (uint32_t)std::lrint((pos - double(ip)) * phases);
+                if (p == phases) { p = 0; ip++; }
+            }
+            const float* h = &bank[(size_t)p * taps];
+            const long first = (long)ip - half + 1;
+            if (chan == 1 && first >= 0 && (size_t)(first + taps) <= count) {
+                out[n] = dot(in + first, h);
+                continue;
+            }
+            // border or interleaved, clamp to the edge samples
+            for (uint32_t c = 0; c < chan; ++c) {
+                float acc = 0.0f;
+                for (int k = 0; k < 2 * half; ++k) {
+                    long idx = std::clamp<long>(first + k, 0, (long)count - 1);
+                    acc += in[(size_t)idx * chan + c] * h[k];
+                }
+                out[n * chan + c] = acc;
+            }
+        }
+    }
+
+    inline float dot(const float* x, const float* h) const {
+#ifdef __SSE__
+        __m128 acc = _mm_setzero_ps();
+        for (int k = 0; k < taps; k += 4)
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(h + k)));
+        float r[4];
+        _mm_storeu_ps(r, acc);
+        return (r[0] + r[1]) + (r[2] + r[3]);
+#else
+        float acc = 0.0f;
+        for (int k = 0; k < taps; ++k) acc += x[k] * h[k];
+        return acc;
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,240 @@
+
+/*
+ * SampleLoader.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+        SampleLoader.h - load a sample in a background thread
+                         decode -> resample -> pitch -> loop
+                         the GUI poll the progress and take
+                         the finished Result to swap it in.
+                         A new start() cancel the running load,
+                         a cancelled load never deliver.
+                         A long file only come as decimated
+                         overview along with the stream.
+****************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+
+#include "AudioFile.h"
+#include "PitchTracker.h"
+#include "LoopGenerator.h"
+#include "DiskStream.h"
+
+#ifndef SAMPLELOADER_H
+#define SAMPLELOADER_H
+
+class SampleLoader {
+public:
+    enum Stage : int {
+        IDLE = 0,
+        DECODE,
+        ANALYSE,
+        LOOP,
+        DONE,
+        FAILED
+    };
+
+    struct Request {
+        std::string file;
+        uint32_t rate = 0;
+        Downmix downmix = Downmix::Left;
+        std::string cacheDir;
+        int loopPeriods = 1;
+    };
+
+    struct Result {
+        std::string file;
+        bool ok = false;
+        float* samples = nullptr;           // new[], mono at the requested rate
+        uint32_t frames = 0;
+        uint32_t fileRate = 0;
+        uint32_t overviewRate = 0;          // rate of samples when they are a overview
+        float freq = 0.0f;
+        int16_t pitchCorrection = 0;
+        uint8_t rootkey = 0;
+        std::shared_ptr<const StreamSource> stream;
+        bool haveLoop = false;
+        LoopGenerator lg;
+        LoopGenerator::LoopInfo loop;
+        std::vector<float> loopBuffer;
+
+        Result() = default;
+        Result(const Result&) = delete;
+        Result& operator=(const Result&) = delete;
+        ~Result() { delete[] samples; }
+    };
+
+    ~SampleLoader() {
+        cancel();
+        for (auto& r : running)
+            if (r.thread.joinable()) r.thread.join();
+    }
+
+    // GUI thread
+    void start(const Request& req) {
+        reap();
+        cancel();
+        auto job = std::make_shared<Job>();
+        {
+            std::lock_guard<std::mutex> g(m);
+            current = job;
+            result.reset();
+        }
+        running.push_back({ job, std::thread(&SampleLoader::run, this, job, req) });
+    }
+
+    void cancel() {
+        std::lock_guard<std::mutex> g(m);
+        if (current) current->progress.cancel.store(true, std::memory_order_relaxed);
+        current.reset();
+    }
+
+    bool busy() const {
+        std::lock_guard<std::mutex> g(m);
+        return current && current->stage.load(std::memory_order_relaxed) < DONE;
+    }
+
+    Stage stage() const {
+        std::lock_guard<std::mutex> g(m);
+        return current ? (Stage)current->stage.load(std::memory_order_relaxed) : IDLE;
+    }
+
+    // overall progress 0..1
+    float progress() const {
+        std::lock_guard<std::mutex> g(m);
+        if (!current) return 0.0f;
+        switch (current->stage.load(std::memory_order_relaxed)) {
+            case DECODE:  return 0.7f * current->progress.value.load(std::memory_order_relaxed);
+            case ANALYSE: return 0.75f;
+            case LOOP:    return 0.85f;
+            case DONE:
+            case FAILED:  return 1.0f;
+            default:      return 0.0f;
+        }
+    }
+
+    static const char* stageName(Stage s) {
+        switch (s) {
+            case DECODE:  return "decode";
+            case ANALYSE: return "analyse";
+            case LOOP:    return "search loop";
+            case DONE:    return "done";
+            case FAILED:  return "failed";
+            default:      return "";
+        }
+    }
+
+    // GUI thread, the finished load of the latest request, if any
+    std::unique_ptr<Result> take() {
+        reap();
+        std::lock_guard<std::mutex> g(m);
+        if (result) current.reset();
+        return std::move(result);
+    }
+
+private:
+    struct Job {
+        LoadProgress progress;
+        std::atomic<int> stage { IDLE };
+        std::atomic<bool> finished { false };
+    };
+
+    struct Running {
+        std::shared_ptr<Job> job;
+        std::thread thread;
+    };
+
+    mutable std::mutex m;
+    std::shared_ptr<Job> current;
+    std::unique_ptr<Result> result;
+    std::vector<Running> running;
+
+    // join the threads which are done
+    void reap() {
+        for (auto it = running.begin(); it != running.end();) {
+            if (it->job->finished.load(std::memory_order_acquire)) {
+                if (it->thread.joinable()) it->thread.join();
+                it = running.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    static bool cancelled(const std::shared_ptr<Job>& job) {
+        return job->progress.cancel.load(std::memory_order_relaxed);
+    }
+
+    void deliver(const std::shared_ptr<Job>& job, std::unique_ptr<Result> r, Stage s) {
+        std::lock_guard<std::mutex> g(m);
+        job->stage.store(s, std::memory_order_relaxed);
+        if (job == current && !cancelled(job)) result = std::move(r);
+    }
+
+    void run(std::shared_ptr<Job> job, Request req) {
+        auto r = std::make_unique<Result>();
+        r->file = req.file;
+        AudioFile af;
+        af.cache.setDir(req.cacheDir);
+        af.downmixMode = req.downmix;
+        af.watch = &job->progress;
+
+        job->stage.store(DECODE, std::memory_order_relaxed);
+        // a long file play from disk, only the overview get loaded
+        uint64_t fileFrames = 0;
+        uint32_t fileRate = 0;
+        const bool streamed = AudioFile::probe(req.file.c_str(), fileFrames, fileRate) &&
+                                StreamSource::wanted(fileFrames, fileRate);
+        const bool loaded = streamed ?
+                    af.getOverview(req.file.c_str(), StreamSource::OVERVIEW_FRAMES) :
+                    af.getAudioFile(req.file.c_str(), req.rate);
+        if (!loaded || !af.samples) {
+            if (!cancelled(job)) deliver(job, std::move(r), FAILED);
+            job->finished.store(true, std::memory_order_release);
+            return;
+        }
+        r->samples = af.samples;
+        af.samples = nullptr;
+        r->frames = af.samplesize;
+        r->fileRate = streamed ? fileRate : af.samplerate;
+        if (streamed) {
+            r->overviewRate = af.samplerate;
+            // the peak come with the overview, the stream only read the head
+            r->stream = StreamSource::open(req.file, 0.6f, req.downmix, af.peak);
+            if (!r->stream) {
+                if (!cancelled(job)) deliver(job, std::move(r), FAILED);
+                job->finished.store(true, std::memory_order_release);
+                return;
+            }
+        }
+        const uint32_t rate = streamed ? r->overviewRate : (req.rate ? req.rate : r->fileRate);
+
+        if (!cancelled(job)) {
+            job->stage.store(ANALYSE, std::memory_order_relaxed);
+            r->rootkey = PitchTracker::getPitch(r->samples, r->frames, 1, (float)rate,
+                                                &r->pitchCorrection, &r->freq);
+        }
+        if (!cancelled(job) && r->freq > 0.0f) {
+            job->stage.store(LOOP, std::memory_order_relaxed);
+            r->haveLoop = r->lg.generateLoop(r->samples, 0, r->frames, r->frames, 1,
+                            rate, r->freq, r->loopBuffer, r->loop, req.loopPeriods);
+        }
+        r->ok = true;
+        if (!cancelled(job)) deliver(job, std::move(r), DONE);
+        job->finished.store(true, std::memory_order_release);
+    }
+};
+
+#endif
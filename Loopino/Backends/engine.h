@@ -20,6 +20,7 @@
 #include <thread>
 #include <unistd.h>
 #include "ParallelThread.h"
+#include "Reclaimer.h"
 
 
 #ifndef ENGINE_H_
@@ -214,6 +215,7 @@ inline void Engine::processDsp(uint32_t n_samples, float* output) {
             ui->position++;
         }
     }
+    Reclaimer::Guard g;
     for (uint32_t i = 0; i < n_samples; ++i) {
         while (m < midi.count && midi.events[m].sampleOffset == i) {
             auto& ev = midi.events[m];
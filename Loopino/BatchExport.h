@@ -0,0 +1,273 @@
+
+/*
+ * BatchExport.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  BatchExport - render a key range times a set of velocity layers
+                to audio files, optional with a sfz mapping
+
+  every note play through a offline voice, a copy of the live
+  voice settings (envelope, filters, modulation) fed by the sample
+  and machine chain the live voices use, taken once at start().
+  Stretched keys are build exact at FINE tier for each note by the
+  KeyCache workers, they never land in the live cache or its
+  statistics. The notes are spread over a small worker pool, one
+  voice per worker. A new start() cancel the running export.
+****************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <filesystem>
+
+#include "SamplePlayer.h"
+#include "AudioFile.h"
+
+#ifndef BATCHEXPORT_H
+#define BATCHEXPORT_H
+
+class BatchExport {
+public:
+    struct Job {
+        std::string path;                       // folder and file name prefix
+        int lowKey = 36;
+        int highKey = 96;
+        int keyStep = 1;                        // render every n-th key
+        std::vector<int> velocities { 127 };    // one layer each
+        float hold = 2.0f;                      // seconds the key is down
+        float tail = 4.0f;                      // max seconds of release
+        bool flac = false;                      // 24 bit flac, else float wav
+        bool sfz = true;
+    };
+
+    struct Report {
+        bool cancelled = false;
+        int files = 0;
+        int failed = 0;
+        std::string sfzFile;
+    };
+
+    ~BatchExport() {
+        cancel();
+        if (worker.joinable()) worker.join();
+    }
+
+    // GUI thread, the voices copy the live settings here
+    void start(PolySynth& synth, const Job& j) {
+        cancel();
+        if (worker.joinable()) worker.join();
+        {
+            std::lock_guard<std::mutex> g(m);
+            report.reset();
+        }
+        Job job = j;
+        job.lowKey = std::clamp(job.lowKey, 0, 127);
+        job.highKey = std::clamp(job.highKey, job.lowKey, 127);
+        job.keyStep = std::max(1, job.keyStep);
+        for (auto& v : job.velocities) v = std::clamp(v, 1, 127);
+        std::sort(job.velocities.begin(), job.velocities.end());
+        job.velocities.erase(std::unique(job.velocities.begin(), job.velocities.end()),
+                                                                job.velocities.end());
+        if (job.path.empty() || job.velocities.empty()) return;
+
+        std::vector<Note> notes;
+        for (int k = job.lowKey; k <= job.highKey; k += job.keyStep)
+            for (int v : job.velocities)
+                notes.push_back({ k, v });
+
+        const size_t threads = std::min<size_t>(notes.size(),
+                        std::max(1u, std::min(8u, std::thread::hardware_concurrency())));
+        std::vector<std::unique_ptr<SampleVoice>> voices;
+        for (size_t i = 0; i < threads; ++i)
+            voices.push_back(synth.makeOfflineVoice());
+        PolySynth::OfflineSource source = synth.getOfflineSource();
+        if (!source.sample) return;
+
+        auto flag = std::make_shared<std::atomic<bool>>(false);
+        {
+            std::lock_guard<std::mutex> g(m);
+            cancelFlag = flag;
+            running = true;
+        }
+        done.store(0, std::memory_order_relaxed);
+        total.store((int)notes.size(), std::memory_order_relaxed);
+        worker = std::thread(&BatchExport::run, this, &synth, std::move(job), std::move(source),
+                            std::move(notes), std::move(voices), std::move(flag));
+    }
+
+    void cancel() {
+        std::lock_guard<std::mutex> g(m);
+        if (cancelFlag) cancelFlag->store(true, std::memory_order_relaxed);
+        cancelFlag.reset();
+        running = false;
+    }
+
+    bool busy() const {
+        std::lock_guard<std::mutex> g(m);
+        return running;
+    }
+
+    int getDone() const { return done.load(std::memory_order_relaxed); }
+    int getTotal() const { return total.load(std::memory_order_relaxed); }
+
+    float progress() const {
+        const int t = getTotal();
+        return t ? float(getDone()) / float(t) : 0.0f;
+    }
+
+    std::unique_ptr<Report> take() {
+        std::lock_guard<std::mutex> g(m);
+        return std::move(report);
+    }
+
+    static std::string noteName(int key) {
+        static const char* names[] = {"C","Cs","D","Ds","E","F","Fs","G","Gs","A","As","B"};
+        return std::string(names[key % 12]) + std::to_string(key / 12 - 1);
+    }
+
+private:
+    struct Note {
+        int key;
+        int velocity;
+        bool ok = false;
+        std::string file;
+    };
+
+    mutable std::mutex m;
+    std::shared_ptr<std::atomic<bool>> cancelFlag;
+    std::unique_ptr<Report> report;
+    std::thread worker;
+    std::atomic<int> done { 0 };
+    std::atomic<int> total { 0 };
+    bool running = false;
+
+    static std::string fileFor(const Job& job, const Note& n) {
+        char num[24];
+        snprintf(num, sizeof(num), "_%03d_", n.key);
+        return job.path + num + noteName(n.key) + "_v" + std::to_string(n.velocity)
+                                                + (job.flac ? ".flac" : ".wav");
+    }
+
+    // key down for hold, then release until the voice fall silent or tail run out
+    static void render(PolySynth& synth, SampleVoice& v, const Note& n, const Job& job,
+                double sr, const PolySynth::OfflineSource& source,
+                std::vector<float>& buf, const std::atomic<bool>& cancel) {
+        buf.clear();
+        if (!synth.offlineNoteOn(v, n.key, n.velocity / 127.0f, source, cancel)) return;
+        const size_t holdFrames = size_t(std::max(0.0f, job.hold) * sr);
+        const size_t tailFrames = size_t(std::max(0.0f, job.tail) * sr);
+        buf.reserve(holdFrames + tailFrames);
+        for (size_t i = 0; i < holdFrames && v.isActive(); ++i) {
+            if ((i & 65535) == 0 && cancel.load(std::memory_order_relaxed)) break;
+            buf.push_back(v.process());
+        }
+        v.noteOff(n.key);
+        for (size_t i = 0; i < tailFrames && v.isActive(); ++i)
+            buf.push_back(v.process());
+        if (v.isActive()) {
+            // cut by the tail limit, fade the last few ms
+            const size_t fade = std::min(buf.size(), size_t(0.005 * sr) + 1);
+            for (size_t i = 0; i < fade; ++i)
+                buf[buf.size() - fade + i] *= float(fade - 1 - i) / float(fade);
+            v.reset();
+        }
+        // drop the silent end, about -100 dB
+        size_t end = buf.size();
+        while (end > 0 && std::fabs(buf[end - 1]) < 1e-5f) --end;
+        buf.resize(end);
+    }
+
+    void work(PolySynth* synth, const Job& job, std::vector<Note>& notes,
+                SampleVoice* voice, std::atomic<size_t>& next,
+                const PolySynth::OfflineSource& source,
+                const std::shared_ptr<std::atomic<bool>>& flag, double sr) {
+        AudioFile af;
+        std::vector<float> buf;
+        const int format = job.flac ? (SF_FORMAT_FLAC | SF_FORMAT_PCM_24)
+                                    : (SF_FORMAT_WAV | SF_FORMAT_FLOAT);
+        for (;;) {
+            if (flag->load(std::memory_order_relaxed)) return;
+            const size_t i = next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= notes.size()) return;
+            Note& n = notes[i];
+            render(*synth, *voice, n, job, sr, source, buf, *flag);
+            if (!buf.empty() && !flag->load(std::memory_order_relaxed)) {
+                n.file = fileFor(job, n);
+                n.ok = af.saveAudioFile(n.file, buf.data(), (uint32_t)buf.size(),
+                                                        (uint32_t)sr, format);
+            }
+            done.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // a region per written note, keys up to the next rendered key,
+    // velocities from the layer below, the level is baked in the file
+    static std::string writeSfz(const Job& job, const std::vector<Note>& notes) {
+        const std::string name = job.path + ".sfz";
+        std::ofstream o(name, std::ios::trunc);
+        if (!o) return "";
+        o << "// " << std::filesystem::path(job.path).filename().u8string()
+          << ", exported from Loopino\n\n<group>\namp_veltrack=0\n\n";
+        for (const auto& n : notes) {
+            if (!n.ok) continue;
+            // the outer zones stretch to the ends of the keyboard
+            const int lokey = n.key == job.lowKey ? 0 : n.key;
+            const int hikey = n.key + job.keyStep > job.highKey ? 127 : n.key + job.keyStep - 1;
+            auto it = std::find(job.velocities.begin(), job.velocities.end(), n.velocity);
+            const int lovel = it == job.velocities.begin() ? 1 : *(it - 1) + 1;
+            const int hivel = it + 1 == job.velocities.end() ? 127 : n.velocity;
+            o << "<region> sample=" << std::filesystem::path(n.file).filename().u8string()
+              << " lokey=" << lokey << " hikey=" << hikey
+              << " pitch_keycenter=" << n.key
+              << " lovel=" << lovel << " hivel=" << hivel << "\n";
+        }
+        return o ? name : "";
+    }
+
+    void run(PolySynth* synth, Job job, PolySynth::OfflineSource source, std::vector<Note> notes,
+                std::vector<std::unique_ptr<SampleVoice>> voices,
+                std::shared_ptr<std::atomic<bool>> flag) {
+        std::error_code ec;
+        const auto dir = std::filesystem::path(job.path).parent_path();
+        if (!dir.empty()) std::filesystem::create_directories(dir, ec);
+        const double sr = synth->getSampleRate();
+        PolySynth::readStreamed(source);
+        std::atomic<size_t> next { 0 };
+
+        std::vector<std::thread> pool;
+        for (auto& v : voices)
+            pool.emplace_back(&BatchExport::work, this, synth, std::cref(job),
+                        std::ref(notes), v.get(), std::ref(next), std::cref(source),
+                        std::cref(flag), sr);
+        for (auto& t : pool) t.join();
+
+        auto r = std::make_unique<Report>();
+        r->cancelled = flag->load(std::memory_order_relaxed);
+        for (const auto& n : notes) {
+            if (n.ok) r->files++;
+            else if (!n.file.empty()) r->failed++;
+        }
+        if (job.sfz && !r->cancelled && r->files) r->sfzFile = writeSfz(job, notes);
+
+        std::lock_guard<std::mutex> g(m);
+        if (flag->load(std::memory_order_relaxed)) return;
+        report = std::move(r);
+        running = false;
+    }
+};
+
+#endif
@@ -13,6 +13,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <atomic>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
 
 
 typedef struct plugin_t plugin_t;
@@ -34,23 +37,68 @@ typedef struct plugin_t plugin_t;
 #include "Loopino_ui.h"
 #include "engine.h"
 
+// every host call may block (autosave), so the state is collected
+// in memory and handed over in a few large blocks
+static constexpr size_t STATE_BLOCK = 1 << 20;
+
 struct ClapStreamOut : StreamOut {
     const clap_ostream_t* out;
+    std::vector<uint8_t> buffer;
 
-    ClapStreamOut(const clap_ostream_t* o) : out(o) {}
+    ClapStreamOut(const clap_ostream_t* o) : out(o) {
+        buffer.reserve(4096);
+    }
 
     void write(const void* data, size_t size) override {
-        out->write(out, data, size);
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        buffer.insert(buffer.end(), p, p + size);
+    }
+
+    // the host may take less than offered
+    bool flush() {
+        size_t pos = 0;
+        while (pos < buffer.size()) {
+            const int64_t n = out->write(out, buffer.data() + pos,
+                                std::min(STATE_BLOCK, buffer.size() - pos));
+            if (n <= 0) return false;
+            pos += (size_t)n;
+        }
+        return true;
     }
 };
 
 struct ClapStreamIn : StreamIn {
-    const clap_istream_t* in;
-
-    ClapStreamIn(const clap_istream_t* i) : in(i) {}
+    std::vector<uint8_t> buffer;
+    size_t pos = 0;
+    bool complete = true;
+
+    // read to the end of the stream, the host may hand out less than asked
+    bool fill(const clap_istream_t* in) {
+        buffer.clear();
+        pos = 0;
+        for (;;) {
+            const size_t have = buffer.size();
+            buffer.resize(have + STATE_BLOCK);
+            const int64_t n = in->read(in, buffer.data() + have, STATE_BLOCK);
+            buffer.resize(have + (n > 0 ? (size_t)n : 0));
+            if (n < 0) return false;
+            if (n == 0) return !buffer.empty();
+        }
+    }
 
+    // a short state leave the missing values zero
     void read(void* data, size_t size) override {
-        in->read(in, data, size);
+        const size_t n = std::min(size, buffer.size() - pos);
+        memcpy(data, buffer.data() + pos, n);
+        if (n < size) {
+            memset(static_cast<uint8_t*>(data) + n, 0, size - n);
+            complete = false;
+        }
+        pos += n;
+    }
+
+    size_t remaining() const override {
+        return buffer.size() - pos;
     }
 };
 
@@ -256,13 +304,15 @@ static bool state_save(const clap_plugin_t *plugin, const clap_ostream_t *stream
     plugin_t *plug = (plugin_t *)plugin->plugin_data;
     ClapStreamOut st(stream);
     plug->r->saveState(st);
-    return true;
+    return st.flush();
 }
 
 static bool state_load(const clap_plugin_t *plugin, const clap_istream_t *stream) {
     plugin_t *plug = (plugin_t *)plugin->plugin_data;
-    ClapStreamIn st(stream);
+    ClapStreamIn st;
+    if (!st.fill(stream)) return false;
     if (plug->r->readState(st)) {
+        if (!st.complete) std::cerr << "Warning: truncated state\n";
         plug->havePresetToLoad = true;
         plug->r->loadPresetToSynth();
         return true;
@@ -652,10 +702,13 @@ static clap_process_status process(const clap_plugin_t *plugin, const clap_proce
     clap_collect_midi(plug, process->in_events, plug->split);
     
 
-    for (uint32_t i = 0; i < plug->split; ++i) {
-        float out = plug->r->synth.process();
-        left_output[i + pframes]  += out;
-        right_output[i + pframes] += out;
+    {
+        Reclaimer::Guard g;
+        for (uint32_t i = 0; i < plug->split; ++i) {
+            float out = plug->r->synth.process();
+            left_output[i + pframes]  += out;
+            right_output[i + pframes] += out;
+        }
     }
 
     plug->engine->process(pframes, left_output, right_output);
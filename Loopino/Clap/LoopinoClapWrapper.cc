@@ -302,9 +302,9 @@
             havePresetToLoad = false;
         }
         loadNew = true;
-        update_waveview(wview, af.samples, af.samplesize);
+        setWaveView(wview, af.samples, af.samplesize);
         loadLoopNew = true;
-        update_waveview(loopview, loopBuffer.data(), loopBuffer.size());
+        setWaveView(loopview, loopBuffer.data(), loopBuffer.size());
     }
     
     void setParent(Window window) {
@@ -410,28 +410,20 @@
         return w_top->app;
     }
 
+    // since version 17, one coded block (see PresetSamples.h)
     bool writeSamples(StreamOut& out, const float* samples, uint32_t numData) {
-        if (!samples || numData == 0) return false;
-
-        out.write(&numData, sizeof(numData));
-        float maxVal = 0.0f;
-        for (size_t i = 0; i < numData; ++i) {
-            maxVal = max(maxVal, std::fabs(samples[i]));
-        }
-        if (maxVal <  0.9999f) maxVal = 1.0f;
-        
-        for (size_t i = 0; i < numData; ++i) {
-            float normalized = samples[i] / maxVal;
-            int16_t encoded = static_cast<int16_t>(std::round(normalized * 32767.0f));
-            out.write(&encoded, sizeof(encoded));
-        }
+        const std::vector<uint8_t> block = PresetSamples::encode(samples, numData,
+                                static_cast<PresetSamples::Storage>(sampleStorage));
+        const uint64_t size = block.size();
+        out.write(&size, sizeof(size));
+        out.write(block.data(), block.size());
         return true;
     }
 
     void saveState(StreamOut& out) {
         PresetHeader header;
         std::memcpy(header.magic, "LOOPINO", 8);
-        header.version = 16; // guard for future proof
+        header.version = 17; // guard for future proof
         header.dataSize = af.samplesize;
         out.write(&header, sizeof(header));
 
@@ -533,9 +525,26 @@
         out.write(&jack_sr, sizeof(jack_sr));
     }
 
+    bool readSampleSection(StreamIn& in, float*& samples, uint32_t& numData) {
+        uint64_t size = 0;
+        in.read(&size, sizeof(size));
+        // a broken size must not allocate more than the state hold
+        if (!size || size > MAX_SAMPLE_SECTION || size > in.remaining()) return false;
+        std::vector<uint8_t> block(size);
+        in.read(block.data(), block.size());
+        float* s = nullptr;
+        uint32_t n = 0;
+        if (!PresetSamples::decode(block.data(), block.size(), s, n)) return false;
+        delete[] samples;
+        samples = s;
+        numData = n;
+        return true;
+    }
+
+    // up to version 16, one int16 per sample
     bool readSamples(StreamIn& in, float*& samples, uint32_t& numData) {
         in.read(&numData, sizeof(numData));
-        if (numData == 0) return false;
+        if (numData == 0 || numData > in.remaining() / sizeof(int16_t)) return false;
         delete[] samples;
         samples = nullptr;
         samples = new float[numData];
@@ -558,7 +567,7 @@
 
         // we need to update the header version when change the preset format
         // then we could protect new values with a guard by check the header version
-        if (header.version > 16) {
+        if (header.version > 17) {
             std::cerr << "Warning: newer preset version (" << header.version << ")\n";
             return false;
         }
@@ -670,12 +679,19 @@
             in.read(&genrateKeyCache, sizeof(genrateKeyCache));
         }
 
-        readSamples(in, af.samples, af.samplesize);
+        if (header.version > 16) {
+            readSampleSection(in, af.samples, af.samplesize);
+        } else {
+            readSamples(in, af.samples, af.samplesize);
+        }
         if (header.version > 12) {
             uint32_t sampleRate = jack_sr;
             in.read(&sampleRate, sizeof(sampleRate));
-            if (sampleRate != jack_sr) {
-                af.checkSampleRate(&af.samplesize, 1, af.samples, sampleRate, jack_sr);
+            if (!jack_sr) {
+                // not activated yet, setJackSampleRate() convert it
+                samplesRate = sampleRate;
+            } else if (sampleRate != jack_sr) {
+                af.samples = af.checkSampleRate(&af.samplesize, 1, af.samples, sampleRate, jack_sr);
             }
         }
         havePresetToLoad = true;
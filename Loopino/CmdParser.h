@@ -21,6 +21,8 @@
 #include <cstring>
 #include <cstdlib>
 
+#include "Downmix.h"
+
 struct CmdParser {
 
     struct CmdOptions {
@@ -28,6 +30,8 @@ struct CmdParser {
         std::optional<float> scaling;
         std::optional<int> bufferSize;
         std::optional<int> sampleRate;
+        bool keyCacheStats = false;
+        std::optional<Downmix> downmix;
     } opts;
 
 
@@ -46,7 +50,9 @@ struct CmdParser {
             << "  -d, --device <name>    ALSA RAW MIDI device eg. hw:1,0,0\n"
             << "  -b, --buffer <value>   ALSA buffer size (int)\n"
             << "  -r, --rate <value>     ALSA Sample Rate (int)\n"
-            << "  -s, --scaling <value>  Scaling factor (float)\n";
+            << "  -s, --scaling <value>  Scaling factor (float)\n"
+            << "  -k, --keycache-stats   print KeyCache statistics on exit\n"
+            << "  -m, --downmix <mode>   fold multichannel files to mono: left, mid or sum\n";
     }
 
     static bool parseFloat(const char* str, float& out) {
@@ -104,6 +110,19 @@ struct CmdParser {
                     return false;
                 }
                 opts.sampleRate = value;
+            } else if (std::strcmp(arg, "-k") == 0 || std::strcmp(arg, "--keycache-stats") == 0) {
+                opts.keyCacheStats = true;
+            } else if (std::strcmp(arg, "-m") == 0 || std::strcmp(arg, "--downmix") == 0) {
+                if (i + 1 >= argc) {
+                    std::cerr << "Error: --downmix requires a value\n";
+                    return false;
+                }
+                Downmix value;
+                if (!parseDownmix(argv[++i], value)) {
+                    std::cerr << "Error: invalid downmix mode\n";
+                    return false;
+                }
+                opts.downmix = value;
             } else {
                 std::cerr << "Error: unknown option '" << arg << "'\n";
                 return false;
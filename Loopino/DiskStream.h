@@ -0,0 +1,322 @@
+
+/*
+ * DiskStream.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** DiskStream - play long samples from disk
+ *
+ *  A file longer than STREAM_SECONDS get streamed. The
+ *  StreamSource keep only the head of it in memory, the GUI
+ *  hold no more than a decimated overview for display and
+ *  analysis.
+ *  Each voice own a StreamVoice, a single producer / single
+ *  consumer ring buffer. One background I/O thread serve all
+ *  registered StreamVoices, it open the file on a new request,
+ *  seek behind the head and keep the ring filled ahead of the
+ *  read position.
+ *
+ *  The audio thread only touch atomics and the ring, it never
+ *  wait for the disk. When the disk can't keep up, missing
+ *  frames read as silence and get counted as underruns.
+ *
+ *  A streamed sample play as it is on disk, only gain scaled.
+ *  It skip the KeyCache and the machine chain, and edits made
+ *  in the wave view don't reach it.
+ *
+ *  usage:
+ *      auto src = StreamSource::open(path, 0.6f, mode, peak);  // not real-time
+ *      StreamVoice v;                         // register itself
+ *      v.start(src.get());                    // audio thread
+ *      v.fetch4(src.get(), i, taps);          // audio thread
+ *      v.release(i);                          // frames below i-1 are done
+ ****************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <sndfile.h>
+
+#include "Reclaimer.h"
+#include "Downmix.h"
+
+#ifndef DISKSTREAM_H_
+#define DISKSTREAM_H_
+
+struct StreamSource {
+    static constexpr double HEAD_SECONDS = 2.0;
+    static constexpr double STREAM_SECONDS = 60.0;
+    static constexpr size_t OVERVIEW_FRAMES = 1 << 22;   // max frames of the overview
+
+    std::string path;
+    uint64_t frames = 0;
+    uint32_t channels = 1;
+    double sampleRate = 44100.0;
+    float gain = 1.0f;
+    Downmix mode = Downmix::Left;
+    std::vector<float> head;    // mono, gain applied
+
+    // load the head only, normalize to the same level the one-shot
+    // path use. peak is the peak of the whole file when the caller
+    // know it, without it the gain come from the head.
+    static std::shared_ptr<const StreamSource> open(const std::string& file,
+                            float normalize = 0.6f, Downmix mode = Downmix::Left,
+                            float peak = 0.0f) {
+        SF_INFO info;
+        info.format = 0;
+        SNDFILE* sf = sf_open(file.c_str(), SFM_READ, &info);
+        if (!sf) return nullptr;
+        if (info.frames <= 0 || info.channels <= 0) {
+            sf_close(sf);
+            return nullptr;
+        }
+        auto s = std::make_shared<StreamSource>();
+        s->path = file;
+        s->frames = (uint64_t)info.frames;
+        s->channels = (uint32_t)info.channels;
+        s->sampleRate = (double)info.samplerate;
+        s->mode = mode;
+        const uint64_t headLen = std::min<uint64_t>(s->frames,
+                                    (uint64_t)(HEAD_SECONDS * s->sampleRate));
+        s->head.resize(headLen);
+
+        std::vector<float> buf(BLOCK * s->channels);
+        uint64_t pos = 0;
+        sf_count_t n;
+        while (pos < headLen && (n = sf_readf_float(sf, buf.data(),
+                                    std::min<sf_count_t>(BLOCK, headLen - pos))) > 0) {
+            downmix(buf.data(), s->head.data() + pos, (size_t)n, s->channels, mode);
+            pos += n;
+        }
+        sf_close(sf);
+        // a short read mean the file end early
+        if (pos < headLen) s->frames = pos;
+        s->head.resize(pos);
+        if (peak <= 0.0f)
+            for (float v : s->head) peak = std::max(peak, std::fabs(v));
+        s->gain = peak > 0.0f ? normalize / peak : 1.0f;
+        for (auto& v : s->head) v *= s->gain;
+        return s;
+    }
+
+    // true when a file of frames at rate is to long to hold in memory
+    static bool wanted(uint64_t frames, double rate) {
+        return rate > 0.0 && (double)frames > STREAM_SECONDS * rate;
+    }
+
+    // read the whole file, for offline use only
+    std::vector<float> readAll() const {
+        return readRange(0, frames);
+    }
+
+    // read frames from .. to, gain applied, for offline use only
+    std::vector<float> readRange(uint64_t from, uint64_t to) const {
+        std::vector<float> out;
+        to = std::min(to, frames);
+        if (from >= to) return out;
+        SF_INFO info;
+        info.format = 0;
+        SNDFILE* sf = sf_open(path.c_str(), SFM_READ, &info);
+        if (!sf) return out;
+        if (from && sf_seek(sf, (sf_count_t)from, SEEK_SET) < 0) {
+            sf_close(sf);
+            return out;
+        }
+        out.resize(to - from);
+        std::vector<float> buf(BLOCK * channels);
+        uint64_t pos = 0;
+        sf_count_t n;
+        while (pos < out.size() && (n = sf_readf_float(sf, buf.data(),
+                                    std::min<sf_count_t>(BLOCK, out.size() - pos))) > 0) {
+            downmix(buf.data(), out.data() + pos, (size_t)n, channels, mode, gain);
+            pos += n;
+        }
+        sf_close(sf);
+        out.resize(pos);
+        return out;
+    }
+
+    static constexpr sf_count_t BLOCK = 4096;
+};
+
+class StreamVoice;
+
+class DiskStream {
+public:
+    static DiskStream& get() {
+        static DiskStream d;
+        return d;
+    }
+
+    void add(StreamVoice* v) {
+        std::lock_guard<std::mutex> g(m);
+        voices.push_back(v);
+    }
+
+    // the I/O thread hold the mutex while it serve a voice,
+    // so the voice is safe to destroy once this return
+    void remove(StreamVoice* v) {
+        std::lock_guard<std::mutex> g(m);
+        voices.erase(std::remove(voices.begin(), voices.end(), v), voices.end());
+    }
+
+    ~DiskStream() {
+        run.store(false, std::memory_order_release);
+        if (worker.joinable()) worker.join();
+    }
+
+private:
+    std::mutex m;
+    std::vector<StreamVoice*> voices;
+    std::atomic<bool> run { true };
+    std::thread worker;
+
+    DiskStream() {
+        // the Reclaimer must outlive the I/O thread
+        Reclaimer::get();
+        worker = std::thread([this]() {
+            while (run.load(std::memory_order_acquire)) {
+                serve();
+                std::this_thread::sleep_for(std::chrono::milliseconds(4));
+            }
+        });
+    }
+
+    inline void serve();
+};
+
+class StreamVoice {
+public:
+    static constexpr size_t RING = 1 << 16;   // power of two
+
+    StreamVoice() { DiskStream::get().add(this); }
+    ~StreamVoice() {
+        DiskStream::get().remove(this);
+        if (sf) sf_close(sf);
+    }
+    StreamVoice(const StreamVoice&) = delete;
+    StreamVoice& operator=(const StreamVoice&) = delete;
+
+    // audio thread, the caller keep src alive until the next start()
+    void start(const StreamSource* s) {
+        src.store(s, std::memory_order_release);
+        seq.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    // audio thread, taps i-1 .. i+2, clamped at the edges
+    inline void fetch4(const StreamSource* s, size_t i, float* out) {
+        const bool ready = ack.load(std::memory_order_acquire) == seq.load(std::memory_order_relaxed);
+        const uint64_t w = ready ? writePos.load(std::memory_order_acquire) : 0;
+        const uint64_t r = readPos.load(std::memory_order_relaxed);
+        const uint64_t last = s->frames ? s->frames - 1 : 0;
+        for (int k = 0; k < 4; ++k) {
+            uint64_t idx = (i + k == 0) ? 0 : std::min<uint64_t>(i + k - 1, last);
+            if (idx < s->head.size()) {
+                out[k] = s->head[idx];
+            } else if (ready && idx >= r && idx < w) {
+                out[k] = ring[idx & (RING - 1)];
+            } else {
+                out[k] = 0.0f;
+                underruns.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // audio thread, frames below i-1 are no longer needed
+    inline void release(size_t i) {
+        if (ack.load(std::memory_order_acquire) != seq.load(std::memory_order_relaxed)) return;
+        const uint64_t r = i > 0 ? i - 1 : 0;
+        if (r > readPos.load(std::memory_order_relaxed))
+            readPos.store(r, std::memory_order_release);
+    }
+
+    uint64_t getUnderruns() const { return underruns.load(std::memory_order_relaxed); }
+
+private:
+    friend class DiskStream;
+
+    // shared with the audio thread
+    std::atomic<const StreamSource*> src { nullptr };
+    std::atomic<uint32_t> seq { 0 };
+    std::atomic<uint32_t> ack { 0 };
+    std::atomic<uint64_t> writePos { 0 };
+    std::atomic<uint64_t> readPos { 0 };
+    std::atomic<uint64_t> underruns { 0 };
+    std::vector<float> ring;
+
+    // I/O thread only, a copy of the source fields, the source
+    // itself may be gone once the voice moved on
+    SNDFILE* sf = nullptr;
+    uint64_t frames = 0;
+    uint32_t channels = 1;
+    float gain = 1.0f;
+    Downmix mode = Downmix::Left;
+    std::vector<float> buf;
+    std::vector<float> mono;
+
+    // I/O thread, reopen on a new request and fill the ring,
+    // called within a Reclaimer::Guard
+    void fill() {
+        const uint32_t s = seq.load(std::memory_order_acquire);
+        if (s != ack.load(std::memory_order_relaxed)) {
+            const StreamSource* cur = src.load(std::memory_order_acquire);
+            if (ring.empty()) ring.resize(RING);
+            if (sf) sf_close(sf);
+            sf = nullptr;
+            uint64_t start = 0;
+            if (cur && cur->frames > cur->head.size()) {
+                SF_INFO info;
+                info.format = 0;
+                sf = sf_open(cur->path.c_str(), SFM_READ, &info);
+                start = cur->head.size();
+                frames = cur->frames;
+                channels = cur->channels;
+                gain = cur->gain;
+                mode = cur->mode;
+                buf.resize(StreamSource::BLOCK * channels);
+                mono.resize(StreamSource::BLOCK);
+                if (sf) sf_seek(sf, (sf_count_t)start, SEEK_SET);
+            }
+            writePos.store(start, std::memory_order_relaxed);
+            readPos.store(start, std::memory_order_relaxed);
+            ack.store(s, std::memory_order_release);
+        }
+        if (!sf) return;
+        uint64_t w = writePos.load(std::memory_order_relaxed);
+        for (;;) {
+            // the voice may have moved on, leave the rest to the next pass
+            if (seq.load(std::memory_order_acquire) != s) return;
+            const uint64_t r = readPos.load(std::memory_order_acquire);
+            const uint64_t space = RING - (w - r);
+            if (w >= frames || space < (uint64_t)StreamSource::BLOCK) return;
+            const sf_count_t n = sf_readf_float(sf, buf.data(), StreamSource::BLOCK);
+            if (n <= 0) return;
+            downmix(buf.data(), mono.data(), (size_t)n, channels, mode, gain);
+            for (sf_count_t i = 0; i < n; ++i)
+                ring[(w + i) & (RING - 1)] = mono[i];
+            w += n;
+            writePos.store(w, std::memory_order_release);
+        }
+    }
+};
+
+inline void DiskStream::serve() {
+    std::lock_guard<std::mutex> g(m);
+    Reclaimer::Guard rg;
+    for (auto* v : voices) v->fill();
+}
+
+#endif
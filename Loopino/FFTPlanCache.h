@@ -0,0 +1,220 @@
+
+/*
+ * FFTPlanCache.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  FFTPlanCache - FFTW plans made once per power of two size
+
+  Plans are made on prototype buffers and run with the new-array
+  execute functions on the aligned buffers of a FFTWorkspace, so
+  one plan serve all threads. The FFTW planner isn't thread safe,
+  every plan get made under the planner lock.
+  plan() only estimate, it is called from the GUI thread. The
+  sizes asked for get measured afterwards in a background thread
+  and replace the estimated plan, the old one is kept alive as a
+  caller may still run it.
+  Wisdom get imported from and exported to the config dir, so
+  measured plans are cheap on the next start.
+****************************************************************/
+
+#pragma once
+
+#include <fftw3.h>
+#include <map>
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <utility>
+#include <condition_variable>
+
+#ifndef FFTPLANCACHE_H
+#define FFTPLANCACHE_H
+
+class FFTPlanCache {
+public:
+    enum Kind : int {
+        R2C = 0,    // real -> complex
+        C2R,        // complex -> real
+        R2HC,       // real -> half complex
+        HC2R        // half complex -> real
+    };
+
+    // measure plans up to this size in background, only estimate bigger ones
+    static constexpr int MEASURE_MAX = 1 << 16;
+
+    // one instance serves all synth instances in the process
+    static FFTPlanCache& get() {
+        static FFTPlanCache c;
+        return c;
+    }
+
+    static int sizeFor(size_t n) {
+        int s = 1;
+        while ((size_t)s < n) s <<= 1;
+        return s;
+    }
+
+    // import wisdom once, new plans get exported to it
+    void setWisdomFile(const std::string& f) {
+        std::lock_guard<std::mutex> g(plannerLock);
+        if (f == wisdomFile) return;
+        wisdomFile = f;
+        if (!wisdomFile.empty())
+            fftwf_import_wisdom_from_filename(wisdomFile.c_str());
+    }
+
+    // a estimated plan, or the measured one once it is there
+    fftwf_plan plan(Kind kind, int n) {
+        std::lock_guard<std::mutex> g(plannerLock);
+        auto it = plans.find({kind, n});
+        if (it != plans.end()) return it->second;
+        fftwf_plan p = make(kind, n, FFTW_ESTIMATE);
+        if (!p) return nullptr;
+        plans[{kind, n}] = p;
+        if (n <= MEASURE_MAX) queueMeasure(kind, n);
+        return p;
+    }
+
+private:
+    std::mutex plannerLock;
+    std::map<std::pair<int, int>, fftwf_plan> plans;
+    std::vector<fftwf_plan> replaced;
+    std::string wisdomFile;
+
+    std::mutex queueLock;
+    std::condition_variable wake;
+    std::deque<std::pair<int, int>> toMeasure;
+    std::thread measurer;
+    bool quit = false;
+
+    FFTPlanCache() = default;
+    ~FFTPlanCache() {
+        {
+            std::lock_guard<std::mutex> g(queueLock);
+            quit = true;
+        }
+        wake.notify_all();
+        if (measurer.joinable()) measurer.join();
+        for (auto& p : plans) fftwf_destroy_plan(p.second);
+        for (auto p : replaced) fftwf_destroy_plan(p);
+    }
+    FFTPlanCache(const FFTPlanCache&) = delete;
+    FFTPlanCache& operator=(const FFTPlanCache&) = delete;
+
+    // caller hold the planner lock
+    static fftwf_plan make(Kind kind, int n, unsigned flags) {
+        float* a = (float*)fftwf_malloc(sizeof(float) * n);
+        float* b = (float*)fftwf_malloc(sizeof(float) * n);
+        fftwf_complex* c = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * (n / 2 + 1));
+        fftwf_plan p = nullptr;
+        if (a && b && c) {
+            switch (kind) {
+                case R2C:  p = fftwf_plan_dft_r2c_1d(n, a, c, flags); break;
+                case C2R:  p = fftwf_plan_dft_c2r_1d(n, c, a, flags); break;
+                case R2HC: p = fftwf_plan_r2r_1d(n, a, b, FFTW_R2HC, flags); break;
+                case HC2R: p = fftwf_plan_r2r_1d(n, a, b, FFTW_HC2R, flags); break;
+            }
+        }
+        fftwf_free(a);
+        fftwf_free(b);
+        fftwf_free(c);
+        return p;
+    }
+
+    // caller hold the planner lock
+    void queueMeasure(Kind kind, int n) {
+        std::lock_guard<std::mutex> g(queueLock);
+        if (quit) return;
+        toMeasure.emplace_back(kind, n);
+        if (!measurer.joinable()) measurer = std::thread(&FFTPlanCache::measure, this);
+        wake.notify_one();
+    }
+
+    // one size at a time, the GUI wait at most for one measure
+    void measure() {
+        for (;;) {
+            std::pair<int, int> job;
+            {
+                std::unique_lock<std::mutex> q(queueLock);
+                wake.wait(q, [this]() { return quit || !toMeasure.empty(); });
+                if (quit) return;
+                job = toMeasure.front();
+                toMeasure.pop_front();
+            }
+            std::lock_guard<std::mutex> g(plannerLock);
+            fftwf_plan p = make(Kind(job.first), job.second, FFTW_MEASURE);
+            if (!p) continue;
+            fftwf_plan& slot = plans[job];
+            replaced.push_back(slot);
+            slot = p;
+            if (!wisdomFile.empty())
+                fftwf_export_wisdom_to_filename(wisdomFile.c_str());
+        }
+    }
+};
+
+/****************************************************************
+  FFTWorkspace - aligned scratch buffers, one set per thread,
+                 grow on demand and kept for the next call
+****************************************************************/
+
+class FFTWorkspace {
+public:
+    // keep at most this much around between calls
+    static constexpr int KEEP_MAX = 1 << 18;
+
+    float* a = nullptr;
+    float* b = nullptr;
+    fftwf_complex* spec = nullptr;
+    fftwf_complex* spec2 = nullptr;
+
+    static FFTWorkspace& local() {
+        thread_local FFTWorkspace w;
+        return w;
+    }
+
+    bool reserve(int n) {
+        if (n <= size) return true;
+        release();
+        a = (float*)fftwf_malloc(sizeof(float) * n);
+        b = (float*)fftwf_malloc(sizeof(float) * n);
+        spec = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * (n / 2 + 1));
+        spec2 = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * (n / 2 + 1));
+        if (!a || !b || !spec || !spec2) {
+            release();
+            return false;
+        }
+        size = n;
+        return true;
+    }
+
+    // drop huge buffers after a long analyse
+    void trim() {
+        if (size > KEEP_MAX) release();
+    }
+
+    ~FFTWorkspace() { release(); }
+
+private:
+    int size = 0;
+
+    void release() {
+        fftwf_free(a);
+        fftwf_free(b);
+        fftwf_free(spec);
+        fftwf_free(spec2);
+        a = b = nullptr;
+        spec = spec2 = nullptr;
+        size = 0;
+    }
+};
+
+#endif
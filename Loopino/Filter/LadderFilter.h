@@ -19,7 +19,7 @@ enum class LadderVoicing { Warm, Classic, Bright };
 ****************************************************************/
 
 struct ZDFLadderFilter {
-    const double leak = 0.99996;
+    static constexpr double leak = 0.99996;
     double z1=0, z2=0, z3=0, z4=0;
     double cutoff = 1000.0;
     double resonance = 0.0;
@@ -38,10 +38,10 @@ struct ZDFLadderFilter {
     bool  targetOn = false; 
     float targetFreq = 440.0f;
 
-    const float minFreq = 20.0;
-    const float maxFreq = 20000.0;
-    const float minQ = 0.6;
-    const float maxQ = 10.0;
+    static constexpr float minFreq = 20.0f;
+    static constexpr float maxFreq = 20000.0f;
+    static constexpr float minQ = 0.6f;
+    static constexpr float maxQ = 10.0f;
 
     bool getOnOff() const { return filterOff; }
 
@@ -173,7 +173,7 @@ struct ZDFLadderFilter {
 ****************************************************************/
 
 struct LadderFilter {
-    const double leak = 0.99996;
+    static constexpr double leak = 0.99996;
     double z1=0, z2=0, z3=0, z4=0; // 4 integrator stages
     double cutoff = 1000.0;
     double resonance = 0.0;
@@ -196,10 +196,10 @@ struct LadderFilter {
     double dc_y1 = 0.0;
     double dc_R  = 0.996;
 
-    const float minFreq = 20.0;
-    const float maxFreq = 20000.0;
-    const float minQ = 0.6;
-    const float maxQ = 10.0;
+    static constexpr float minFreq = 20.0f;
+    static constexpr float maxFreq = 20000.0f;
+    static constexpr float minQ = 0.6f;
+    static constexpr float maxQ = 10.0f;
 
     bool getOnOff() const { return filterOff; }
 
@@ -19,6 +19,7 @@
 #include <atomic>
 #include <vector>
 
+#include "Reclaimer.h"
 #include "LM_SEM12.h"
 #include "WaspFilter.h"
 #include "LadderFilter.h"
@@ -53,7 +54,6 @@ public:
     Filters() = default;
     ~Filters() {
         delete activeChain.exchange(nullptr);
-        delete retired.exchange(nullptr);
     }
 
     void setSampleRate(double sr) {
@@ -86,7 +86,21 @@ public:
         obf.reset();
     }
 
+    // take over settings and order of an other chain, for offline voices
+    void copySettings(const Filters& o) {
+        tbfilter = o.tbfilter;
+        wasp = o.wasp;
+        filterLP = o.filterLP;
+        filterHP = o.filterHP;
+        obf = o.obf;
+        sampleRate = o.sampleRate;
+        targetFreq = o.targetFreq;
+        isInitied = true;
+        rebuildFilterChain(o.order);
+    }
+
     void rebuildFilterChain(const std::vector<int>& newOrder) {
+        order = newOrder;
         auto* newChain = new DspChain;
         newChain->slots.reserve(newOrder.size());
         
@@ -117,12 +131,13 @@ private:
     double sampleRate = 44100.0;
     float targetFreq = 440.0f;
     bool isInitied = false;
+    std::vector<int> order;
     std::atomic<DspChain*> activeChain { nullptr };
-    std::atomic<DspChain*> retired { nullptr };
 
+    // the audio thread may still run the old chain,
+    // readers hold a Reclaimer::Guard (see PolySynth::process)
     void retire(DspChain* old) {
-        DspChain* prev = retired.exchange(old, std::memory_order_acq_rel);
-        delete prev;
+        Reclaimer::get().retire(old);
     }
 
 };
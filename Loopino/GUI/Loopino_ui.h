@@ -15,11 +15,13 @@
 #include <filesystem>
 #include <iostream>
 #include <mutex>
+#include <chrono>
 #include <set>
 #include <vector>
 #include <string>
 #include <sndfile.hh>
 #include <fstream>
+#include <sstream>
 #include <limits>
 #include <cstdint>
 
@@ -27,8 +29,15 @@
 #include "ParallelThread.h"
 #include "SupportedFormats.h"
 #include "AudioFile.h"
+#include "SampleLoader.h"
+#include "PresetSamples.h"
+#include "PresetLoader.h"
+#include "PresetValues.h"
+#include "PresetIndex.h"
 #include "PitchTracker.h"
 #include "LoopGenerator.h"
+#include "WaveShaper.h"
+#include "BatchExport.h"
 #include "Smoother.h"
 #include "SamplePlayer.h"
 #include "Parameter.h"
@@ -37,6 +46,7 @@
 #include "TextEntry.h"
 #include "Wheel.h"
 #include "ADSRview.h"
+#include "PeakPyramid.h"
 
 #include "xwidgets.h"
 #include "xfile-dialog.h"
@@ -53,6 +63,8 @@ struct StreamOut {
 
 struct StreamIn {
     virtual void read(void* data, size_t size) = 0;
+    // bytes left to read, a length field is checked against it
+    virtual size_t remaining() const = 0;
     virtual ~StreamIn() = default;
 };
 
@@ -100,17 +112,47 @@ public:
     ParallelThread pa;
     //ParallelThread fetch;
     AudioFile af;
+    SampleLoader loader;
+    PresetLoader presetLoader;
+    PresetIndex presetIndex;
+    std::unique_ptr<PresetLoader::Result> pendingPreset;
     PolySynth synth;
     Params param;
 
     SampleBank sbank;
     std::shared_ptr<SampleInfo> sampleData { nullptr };
+    // the key/velocity zones beside the main sample, slot 1 and up of sbank
+    struct ZoneSample {
+        std::shared_ptr<const SampleInfo> sample;
+        SampleZone range;
+        uint8_t rootkey = 0;
+    };
+    std::vector<ZoneSample> zones;
+    std::shared_ptr<const StreamSource> streamSource { nullptr };
     SampleBank lbank;
     std::shared_ptr<SampleInfo> loopData { nullptr };
+    PeakPyramid wavePeaks;
+    PeakPyramid loopPeaks;
+    // visible part of a wave view, as fraction of the buffer
+    struct WaveZoom {
+        double from = 0.0;
+        double to = 1.0;
+        double toView(double st) const { return (st - from) / (to - from); }
+        double toState(double x) const { return from + x * (to - from); }
+    };
+    WaveZoom waveZoom;
+    WaveZoom loopZoom;
+    ShapeRenderer shaper;
+    // what the background render work on, reset with sampleBufferSave
+    std::shared_ptr<const std::vector<float>> sampleSaveSnap { nullptr };
+    bool inShape = false;
+    BatchExport batch;
     std::vector<int> machineOrder;
     std::vector<int> filterOrder;
 
     uint32_t jack_sr;
+    uint32_t samplesRate;   // rate of af.samples when it isn't jack_sr yet
+    uint32_t overviewRate;  // rate of af.samples when it's the overview of a stream
     uint32_t position;
     uint32_t loopPoint_l;
     uint32_t loopPoint_r;
@@ -122,6 +164,18 @@ public:
     uint8_t customRootkey;
     uint8_t loopRootkey;
     uint8_t saveRootkey;
+    uint8_t batchLowKey;
+    uint8_t batchHighKey;
+    int batchLayers;
+    int batchFormat;      // 0 wav, 1 flac, 2 wav + sfz, 3 flac + sfz
+    int sampleStorage;    // PresetSamples::Storage used to save presets
+    int prefetchRange;    // presets kept decoded on each side of the current one
+    int presetKeyDetect;  // PresetIndex decode each preset to show its root key
+    int keyCacheFastPass; // KeyCache run a fast draft pass before the fine one
+    int keyCacheMemoryMB; // KeyCache memory budget, 0 = from the RAM size
+    int keyCacheSeconds;  // KeyCache time budget
+    int keyCacheFormat;   // SampleFormat of the stretched keys
+    int sourceFormat;     // SampleFormat of the processed root
 
     int16_t pitchCorrection;
     int16_t loopPitchCorrection;
@@ -132,6 +186,9 @@ public:
 
     float freq;
     float customFreq;
+    KeyCachePlan cachePlan;
+    size_t planFrames;
+    double planFreq;
     float loopFreq;
     float gain;
     float volume;
@@ -155,6 +212,8 @@ public:
         machineOrder = {20,21,22,23,24,25};
         filterOrder = {8,9,10,11,12};
         jack_sr = 0;
+        samplesRate = 0;
+        overviewRate = 0;
         position = 0;
         loopPoint_l = 0;
         loopPoint_r = 1000;
@@ -182,12 +241,28 @@ public:
         rootkey = 60;
         customRootkey = 60;
         saveRootkey = 69;
+        batchLowKey = 36;
+        batchHighKey = 96;
+        batchLayers = 1;
+        batchFormat = 2;
+        sampleStorage = PresetSamples::FLAC16;
+        prefetchRange = 1;
+        presetKeyDetect = 0;
+        keyCacheFastPass = 0;
+        keyCacheMemoryMB = 0;
+        keyCacheSeconds = 60;
+        keyCacheFormat = 0;
+        sourceFormat = 0;
+        planFrames = 0;
+        planFreq = 0.0;
         loopFreq = 0.0;
         loopPitchCorrection = 0;
         loopRootkey = 69;
         loadPresetMIDI = -1;
         lastPresetMIDI = -1;
         currentPresetNum = -1;
+        presetFadeWait = 0;
+        presetFadeFrames = 0;
         p = 0;
         firstLoop = true;
 
@@ -228,7 +303,12 @@ public:
     
     // receive Sample Rate from audio back-end
     void setJackSampleRate(uint32_t sr) {
-        jack_sr = sr;        
+        // bring a pending preset sample to the new rate
+        const uint32_t from = samplesRate ? samplesRate : jack_sr;
+        if (havePresetToLoad && af.samples && af.samplesize && from && from != sr)
+            af.samples = af.checkSampleRate(&af.samplesize, 1, af.samples, from, sr);
+        samplesRate = 0;
+        jack_sr = sr;
         synth.init((double)jack_sr, 48);
         syncValuesToSynth();
         if (!havePresetToLoad) generateSine();
@@ -247,9 +327,73 @@ public:
         }
     }
 
-    // load a audio file in background process
+    // load a audio file in background process, the current sample
+    // keep playing until the new one is decoded and analysed
     void loadFile() {
-        read_soundfile(filename.c_str());
+        if (!guiIsCreated || !jack_sr) {
+            read_soundfile(filename.c_str());
+            return;
+        }
+        SampleLoader::Request req;
+        req.file = filename;
+        req.rate = jack_sr;
+        req.downmix = af.downmixMode;
+        req.cacheDir = af.cache.getDir();
+        req.loopPeriods = loopPeriods;
+        loader.start(req);
+        std::string tittle = "loopino: loading " +
+                    std::filesystem::path(filename).filename().u8string();
+        widget_set_title(w_top, tittle.data());
+    }
+
+    // swap a finished background load in
+    void applyLoad(std::unique_ptr<SampleLoader::Result> r) {
+        if (!r || !r->samples) {
+            std::cerr << "Error: could not load file " << (r ? r->file : "") << std::endl;
+            widget_set_title(w_top, "loopino");
+            return;
+        }
+        ready = false;
+        play_loop = false;
+        position = 0;
+        matches = 0;
+        delete[] af.samples;
+        af.samples = r->samples;
+        r->samples = nullptr;
+        af.samplesize = r->frames;
+        af.samplerate = r->fileRate;
+        af.channels = 1;
+        is_loaded = false;
+        loadNew = true;
+        adj_set_value(setLoop->adj, 0.0);
+        adj_set_max_value(wview->adj, (float)af.samplesize);
+        adj_set_state(loopMark_L->adj_x, 0.0);
+        adj_set_state(loopMark_R->adj_x,1.0);
+        loopPoint_l = 0;
+        loopPoint_r = af.samplesize;
+
+        freq = r->freq;
+        pitchCorrection = r->pitchCorrection;
+        rootkey = r->rootkey;
+        customRootkey = rootkey;
+        combobox_set_active_entry(RootKey, rootkey);
+        streamSource = r->stream;
+        overviewRate = r->overviewRate;
+        setOneShootToBank(false, true);
+
+        if (r->haveLoop) {
+            lg = std::move(r->lg);
+            loopBuffer = std::move(r->loopBuffer);
+            takeLoop(r->loop);
+            setLoopToBank();
+        } else {
+            loopPoint_l_auto = 0;
+            loopPoint_r_auto = 0;
+            Widget_t *dia = open_message_dialog(w, ERROR_BOX, "loopino",
+                freq > 0.0 ? _("Fail to create loop") : _("Fail to get root Frequency"),NULL);
+            os_set_transient_for_hint(w, dia);
+        }
+        ready = true;
     }
 
     void loadPresetNum(int v) {
@@ -257,15 +401,41 @@ public:
         loadPresetMIDI = v;
     }
 
-    void loadPresetToSynth() {
+    // analysed hold pitch and loop from the PresetLoader, else do it here
+    void loadPresetToSynth(SampleLoader::Result* analysed = nullptr) {
         //std::cout << "loadPresetToSynth" << std::endl;
         af.channels = 1;
         loopPoint_l = 0;
         loopPoint_r = af.samplesize;
-        setOneShootToBank();
-        if (createLoop()) {
-            setLoopToBank();
-        } 
+        streamSource.reset();
+        loader.cancel();
+        if (analysed) {
+            freq = analysed->freq;
+            pitchCorrection = analysed->pitchCorrection;
+            rootkey = analysed->rootkey;
+            customRootkey = rootkey;
+            if (guiIsCreated) combobox_set_active_entry(RootKey, rootkey);
+            setOneShootToBank(false, true);
+            if (analysed->haveLoop) {
+                lg = std::move(analysed->lg);
+                loopBuffer = std::move(analysed->loopBuffer);
+                takeLoop(analysed->loop);
+                setLoopToBank();
+            } else {
+                loopPoint_l_auto = 0;
+                loopPoint_r_auto = 0;
+                if (guiIsCreated) {
+                    Widget_t *dia = open_message_dialog(w, ERROR_BOX, "loopino",
+                        freq > 0.0 ? _("Fail to create loop") : _("Fail to get root Frequency"),NULL);
+                    os_set_transient_for_hint(w, dia);
+                }
+            }
+        } else {
+            setOneShootToBank();
+            if (createLoop()) {
+                setLoopToBank();
+            }
+        }
         #if defined (RUN_AS_PLUGIN)
         setValuesFromHost();
         #endif
@@ -407,6 +577,7 @@ public:
         wview->adj = wview->adj_x;
         wview->func.expose_callback = draw_wview;
         wview->func.button_release_callback = set_playhead;
+        add_tooltip(wview, "Mouse wheel zoom");
         commonWidgetSettings(wview);
 
         lw = create_widget(app, w_top, 484, 40, 484, 140);
@@ -420,6 +591,7 @@ public:
         set_adjustment(loopview->adj_x,0.0, 0.0, 0.0, 1000.0,1.0, CL_METER);
         loopview->func.expose_callback = draw_lwview;
         //loopview->func.button_release_callback = set_playhead;
+        loopview->func.button_release_callback = zoom_view;
         commonWidgetSettings(loopview);
         // Controls Window takes all space between wave view and keyboard
         Controls = create_widget(app, w_top, 0, 180, WINDOW_WIDTH, WINDOW_HEIGHT - 180 - 80);
@@ -742,6 +914,7 @@ private:
     std::string newLabel;
     std::vector<std::string> keys;
     std::vector<std::string> presetFiles;
+    std::vector<std::string> menuPresetFiles;   // the names the open menu was built from
 
     std::string configFile;
     std::string presetFile;
@@ -749,9 +922,12 @@ private:
     std::string presetName;
     std::string filename;
 
-    int loadPresetMIDI;
+    std::atomic<int> loadPresetMIDI;
     int lastPresetMIDI;
     int currentPresetNum;
+    int presetFadeWait;
+    uint64_t presetFadeFrames;
+    std::chrono::steady_clock::time_point presetFadeStart;
     
     float attack, decay, sustain, release;
     float frequency, tone, age;
@@ -785,7 +961,7 @@ private:
     int LMark = 0;
     int tuningScale = 0;
     int genrateKeyCache = 0;
-    constexpr static uint32_t KEYCACHE_MAX_SAMPLES = 384000;
+    int lastKeyCacheState = 0;
     std::vector<float> analyseBuffer;
     std::function<float()> latencyCallback;
 
@@ -833,29 +1009,34 @@ private:
         freq = 0.0;
         pitchCorrection = 0;
         rootkey = 0;
-        if (af.samples) rootkey = pt.getPitch(af.samples, af.samplesize , af.channels, (float)jack_sr, &pitchCorrection, &freq);
+        if (af.samples) rootkey = pt.getPitch(af.samples, af.samplesize , af.channels, (float)bufferRate(), &pitchCorrection, &freq);
         customRootkey = rootkey;
         if (guiIsCreated) combobox_set_active_entry(RootKey, rootkey);
     }
 
+    // loopBuffer hold a fresh generated loop
+    void takeLoop(const LoopGenerator::LoopInfo& loopinfo) {
+        loopPoint_l_auto = loopinfo.start;
+        loopPoint_r_auto = loopinfo.end;
+        matches = loopinfo.matches;
+        currentLoop = matches - 1;
+        normalize(loopBuffer, 0.6f);
+        loopBufferSave.clear();
+        loopBufferSave.resize(loopBuffer.size());
+        for (size_t i = 0; i < loopBuffer.size(); ++i) {
+            loopBufferSave[i] = loopBuffer[i];
+        }
+        process_sharp();
+    }
+
     bool createLoop() {
         getPitch();
         if (freq > 0.0) {
             LoopGenerator::LoopInfo loopinfo;
             loopBuffer.clear();
             if (lg.generateLoop(af.samples, loopPoint_l, loopPoint_r, af.samplesize ,
-                                af.channels, jack_sr, freq, loopBuffer, loopinfo, loopPeriods)) {
-                loopPoint_l_auto = loopinfo.start;
-                loopPoint_r_auto = loopinfo.end;
-                matches = loopinfo.matches;
-                currentLoop = matches - 1;
-                normalize(loopBuffer, 0.6f);
-                loopBufferSave.clear();
-                loopBufferSave.resize(loopBuffer.size());
-                for (size_t i = 0; i < loopBuffer.size(); ++i) {
-                    loopBufferSave[i] = loopBuffer[i];
-                }
-                process_sharp();
+                                af.channels, bufferRate(), freq, loopBuffer, loopinfo, loopPeriods)) {
+                takeLoop(loopinfo);
             } else {
                 loopPoint_l_auto = 0;
                 loopPoint_r_auto = 0;
@@ -882,176 +1063,170 @@ private:
         offline processor (sharp (square) and saw tooth)
 ****************************************************************/
 
-    void process_fadeout(std::vector<float>& buffer) {
-        if (buffer.empty() || fadeout <= 0.0f) return;
-
-        const size_t N = buffer.size();
-        const float maxFraction = 5.0f / 6.0f;
-        size_t fadeSamples = size_t(maxFraction * fadeout * N);
-        if (fadeSamples < 1) return;
-        size_t start = N - fadeSamples;
-
-        for (size_t i = start; i < N; ++i)
-        {
-            float t = float(i - start) / float(fadeSamples);
-            float gain = std::exp(-3.0f * t);
-            buffer[i] *= gain;
-        }
-    }
-
-    void process_saw(std::vector<float>& buffer) {
-        if (buffer.empty()) return;
-        if (std::abs(saw) <= 0.0001f) return;
-
-        float sawAmount = std::abs(saw);
-        bool reverseSaw = (saw < 0.0f);
-
-        const size_t N = buffer.size();
-        float* out = buffer.data();
-
-        const float snapTime = 0.003f * sawAmount;
-        size_t start = 0;
-
-        while (start < N - 1) {
-
-            while (start < N - 1 && out[start] == 0.0f)
-                start++;
-            if (start >= N - 1) break;
-
-            float sgn = (out[start] >= 0.0f ? 1.0f : -1.0f);
-            size_t end = start + 1;
-
-            while (end < N && (out[end] * sgn) >= 0.0f)
-                end++;
-
-            size_t len = end - start;
-            if (len < 3) { start = end; continue; }
-
-            float mn = out[start], mx = out[start];
-            for (size_t i = start; i < end; ++i) {
-                mn = std::min<float>(mn, out[i]);
-                mx = std::max<float>(mx, out[i]);
-            }
-
-            // linear ramp (forward / reverse)
-            for (size_t i = 0; i < len; ++i) {
-                float t = float(i) / float(len - 1);
-                float linear;
-
-                if (!reverseSaw) {
-                    if (sgn > 0.0f) linear = mn + t * (mx - mn);
-                    else           linear = mx + t * (mn - mx);
-                } else {
-                    if (sgn > 0.0f) linear = mx - t * (mx - mn);
-                    else           linear = mn - t * (mn - mx);
-                }
-                float x = (1.0f - sawAmount) * out[start + i] +
-                                            sawAmount * linear;
-                x = (std::abs(x) < 1e-15f) ? 0.0f : x;
-
-                out[start + i] = x;
-            }
-
-            // snap
-            size_t snapSamples = size_t(snapTime * float(len));
-            snapSamples = std::clamp(snapSamples, size_t(1), len / 3);
-
-            float alpha = 0.25f + sawAmount * 0.35f;
-            float beta  = 1.20f + sawAmount * 0.50f;
-
-            for (size_t i = 0; i < snapSamples; ++i) {
-                float t = float(i) / float(snapSamples - 1);
-                float snapEnv = std::pow(t, alpha) * std::pow(1.0f - t, beta);
-
-                size_t idx = reverseSaw ? (start + i) : (end - 1 - i);
-
-                float snapTarget;
-                if (!reverseSaw)
-                    snapTarget = (sgn > 0.0f ? mn : mx);
-                else
-                    snapTarget = (sgn > 0.0f ? mx : mn);
-                float x = out[idx] * (1.0f - snapEnv) +
-                                    snapTarget * snapEnv;
-                x = (std::abs(x) < 1e-15f) ? 0.0f : x;
-                out[idx] = x;
-            }
-
-            start = end;
-        }
+    ShapeParams shapeParams() const {
+        return ShapeParams{ sharp, saw, fadeout };
     }
 
     void process_sharp(){
         if (!loopBuffer.size()) return;
-
-        for (size_t i = 0; i < loopBuffer.size(); ++i) {
-            loopBuffer[i] = loopBufferSave[i];
-        }
-
-        float drive = 1.0f + sharp * 25.0f;
-        float compDB = sharp * 6.0f;
-        float compensation = std::pow(10.0f, compDB / 20.0f);
-
-        for (size_t i = 0; i < loopBuffer.size(); ++i) {
-            float x = loopBuffer.data()[i];
-            float shaped = std::tanh(x * drive);
-
-            loopBuffer[i] = (x + sharp * (shaped - x)) * compensation;
-        }
-        process_saw(loopBuffer);
-        normalize(loopBuffer, 0.6f);
+        WaveShaper::render(loopBufferSave.data(), loopBuffer.data(), loopBuffer.size(),
+                                                            shapeParams(), false);
         if (guiIsCreated) {
             loadLoopNew = true;
-            update_waveview(loopview, loopBuffer.data(), loopBuffer.size());
+            setWaveView(loopview, loopBuffer.data(), loopBuffer.size());
         }
     }
 
-    void process_sample_sharp() {
-        if (!sampleBuffer.size()) return;
-
-        for (size_t i = 0; i < sampleBuffer.size(); ++i)
-            sampleBuffer[i] = sampleBufferSave[i];
-
-        float drive = 1.0f + sharp * 25.0f;
-        float compDB = sharp * 6.0f;
-        float compensation = std::pow(10.0f, compDB / 20.0f);
+    // hand a buffer to a wave view and summarise it for drawing,
+    // a buffer of a other length show up unzoomed
+    void setWaveView(Widget_t* view, float* data, size_t size) {
+        WaveView_t *wave_view = (WaveView_t*)view->private_struct;
+        const bool resized = wave_view->size != (int)size;
+        update_waveview(view, data, size);
+        (view == loopview ? loopPeaks : wavePeaks).build(data, size);
+        if (resized) {
+            zoomOf(view) = WaveZoom();
+            if (view == wview && guiIsCreated) placeLoopMarks();
+        }
+    }
 
-        for (size_t i = 0; i < sampleBuffer.size(); ++i) {
-            float x = sampleBuffer[i];
-            float shaped = std::tanh(x * drive);
+    WaveZoom& zoomOf(Widget_t* view) {
+        return view == loopview ? loopZoom : waveZoom;
+    }
 
-            sampleBuffer[i] =  (x + sharp * (shaped - x)) * compensation;
+    // mouse wheel zoom, the sample under the pointer stay in place
+    void zoomWaveView(Widget_t* view, int x, bool in) {
+        WaveView_t *wave_view = (WaveView_t*)view->private_struct;
+        if (wave_view->size < 1) return;
+        Metrics_t metrics;
+        os_get_window_metrics(view, &metrics);
+        WaveZoom& z = zoomOf(view);
+        const double span = z.to - z.from;
+        const double at = z.toState(std::clamp((double)x / (double)metrics.width, 0.0, 1.0));
+        // not closer than 64 samples over the whole view
+        const double minSpan = std::min(1.0, 64.0 / (double)wave_view->size);
+        const double next = std::clamp(span * (in ? 0.5 : 2.0), minSpan, 1.0);
+        const double from = std::clamp(at - (at - z.from) * next / span, 0.0, 1.0 - next);
+        z.from = from;
+        z.to = from + next;
+        if (view == loopview) {
+            loadLoopNew = true;
+        } else {
+            loadNew = true;
+            placeLoopMarks();
         }
+        expose_widget(view);
+    }
 
-        process_saw(sampleBuffer);
-        process_fadeout(sampleBuffer);
-        normalize(sampleBuffer, 0.6f);
+    static void zoom_view(void *w_, void* xbutton_, void* user_data) {
+        Widget_t *w = (Widget_t*)w_;
+        Loopino *self = static_cast<Loopino*>(w->parent_struct);
+        XButtonEvent *xbutton = (XButtonEvent*)xbutton_;
+        if (!(w->flags & HAS_POINTER)) return;
+        if (xbutton->button == Button4) self->zoomWaveView(w, xbutton->x, true);
+        else if (xbutton->button == Button5) self->zoomWaveView(w, xbutton->x, false);
+    }
 
+    void process_sample_sharp() {
+        if (!sampleBuffer.size()) return;
+        shaper.cancelRunning();
+        WaveShaper::render(sampleBufferSave.data(), sampleBuffer.data(), sampleBuffer.size(),
+                                                            shapeParams(), true);
         if (guiIsCreated) {
             loadNew = true;
-            update_waveview(wview, sampleBuffer.data(), sampleBuffer.size());
+            setWaveView(wview, sampleBuffer.data(), sampleBuffer.size());
         }
     }
 
+    // knob moves: draw a preview from a decimated buffer and render
+    // the full buffer in the background, applyShape() swap it in
+    void shapeSample() {
+        if (!sampleBufferSave.size()) return;
+        if (!guiIsCreated) {
+            process_sample_sharp();
+            setOneShootBank();
+            return;
+        }
+        if (!sampleSaveSnap)
+            sampleSaveSnap = std::make_shared<const std::vector<float>>(sampleBufferSave);
+        const ShapeParams p = shapeParams();
+        std::vector<float> pv = WaveShaper::preview(sampleBufferSave.data(),
+                                    sampleBufferSave.size(), 1 << 15, p, true);
+        wavePeaks.build(pv.data(), pv.size(), sampleBufferSave.size());
+        shaper.start(sampleSaveSnap, p);
+    }
+
+    void applyShape(std::unique_ptr<ShapeRenderer::Result> r) {
+        // made from a buffer which is gone meanwhile
+        if (r->source != sampleSaveSnap || r->data.size() != sampleBuffer.size()) return;
+        sampleBuffer.swap(r->data);
+        loadNew = true;
+        setWaveView(wview, sampleBuffer.data(), sampleBuffer.size());
+        if (!inShape) setOneShootBank();
+    }
+
 /****************************************************************
                     Load samples into synth
 ****************************************************************/
 
-    void setOneShootBank(bool custom = false) {
+    // rate of af.samples and the buffers made from it, of a
+    // streamed file only a decimated overview is held
+    uint32_t bufferRate() const {
+        return streamSource ? overviewRate : jack_sr;
+    }
+
+    // the KeyCache plan for the sample and the root frequency in use,
+    // made again when one of them or the budgets change
+    bool updateCachePlan(size_t frames, double rootFreq) {
+        planFrames = frames;
+        planFreq = rootFreq;
+        cachePlan = synth.rb.planFor(frames, rootFreq);
+        return cachePlan.fits;
+    }
+
+    void setKeyCacheBudget() {
+        synth.rb.setMemoryBudget(size_t(keyCacheMemoryMB) * 1024 * 1024);
+        synth.rb.setTimeBudget((double)keyCacheSeconds);
+        if (!planFrames) return;
+        toBig = !updateCachePlan(planFrames, planFreq);
+        synth.setSampleToBig(toBig);
+        // a sample played from memory is cached again with the new plan
+        if (sampleData && !sampleData->stream) synth.setBank(&sbank);
+        loadNew = true;
+        expose_widget(wview);
+    }
+
+    void setOneShootBank(bool custom = false, bool analysed = false) {
         if (!sampleBuffer.size()) return;
-        if (!sampleData) sampleData = std::make_shared<SampleInfo>();
-        if (!custom) getPitch();
-        toBig = sampleBuffer.size() < KEYCACHE_MAX_SAMPLES ? false : true;
+        // a fresh SampleInfo, the voices may still play the last one
+        sampleData = std::make_shared<SampleInfo>();
+        if (!custom && !analysed) getPitch();
+        if (streamSource) {
+            // played from disk, the KeyCache never see it
+            planFrames = 0;
+            cachePlan = KeyCachePlan();
+            toBig = true;
+        } else {
+            toBig = !updateCachePlan(sampleBuffer.size(), custom ? customFreq : freq);
+        }
         synth.setSampleToBig(toBig);
 
         //sbank.clear();
-        sampleData->data = sampleBuffer;
-        sampleData->sourceRate = (double)jack_sr;
+        if (streamSource) {
+            // only the head stay in memory, the voices stream the rest
+            sampleData->data = streamSource->head;
+            sampleData->stream = streamSource;
+            sampleData->sourceRate = streamSource->sampleRate;
+        } else {
+            sampleData->data = sampleBuffer;
+            sampleData->sourceRate = (double)jack_sr;
+        }
         sampleData->rootFreq = custom ? (double) customFreq : (double) freq;
-        sbank.addSample(std::const_pointer_cast<const SampleInfo>(sampleData));
+        sbank.publish(std::const_pointer_cast<const SampleInfo>(sampleData));
         synth.setBank(&sbank);
     }
 
-    void setOneShootToBank(bool custom = false) {
+    void setOneShootToBank(bool custom = false, bool analysed = false) {
         if (!af.samples) return;
         
         sampleBuffer.clear();
@@ -1073,22 +1248,23 @@ private:
         }
 
         sampleBufferSave.clear();
+        sampleSaveSnap.reset();
         sampleBufferSave.resize(sampleBuffer.size());
         for (size_t i = 0; i < sampleBuffer.size(); ++i) {
             sampleBufferSave[i] = sampleBuffer[i];
         }
 
         process_sample_sharp();
-        custom ? setOneShootBank(true) : setOneShootBank(false);
+        setOneShootBank(custom, analysed);
     }
 
     void setLoopBank() {
         if (!loopBuffer.size()) return;
-        if (!loopData) loopData = std::make_shared<SampleInfo>();
+        loopData = std::make_shared<SampleInfo>();
         loopData->data = loopBufferSave;
-        loopData->sourceRate = (double)jack_sr;
+        loopData->sourceRate = (double)bufferRate();
         loopData->rootFreq = (double)freq;
-        lbank.addSample(std::const_pointer_cast<const SampleInfo>(loopData));
+        lbank.publish(std::const_pointer_cast<const SampleInfo>(loopData));
         synth.setLoopBank(&lbank);
         analyseBuffer.clear();
         analyseBuffer.resize(40960);
@@ -1112,12 +1288,13 @@ private:
                 loopRootkey = rootkey;
             }
         }
+        loopData = std::make_shared<SampleInfo>();
         loopData->data = loopBuffer;
-        loopData->sourceRate = (double)jack_sr;
+        loopData->sourceRate = (double)bufferRate();
         loopData->rootFreq = (double)(freq * cor);
        // int set = max(1,jack_sr/loopBuffer.size());
        // for (int i =0; i<set;i++)
-        lbank.addSample(std::const_pointer_cast<const SampleInfo>(loopData));
+        lbank.publish(std::const_pointer_cast<const SampleInfo>(loopData));
         synth.setLoopBank(&lbank);
         if (guiIsCreated) {
             uint32_t length = loopPoint_r_auto - loopPoint_l_auto;
@@ -1141,6 +1318,103 @@ private:
         setLoopBank();
     }
 
+/****************************************************************
+                    Key/velocity zones
+****************************************************************/
+
+    // load a file as a further zone, the root key come from the pitch
+    // tracker and the loop from the loop search, both at jack_sr
+    bool addZone(const std::string& file) {
+        static_assert(PresetLoader::MAX_ZONES < SampleBank::CAPACITY, "zones beside slot 0");
+        if (!jack_sr || zones.size() >= PresetLoader::MAX_ZONES) return false;
+        AudioFile zf;
+        zf.cache.setDir(af.cache.getDir());
+        zf.downmixMode = af.downmixMode;
+        if (!zf.getAudioFile(file.c_str(), jack_sr) || !zf.samples) return false;
+        auto info = std::make_shared<SampleInfo>();
+        info->data.assign(zf.samples, zf.samples + zf.samplesize);
+        normalize(info->data, 0.6f);
+        float f = 0.0f;
+        int16_t cor = 0;
+        const uint8_t key = pt.getPitch(info->data.data(), info->data.size(), 1,
+                                                        (float)jack_sr, &cor, &f);
+        if (f <= 0.0f) return false;
+        info->sourceRate = (double)jack_sr;
+        info->rootFreq = (double)f;
+        ZoneSample z;
+        z.rootkey = key;
+        LoopGenerator zl;
+        std::vector<float> loop;
+        LoopGenerator::LoopInfo li;
+        if (zl.generateLoop(info->data.data(), 0, info->data.size(), info->data.size(), 1,
+                                                    jack_sr, f, loop, li, loopPeriods)) {
+            z.range.loopStart = (uint32_t)li.start;
+            z.range.loopEnd = (uint32_t)li.end;
+        }
+        z.sample = info;
+        zones.push_back(z);
+        splitZones();
+        publishZones();
+        return true;
+    }
+
+    void clearZones() {
+        zones.clear();
+        publishZones();
+    }
+
+    // the keys between two roots get split in the middle, the root of
+    // the main sample count too, it play the keys no zone cover.
+    // Zones on the same root are velocity layers, in the order they
+    // were added.
+    void splitZones() {
+        std::vector<int> roots { customRootkey };
+        for (const auto& z : zones) roots.push_back(z.rootkey);
+        std::sort(roots.begin(), roots.end());
+        roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+        for (size_t i = 0; i < zones.size(); ++i) {
+            ZoneSample& z = zones[i];
+            const auto at = std::lower_bound(roots.begin(), roots.end(), (int)z.rootkey);
+            z.range.loKey = at == roots.begin() ? 0 : (uint8_t)((*(at - 1) + z.rootkey) / 2 + 1);
+            z.range.hiKey = at + 1 == roots.end() ? 127 : (uint8_t)((z.rootkey + *(at + 1)) / 2);
+            int layers = 0;
+            int layer = 0;
+            for (size_t j = 0; j < zones.size(); ++j) {
+                if (zones[j].rootkey != z.rootkey) continue;
+                if (j < i) layer++;
+                layers++;
+            }
+            z.range.loVel = (uint8_t)(layer * 128 / layers);
+            z.range.hiVel = (uint8_t)((layer + 1) * 128 / layers - 1);
+        }
+    }
+
+    void publishZones() {
+        for (size_t i = 0; i < zones.size(); ++i)
+            sbank.publish(zones[i].sample, i + 1, zones[i].range);
+        for (size_t i = zones.size() + 1; i < SampleBank::CAPACITY; ++i)
+            if (sbank.getZone(i)) sbank.clear(i);
+    }
+
+    void showZoneDialog() {
+        Widget_t *dia = open_file_dialog(w_top, getenv("HOME") ? getenv("HOME") : PATH_SEPARATOR, "audio");
+        #if defined(__linux__) || defined(__FreeBSD__) || \
+            defined(__NetBSD__) || defined(__OpenBSD__)
+        XSetTransientForHint(w_top->app->dpy, dia->widget, w_top->widget);
+        #endif
+        w_top->func.dialog_callback = [] (void *w_, void* user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            if(user_data !=NULL && strlen(*(const char**)user_data)) {
+                Loopino *self = static_cast<Loopino*>(w->parent_struct);
+                if (!self->addZone(*(const char**)user_data)) {
+                    Widget_t *dia = open_message_dialog(self->w, ERROR_BOX, "loopino",
+                                                        _("Fail to add zone"),NULL);
+                    os_set_transient_for_hint(self->w, dia);
+                }
+            }
+        };
+    }
+
 /****************************************************************
                     Sound File clipping
 ****************************************************************/
@@ -1150,22 +1424,39 @@ private:
         if (!af.samples) return;
         play = false;
         ready = false;
-        uint32_t new_size = (loopPoint_r-loopPoint_l) * af.channels;
-        delete[] af.saveBuffer;
-        af.saveBuffer = nullptr;
-        af.saveBuffer = new float[new_size];
-        std::memset(af.saveBuffer, 0, new_size * sizeof(float));
-        for (uint32_t i = 0; i<new_size; i++) {
-            af.saveBuffer[i] = af.samples[i+loopPoint_l];
-        }
         matches = 0;
-        delete[] af.samples;
-        af.samples = nullptr;
-        af.samples =  new float[new_size];
-        std::memset(af.samples, 0, new_size * sizeof(float));
-        memcpy(af.samples, af.saveBuffer, new_size * sizeof(float));
-
-        af.samplesize = new_size / af.channels;
+        loader.cancel();
+        if (streamSource) {
+            // only the overview is in memory, read the part from disk
+            // and hold it in memory from now on
+            const double scale = streamSource->sampleRate / (double)overviewRate;
+            std::vector<float> part = streamSource->readRange((uint64_t)(loopPoint_l * scale),
+                                                              (uint64_t)(loopPoint_r * scale));
+            uint32_t size = (uint32_t)part.size();
+            float* buf = size ? new float[size] : nullptr;
+            if (buf) std::memcpy(buf, part.data(), size * sizeof(float));
+            buf = af.checkSampleRate(&size, 1, buf, (uint32_t)streamSource->sampleRate, jack_sr);
+            streamSource.reset();
+            delete[] af.samples;
+            af.samples = buf;
+            af.samplesize = buf ? size : 0;
+            af.channels = 1;
+        } else {
+            uint32_t new_size = (loopPoint_r-loopPoint_l) * af.channels;
+            delete[] af.saveBuffer;
+            af.saveBuffer = nullptr;
+            af.saveBuffer = new float[new_size];
+            std::memset(af.saveBuffer, 0, new_size * sizeof(float));
+            for (uint32_t i = 0; i<new_size; i++) {
+                af.saveBuffer[i] = af.samples[i+loopPoint_l];
+            }
+            delete[] af.samples;
+            af.samples = nullptr;
+            af.samples =  new float[new_size];
+            std::memset(af.samples, 0, new_size * sizeof(float));
+            memcpy(af.samples, af.saveBuffer, new_size * sizeof(float));
+            af.samplesize = new_size / af.channels;
+        }
         position = 0;
         adj_set_max_value(wview->adj, (float)af.samplesize);
         adj_set_state(loopMark_L->adj_x, 0.0);
@@ -1192,7 +1483,7 @@ private:
     void failToLoad() {
         if (guiIsCreated) {
             loadNew = true;
-            update_waveview(wview, af.samples, af.samplesize);
+            setWaveView(wview, af.samples, af.samplesize);
             widget_set_title(w_top, "loopino");
         }
     }
@@ -1207,8 +1498,27 @@ private:
         ready = false;
         play_loop = false;
         matches = 0;
+        streamSource.reset();
+        loader.cancel();
         adj_set_value(setLoop->adj, 0.0);
-        is_loaded = af.getAudioFile(file, jack_sr);
+        // a long file play from disk, only the overview get loaded
+        uint64_t frames = 0;
+        uint32_t rate = 0;
+        if (AudioFile::probe(file, frames, rate) && StreamSource::wanted(frames, rate)) {
+            is_loaded = af.getOverview(file, StreamSource::OVERVIEW_FRAMES);
+            if (is_loaded) {
+                overviewRate = af.samplerate;
+                // the peak come with the overview, the stream only read the head
+                streamSource = StreamSource::open(file, 0.6f, af.downmixMode, af.peak);
+                is_loaded = streamSource != nullptr;
+            }
+            if (!is_loaded) {
+                delete[] af.samples;
+                af.samples = nullptr;
+            }
+        } else {
+            is_loaded = af.getAudioFile(file, jack_sr);
+        }
         if (!is_loaded) failToLoad();
     }
 
@@ -1226,8 +1536,6 @@ private:
             }
             loopPoint_l = 0;
             loopPoint_r = af.samplesize;
-            toBig = af.samplesize < KEYCACHE_MAX_SAMPLES ? false : true;
-            synth.setSampleToBig(toBig);
 
             //loadLoopNew = true;
             //update_waveview(wview, af.samples, af.samplesize);
@@ -1243,6 +1551,8 @@ private:
 
     void generateSine() {
         int new_size = static_cast<int>(4.0 * jack_sr);
+        streamSource.reset();
+        loader.cancel();
         delete[] af.samples;
         af.samples = nullptr;
         af.samples =  new float[new_size];
@@ -1285,6 +1595,8 @@ private:
 
     void record_sample() {
         int new_size = static_cast<int>(4.0 * jack_sr);
+        streamSource.reset();
+        loader.cancel();
         delete[] af.samples;
         af.samples = nullptr;
         af.samples =  new float[new_size];
@@ -1298,7 +1610,7 @@ private:
         play = false;
         if (guiIsCreated) {
             loadNew = true;
-            update_waveview(wview, af.samples, af.samplesize);
+            setWaveView(wview, af.samples, af.samplesize);
         }
     }
 
@@ -1389,6 +1701,7 @@ private:
                     }
                 } else if (strstr(dndfile, ".kbm")) {
                     if (Scala::loadKBM(self->url_decode(dndfile), self->synth.getScalaTable())) {
+                        self->synth.publishTuning();
                         std::cout << "kbm loaded" << std::endl;
                     }
                 } else {
@@ -1455,11 +1768,20 @@ private:
         #if defined (RUN_AS_PLUGIN)
             runGui();
         #endif
-        if (loadPresetMIDI > -1) {
+        if (auto r = loader.take()) applyLoad(std::move(r));
+        if (auto r = shaper.take()) applyShape(std::move(r));
+        if (auto r = batch.take()) batchDone(std::move(r));
+        // redraw once the background summary is in place
+        if (wavePeaks.takeFresh()) loadNew = true;
+        if (presetIndex.takeFresh()) createPrestList();
+        if (loopPeaks.takeFresh()) loadLoopNew = true;
+        // written by the audio thread
+        const int presetMIDI = loadPresetMIDI.exchange(-1);
+        if (presetMIDI > -1 && !presetFiles.empty()) {
             int loadNew = -1;
-            if (loadPresetMIDI > lastPresetMIDI) {
+            if (presetMIDI > lastPresetMIDI) {
                 loadNew = currentPresetNum + 1;
-            } else if (loadPresetMIDI < lastPresetMIDI) {
+            } else if (presetMIDI < lastPresetMIDI) {
                 loadNew = currentPresetNum - 1;
             }
             if (loadNew > (int)presetFiles.size() - 1) {
@@ -1468,11 +1790,37 @@ private:
                 loadNew = presetFiles.size() - 1;
             }
             currentPresetNum = loadNew;
-            lastPresetMIDI = loadPresetMIDI;
+            lastPresetMIDI = presetMIDI;
             std::string name = presetFiles[currentPresetNum];
             std::string path = getPathFor(name);
-            loadPreset(path);
-            loadPresetMIDI = -1;
+            startPresetLoad(path);
+        }
+        if (auto r = presetLoader.take()) {
+            if (r->ok) {
+                pendingPreset = std::move(r);
+                presetFadeWait = 0;
+                presetFadeFrames = synth.renderedFrames();
+                presetFadeStart = std::chrono::steady_clock::now();
+                synth.fadeOut();
+            }
+        }
+        if (pendingPreset) {
+            // count only the ticks where the audio didn't render a sample
+            const uint64_t rendered = synth.renderedFrames();
+            if (rendered != presetFadeFrames) {
+                presetFadeFrames = rendered;
+                presetFadeWait = 0;
+            }
+            // swap once the voices are faded out, or when the audio doesn't run,
+            // the fade take 10 ms of audio, a half second is the upper bound
+            // even for the longest periods
+            const bool late = std::chrono::steady_clock::now() - presetFadeStart >
+                                                        std::chrono::milliseconds(500);
+            if (synth.isMuted() || ++presetFadeWait > 10 || late) {
+                applyPreset(std::move(pendingPreset));
+                synth.fadeIn();
+                prefetchNeighbours();
+            }
         }
         #ifndef IS_VST2
         if (!isAlsa) {
@@ -1506,8 +1854,10 @@ private:
         sz.updateTweens(1.0f / 60.0f);
         if (sz.resizeTimeOut > 0) sz.resizeTimeOut--;
         if (sz.resizeTimeOut == 1) sz.relayoutNow();
-        if (synth.rb.getKeyCacheState())
+        int keyCacheState = synth.rb.getKeyCacheState();
+        if (keyCacheState || keyCacheState != lastKeyCacheState)
             expose_widget(Controls);
+        lastKeyCacheState = keyCacheState;
         #ifndef RUN_AS_PLUGIN
         if (!record && timer == 0) {
             set_record();
@@ -1579,6 +1929,8 @@ private:
         set_adjustment(FadeOut->adj, 0.0, 0.0, 0.0, 1.0, 0.01, CL_CONTINUOS);
         set_widget_color(FadeOut, (Color_state)3, (Color_mod)2, 0.15, 0.52, 0.55, 1.0);
         FadeOut->func.expose_callback = draw_knob;
+        FadeOut->func.button_press_callback = shape_pressed;
+        FadeOut->func.button_release_callback = fade_released;
         FadeOut->func.value_changed_callback = fade_callback;
         commonWidgetSettings(FadeOut);
 
@@ -1703,6 +2055,7 @@ private:
         set_adjustment(Sharp->adj, 0.0, 0.0, -1.0, 1.0, 0.01, CL_CONTINUOS);
         set_widget_color(Sharp, (Color_state)3, (Color_mod)2, 0.55, 0.42, 0.15, 1.0);
         Sharp->func.expose_callback = draw_knob;
+        Sharp->func.button_press_callback = shape_pressed;
         Sharp->func.button_release_callback = sharp_released;
         Sharp->func.value_changed_callback = sharp_callback;
         commonWidgetSettings(Sharp);
@@ -1715,6 +2068,7 @@ private:
         set_adjustment(Saw->adj, 0.0, 0.0, -1.0, 1.0, 0.01, CL_CONTINUOS);
         set_widget_color(Saw, (Color_state)3, (Color_mod)2, 0.55, 0.52, 0.15, 1.0);
         Saw->func.expose_callback = draw_knob;
+        Saw->func.button_press_callback = shape_pressed;
         Saw->func.button_release_callback = sharp_released;
         Saw->func.value_changed_callback = saw_callback;
         commonWidgetSettings(Saw);
@@ -2500,7 +2854,7 @@ private:
         if (self->toBig) {
             if (self->guiIsCreated) {
                 self->loadNew = true;
-                update_waveview(self->wview, self->sampleBuffer.data(), self->sampleBuffer.size());
+                self->setWaveView(self->wview, self->sampleBuffer.data(), self->sampleBuffer.size());
             }
         } else {
             self->synth.genCache(self->genrateKeyCache);
@@ -2676,7 +3030,7 @@ private:
         adj_set_state(w->adj_x, st);
         if (adj_get_state(self->loopMark_R->adj_x) < st+0.01)adj_set_state(self->loopMark_R->adj_x, st+0.01);
         int width = self->w->width-36;
-        os_move_window(self->w->app->dpy, w, 15+ (width * st), 2);
+        os_move_window(self->w->app->dpy, w, 15+ (width * self->markView(st)), 2);
         self->loopPoint_l = lp;
         //if(self->af.samples) fprintf(stderr, "left %f\n", self->af.samples[self->loopPoint_l]);
     }
@@ -2717,7 +3071,7 @@ private:
         x2 += x1;
         int width = self->w->width-36;
         int pos = max(15, min (width+15,x2-5));
-        float st =  (float)( (float)(pos-15.0)/(float)width);
+        float st = self->waveZoom.toState((float)(pos-15.0)/(float)width);
         uint32_t lp = (self->af.samplesize) * st;
         if (lp > self->position) {
             self->position = lp;
@@ -2725,7 +3079,8 @@ private:
         }
         st = std::clamp(st, 0.0f, 0.99f);
         float st_ = adj_get_state(w->adj);
-        st = std::clamp(st, st_ - 0.01f, st_ + 0.01f);
+        const float step = 0.01f * (self->waveZoom.to - self->waveZoom.from);
+        st = std::clamp(st, st_ - step, st_ + step);
         adj_set_state(w->adj_x, st);
     }
 
@@ -2743,7 +3098,7 @@ private:
         adj_set_state(w->adj_x, st);
         if (adj_get_state(self->loopMark_L->adj_x) > st-0.01)adj_set_state(self->loopMark_L->adj_x, st-0.01);
         int width = self->w->width-36;
-        os_move_window(self->w->app->dpy, w, 15 + (width * st), 2);
+        os_move_window(self->w->app->dpy, w, 15 + (width * self->markView(st)), 2);
         self->loopPoint_r = lp;
         //if(self->af.samples) fprintf(stderr, "right %f\n", self->af.samples[self->loopPoint_r]);
     }
@@ -2774,7 +3129,7 @@ private:
         x2 += x1;
         int width = self->w->width-36;
         int pos = max(15, min (width+15,x2-5));
-        float st =  (float)( (float)(pos-15.0)/(float)width);
+        float st = self->waveZoom.toState((float)(pos-15.0)/(float)width);
          uint32_t lp = (self->af.samplesize * st);
         if (lp < self->position) {
             self->position = lp;
@@ -2782,7 +3137,8 @@ private:
         }
         st = std::clamp(st, 0.01f, 1.0f);
         float st_ = adj_get_state(w->adj_x);
-        st = std::clamp(st, st_ - 0.01f, st_ + 0.01f);
+        const float step = 0.01f * (self->waveZoom.to - self->waveZoom.from);
+        st = std::clamp(st, st_ - step, st_ + step);
         adj_set_state(w->adj_x, st);
     }
 
@@ -2790,11 +3146,20 @@ private:
     static void resize_callback(void *w_, void* user_data) {
         Widget_t *w = (Widget_t*)w_;
         Loopino *self = static_cast<Loopino*>(w->parent_struct);
-        float st = adj_get_state(self->loopMark_L->adj_x);
-        int width = self->w->width-36;
-        os_move_window(w->app->dpy, self->loopMark_L, 15+ (width * st), 2);
-        st = adj_get_state(self->loopMark_R->adj_x);
-        os_move_window(w->app->dpy, self->loopMark_R, 15+ (width * st), 2);
+        self->placeLoopMarks();
+    }
+
+    // position of a loop mark in the zoomed wave view, out of view marks sit at the edge
+    float markView(float st) const {
+        return std::clamp((float)waveZoom.toView(st), 0.0f, 1.0f);
+    }
+
+    void placeLoopMarks() {
+        int width = w->width-36;
+        float st = adj_get_state(loopMark_L->adj_x);
+        os_move_window(w->app->dpy, loopMark_L, 15+ (width * markView(st)), 2);
+        st = adj_get_state(loopMark_R->adj_x);
+        os_move_window(w->app->dpy, loopMark_R, 15+ (width * markView(st)), 2);
     }
 
     // inform SizeGroup about window resize
@@ -2816,10 +3181,13 @@ private:
                 int width = metrics.width;
                 int x = xbutton->x;
                 float st = max(0.0, min(1.0, static_cast<float>((float)x/(float)width)));
+                st = self->waveZoom.toState(st);
                 uint32_t lp = adj_get_max_value(w->adj) * st;
                 if (lp > self->loopPoint_r) lp = self->loopPoint_r;
                 if (lp < self->loopPoint_l) lp = self->loopPoint_l;
                 self->position = lp;
+            } else if (xbutton->button == Button4 || xbutton->button == Button5) {
+                zoom_view(w_, xbutton_, user_data);
             }
         }
     }
@@ -2942,13 +3310,28 @@ private:
         self->synth.setGain(self->gain);
     }
 
+    static void shape_pressed(void *w_, void* xbutton_, void* user_data) {
+        Widget_t *w = (Widget_t*)w_;
+        Loopino *self = static_cast<Loopino*>(w->parent_struct);
+        self->inShape = true;
+    }
+
+    // the sample bank get the full render, now or when it is done
     static void sharp_released(void *w_, void* xbutton_, void* user_data) {
         Widget_t *w = (Widget_t*)w_;
         Loopino *self = static_cast<Loopino*>(w->parent_struct);
-        self->setOneShootBank();
+        self->inShape = false;
+        if (!self->shaper.busy()) self->setOneShootBank();
         self->setLoopToBank();
 
     }
+
+    static void fade_released(void *w_, void* xbutton_, void* user_data) {
+        Widget_t *w = (Widget_t*)w_;
+        Loopino *self = static_cast<Loopino*>(w->parent_struct);
+        self->inShape = false;
+        if (!self->shaper.busy()) self->setOneShootBank();
+    }
     // sharp control
     static void sharp_callback(void *w_, void* user_data) {
         Widget_t *w = (Widget_t*)w_;
@@ -2956,7 +3339,7 @@ private:
         self->sharp = adj_get_value(w->adj);
         self->markDirty(10);
         self->process_sharp();
-        self->process_sample_sharp();
+        self->shapeSample();
     }
 
     // saw control
@@ -2966,7 +3349,7 @@ private:
         self->saw = adj_get_value(w->adj);
         self->markDirty(11);
         self->process_sharp();
-        self->process_sample_sharp();
+        self->shapeSample();
     }
 
     // fade control
@@ -2975,8 +3358,7 @@ private:
         Loopino *self = static_cast<Loopino*>(w->parent_struct);
         self->fadeout = adj_get_value(w->adj);
         self->markDirty(12);
-        self->process_sample_sharp();
-        self->setOneShootBank();
+        self->shapeSample();
     }
 
 /****************************************************************
@@ -3420,23 +3802,30 @@ private:
         const int margin_right = 2;
         const int top_scale_h  = 14;
         const int draw_width   = width - margin_left - margin_right;
-        const float samples_per_pixel = (float)wave_view->size / (float)draw_width;
-        const float ms_per_sample = 1000.0f / (float)self->jack_sr;
+        // the zoomed part of the buffer
+        const WaveZoom& zoom = zoomOf(w);
+        const size_t view_from = (size_t)(zoom.from * wave_view->size);
+        const size_t view_to = std::max(view_from + 1, (size_t)(zoom.to * wave_view->size));
+        const float samples_per_pixel = (float)(view_to - view_from) / (float)draw_width;
+        const float ms_per_sample = 1000.0f / (float)self->bufferRate();
         const float ms_per_pixel = samples_per_pixel * ms_per_sample;
 
         float major_ms;
         float total_ms = wave_view->size * ms_per_sample;
-        float max_ms = KEYCACHE_MAX_SAMPLES * ms_per_sample;
-
-        if (total_ms < 25)        major_ms = 1;
-        else if (total_ms < 50)   major_ms = 5;
-        else if (total_ms < 100)  major_ms = 10;
-        else if (total_ms < 200)  major_ms = 20;
-        else if (total_ms < 500)  major_ms = 50;
-        else if (total_ms < 1000) major_ms = 100;
-        else if (total_ms < 5000) major_ms = 500;
-        else if (total_ms < 10000)major_ms = 1000;
-        else                      major_ms = 5000;
+        const float from_ms = view_from * ms_per_sample;
+        const float view_ms = (view_to - view_from) * ms_per_sample;
+        const KeyCachePlan& plan = cachePlan;
+        float max_ms = plan.maxSamples * ms_per_sample;
+
+        if (view_ms < 25)        major_ms = 1;
+        else if (view_ms < 50)   major_ms = 5;
+        else if (view_ms < 100)  major_ms = 10;
+        else if (view_ms < 200)  major_ms = 20;
+        else if (view_ms < 500)  major_ms = 50;
+        else if (view_ms < 1000) major_ms = 100;
+        else if (view_ms < 5000) major_ms = 500;
+        else if (view_ms < 10000)major_ms = 1000;
+        else                     major_ms = 5000;
 
         cairo_move_to(cri, 0, 0);
         cairo_set_line_width(cri,2);
@@ -3453,8 +3842,8 @@ private:
         cairo_set_source_rgba(cri, 0.8, 0.8, 0.8, 0.7);
         cairo_set_font_size(cri, (w->app->small_font - 3) / w->scale.ascale);
         // time scale (ms)
-        for (float ms = 0; ms <= total_ms; ms += major_ms) {
-            float x = margin_left + (ms / ms_per_pixel);
+        for (float ms = std::ceil(from_ms / major_ms) * major_ms; ms <= total_ms; ms += major_ms) {
+            float x = margin_left + ((ms - from_ms) / ms_per_pixel);
             if (x > width - margin_right)
                 break;
             cairo_move_to(cri, x, 2);
@@ -3467,9 +3856,10 @@ private:
             cairo_move_to(cri, x - ext.width -2, top_scale_h - 2);
             cairo_show_text(cri, txt);
         }
-        // mark Sample size to big
-        if ((uint32_t)wave_view->size > KEYCACHE_MAX_SAMPLES && genrateKeyCache) {
-            float x_max = margin_left + (KEYCACHE_MAX_SAMPLES / samples_per_pixel);
+        // mark the part of the Sample the Key Cache drops
+        if (plan.truncated && genrateKeyCache) {
+            float x_max = std::max((float)margin_left,
+                    margin_left + (((float)plan.maxSamples - (float)view_from) / samples_per_pixel));
             if (x_max < width - margin_right) {
                 cairo_save(cri);
                 double dashes[] = {4.0, 4.0};
@@ -3499,14 +3889,14 @@ private:
             return;
         }
         
-        int channels = play_loop ? 1 : af.channels;
-        float step = (float)((float)(wave_view->size/(float)draw_width)/(float)channels);
-        float lstep = (float)(half_height_t)/channels;
-        cairo_set_line_width(cri,2);
-        cairo_set_source_rgba(cri, 0.55, 0.65, 0.55, 1);
-        // draw wave form
-        int pos = half_height_t/channels;
-        for (int c = 0; c < (int)channels; c++) {
+        // draw wave form, min/max per column from the peak pyramid,
+        // the rms on top of it. The views hold mono data only.
+        const PeakPyramid& peaks = (w == loopview) ? loopPeaks : wavePeaks;
+        std::vector<PeakPyramid::Peak> cols;
+        if (peaks.size() == (size_t)wave_view->size &&
+                peaks.query(view_from, view_to, draw_width, cols)) {
+            const float lstep = (float)half_height_t;
+            const int pos = half_height_t;
             cairo_pattern_t *pat = cairo_pattern_create_linear (0, pos, 0, height);
             cairo_pattern_add_color_stop_rgba
                 (pat, 0,1.53,0.33,0.33, 1.0);
@@ -3518,25 +3908,36 @@ private:
                 (pat, 0, 0.55, 0.55, 0.55, 1.0);
             cairo_pattern_set_extend(pat, CAIRO_EXTEND_REFLECT);
             cairo_set_source(cri, pat);
+            cairo_set_line_width(cri,1);
             for (int i=0;i<draw_width;i++) {
-                cairo_move_to(cri,i+2,pos);
-                float w = wave_view->wave[int(c+(i*channels)*step)];
-                cairo_line_to(cri, i+2,(float)(pos)+ (-w * lstep));
-                //cairo_line_to(cri, i+2,(float)(pos)+ (w * lstep));
+                cairo_move_to(cri, i+2.5, (float)pos - cols[i].max * lstep);
+                cairo_line_to(cri, i+2.5, (float)pos - cols[i].min * lstep + 1.0f);
             }
-            pos += half_height_t;
+            cairo_stroke(cri);
             cairo_pattern_destroy (pat);
             pat = nullptr;
+            cairo_set_source_rgba(cri, 0.55, 0.65, 0.55, 0.5);
+            for (int i=0;i<draw_width;i++) {
+                const float rms = std::sqrt(cols[i].ms);
+                cairo_move_to(cri, i+2.5, (float)pos - rms * lstep);
+                cairo_line_to(cri, i+2.5, (float)pos + rms * lstep);
+            }
+            cairo_stroke(cri);
         }
-        cairo_stroke(cri);
 
         cairo_text_extents_t extents;
         char s[100];
         // show sample size or warning
         cairo_set_font_size (cri, (w->app->small_font-2)/w->scale.ascale);
         cairo_set_source_rgba(cri, 0.85, 0.85, 0.85, 0.9);
-        if ((uint32_t)wave_view->size < KEYCACHE_MAX_SAMPLES || !genrateKeyCache) {
+        if (!genrateKeyCache || (!plan.truncated && plan.decimate == 1)) {
             snprintf(s, 63, "%.2f ms", total_ms);
+        } else if (plan.fits) {
+            cairo_set_source_rgba(cri, 0.95, 0.55, 0.25, 0.9);
+            if (plan.truncated)
+                snprintf(s, 99, "%.2f ms  Key Cache: 1/%d rate, first %.2f ms", total_ms, plan.decimate, max_ms);
+            else
+                snprintf(s, 99, "%.2f ms  Key Cache: 1/%d rate", total_ms, plan.decimate);
         } else {
             cairo_set_source_rgba(cri, 0.85, 0.25, 0.25, 1.0);
             snprintf(s, 99, "%.2f ms ! Maximum supported length: %.2f ms", total_ms, max_ms);
@@ -3584,29 +3985,33 @@ private:
         cairo_rectangle(w->crb,0, 0, width, height);
         cairo_fill(w->crb);
 
+        // the overlays follow the zoom, positions are fractions of the buffer
+        const WaveZoom& zoom = self->waveZoom;
         if (self->play) {
-            double state = adj_get_state(w->adj);
-            cairo_set_source_rgba(w->crb, 0.55, 0.05, 0.05, 1);
-            cairo_rectangle(w->crb, (width * state) - 1.5,2,3, height-4);
-            cairo_fill(w->crb);
+            double state = zoom.toView(adj_get_state(w->adj));
+            if (state >= 0.0 && state <= 1.0) {
+                cairo_set_source_rgba(w->crb, 0.55, 0.05, 0.05, 1);
+                cairo_rectangle(w->crb, (width * state) - 1.5,2,3, height-4);
+                cairo_fill(w->crb);
+            }
         }
 
         //int halfWidth = width*0.5;
 
-        double state_l = adj_get_state(self->loopMark_L->adj_x);
+        double state_l = self->markView(adj_get_state(self->loopMark_L->adj_x));
         cairo_set_source_rgba(w->crb, 0.25, 0.25, 0.05, 0.666);
         cairo_rectangle(w->crb, 0, 2, (width*state_l), height-4);
         cairo_fill(w->crb);
 
-        double state_r = adj_get_state(self->loopMark_R->adj_x);
+        double state_r = self->markView(adj_get_state(self->loopMark_R->adj_x));
         cairo_set_source_rgba(w->crb, 0.25, 0.25, 0.05, 0.666);
         int point = (width*state_r);
         cairo_rectangle(w->crb, point, 2 , width - point, height-4);
         cairo_fill(w->crb);
 
         if (self->loopPoint_l_auto && self->loopPoint_r_auto) {
-            double lstate = (double)self->loopPoint_l_auto/ (double)self->af.samplesize;
-            double rstate = (double)self->loopPoint_r_auto/ (double)self->af.samplesize;
+            double lstate = std::clamp(zoom.toView((double)self->loopPoint_l_auto/ (double)self->af.samplesize), 0.0, 1.0);
+            double rstate = std::clamp(zoom.toView((double)self->loopPoint_r_auto/ (double)self->af.samplesize), 0.0, 1.0);
             int lpoint = (width*lstate);
             int rpoint = (width*rstate);
             cairo_set_source_rgba(w->crb, 0.25, 0.25, 0.65, 0.444);
@@ -3614,6 +4019,34 @@ private:
             cairo_fill(w->crb);
         }
 
+        if (self->loader.busy()) {
+            // background load, progress bar with the current stage
+            cairo_set_source_rgba(w->crb, 0.0, 0.0, 0.0, 0.444);
+            cairo_rectangle(w->crb, 0, height - 22, width, 22);
+            cairo_fill(w->crb);
+            cairo_set_source_rgba(w->crb, 0.25, 0.45, 0.65, 0.666);
+            cairo_rectangle(w->crb, 2, height - 20, (width - 4) * self->loader.progress(), 18);
+            cairo_fill(w->crb);
+            use_text_color_scheme(w, NORMAL_);
+            cairo_set_font_size (w->crb, w->app->normal_font/w->scale.ascale);
+            cairo_move_to(w->crb, 8, height - 7);
+            cairo_show_text(w->crb, SampleLoader::stageName(self->loader.stage()));
+        }
+        if (self->batch.busy()) {
+            // batch export, progress bar with the note count
+            char s[64];
+            snprintf(s, 63, "export %i / %i", self->batch.getDone(), self->batch.getTotal());
+            cairo_set_source_rgba(w->crb, 0.0, 0.0, 0.0, 0.444);
+            cairo_rectangle(w->crb, 0, 0, width, 22);
+            cairo_fill(w->crb);
+            cairo_set_source_rgba(w->crb, 0.45, 0.35, 0.65, 0.666);
+            cairo_rectangle(w->crb, 2, 2, (width - 4) * self->batch.progress(), 18);
+            cairo_fill(w->crb);
+            use_text_color_scheme(w, NORMAL_);
+            cairo_set_font_size (w->crb, w->app->normal_font/w->scale.ascale);
+            cairo_move_to(w->crb, 8, 15);
+            cairo_show_text(w->crb, s);
+        }
         if (!self->ready) 
             show_spinning_wheel(w, nullptr);
         if (self->record && self->timer > 0)
@@ -3900,6 +4333,36 @@ private:
             cairo_line_to(w->crb, 15 + 55 * keyCacheState, w->height-5);
             cairo_stroke(w->crb);
         }
+        char bs[32];
+        snprintf(bs, 31, "Banks: %.1f MB",
+            (self->sbank.bytes() + self->lbank.bytes()) / (1024.0 * 1024.0));
+        use_fg_color_scheme(w, INSENSITIVE_);
+        cairo_set_font_size (w->crb, (w->app->small_font-2)/w->scale.ascale);
+        cairo_move_to (w->crb, 20, w->height-10);
+        cairo_show_text(w->crb, bs);
+        cairo_new_path (w->crb);
+        if (self->genrateKeyCache) {
+            // show the KeyCache stats
+            KeyCacheStats st = self->synth.rb.getStats();
+            double lastMs = 0.0, stretchMs = 0.0, machineMs = 0.0;
+            for (auto& e : st.entries) {
+                if (e.buildMs > lastMs) {
+                    lastMs = e.buildMs;
+                    stretchMs = e.stretchMs;
+                    machineMs = e.machineMs;
+                }
+            }
+            char s[192];
+            snprintf(s, 191, "KeyCache: %zu keys  %.1f MB  queue %d  hits %.0f%%  near %.0f%%  cancelled %llu  max %.0f ms (rb %.0f / machines %.0f)  rt frees %llu",
+                st.entries.size(), st.totalBytes / (1024.0 * 1024.0), st.queueDepth + st.building,
+                st.hitRate() * 100.0, st.nearRate() * 100.0, (unsigned long long)st.cancelled, lastMs, stretchMs, machineMs,
+                (unsigned long long)Reclaimer::get().droppedCount());
+            use_fg_color_scheme(w, INSENSITIVE_);
+            cairo_set_font_size (w->crb, (w->app->small_font-2)/w->scale.ascale);
+            cairo_move_to (w->crb, 120, w->height-10);
+            cairo_show_text(w->crb, s);
+            cairo_new_path (w->crb);
+        }
         
         #ifndef RUN_AS_PLUGIN
         cairo_text_extents_t extents;
@@ -4141,18 +4604,127 @@ private:
         };
     }
 
+    // render the key range for each velocity layer in the background
+    void showBatchExportWindow() {
+        Widget_t *dia = save_file_dialog(w_top, "", "audio");
+        dia->private_struct = (void*)this;
+        #if defined(__linux__) || defined(__FreeBSD__) || \
+            defined(__NetBSD__) || defined(__OpenBSD__)
+        XSetTransientForHint(w_top->app->dpy, dia->widget, w_top->widget);
+        #endif
+        Widget_t *lowKey = add_combobox(dia, "", 130, 355, 70, 30);
+        lowKey->parent_struct = (void*)this;
+        Widget_t *highKey = add_combobox(dia, "", 205, 355, 70, 30);
+        highKey->parent_struct = (void*)this;
+        for (auto & element : keys) {
+            combobox_add_entry(lowKey, element.c_str());
+            combobox_add_entry(highKey, element.c_str());
+        }
+        combobox_set_menu_size(lowKey, 12);
+        combobox_set_menu_size(highKey, 12);
+        combobox_set_active_entry(lowKey, batchLowKey);
+        combobox_set_active_entry(highKey, batchHighKey);
+        lowKey->func.value_changed_callback = [](void *w_, void* user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            Loopino *self = static_cast<Loopino*>(w->parent_struct);
+            self->batchLowKey = static_cast<uint8_t>(adj_get_value(w->adj));
+        };
+        highKey->func.value_changed_callback = [](void *w_, void* user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            Loopino *self = static_cast<Loopino*>(w->parent_struct);
+            self->batchHighKey = static_cast<uint8_t>(adj_get_value(w->adj));
+        };
+        Widget_t *layers = add_combobox(dia, "", 280, 355, 90, 30);
+        layers->parent_struct = (void*)this;
+        combobox_add_entry(layers, "1 layer");
+        combobox_add_entry(layers, "2 layers");
+        combobox_add_entry(layers, "3 layers");
+        combobox_add_entry(layers, "4 layers");
+        combobox_set_active_entry(layers, batchLayers - 1);
+        layers->func.value_changed_callback = [](void *w_, void* user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            Loopino *self = static_cast<Loopino*>(w->parent_struct);
+            self->batchLayers = static_cast<int>(adj_get_value(w->adj)) + 1;
+        };
+        Widget_t *format = add_combobox(dia, "", 375, 355, 100, 30);
+        format->parent_struct = (void*)this;
+        combobox_add_entry(format, "wav");
+        combobox_add_entry(format, "flac");
+        combobox_add_entry(format, "wav + sfz");
+        combobox_add_entry(format, "flac + sfz");
+        combobox_set_active_entry(format, batchFormat);
+        format->func.value_changed_callback = [](void *w_, void* user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            Loopino *self = static_cast<Loopino*>(w->parent_struct);
+            self->batchFormat = static_cast<int>(adj_get_value(w->adj));
+        };
+        widget_show_all(dia);
+        w_top->func.dialog_callback = [] (void *w_, void* user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            if(user_data !=NULL && strlen(*(const char**)user_data)) {
+                Loopino *self = static_cast<Loopino*>(w->parent_struct);
+                std::string filename = *(const char**)user_data;
+                std::string::size_type idx;
+                idx = filename.rfind('.');
+                if(idx != std::string::npos) {
+                    filename = filename.substr(0, idx);
+                }
+                BatchExport::Job job;
+                job.path = filename;
+                job.lowKey = std::min(self->batchLowKey, self->batchHighKey);
+                job.highKey = std::max(self->batchLowKey, self->batchHighKey);
+                job.velocities.clear();
+                for (int i = 1; i <= self->batchLayers; i++)
+                    job.velocities.push_back((int)std::lrint(127.0 * i / self->batchLayers));
+                job.tail = 8.0f;
+                job.flac = self->batchFormat & 1;
+                job.sfz = self->batchFormat > 1;
+                self->batch.start(self->synth, job);
+            }
+        };
+    }
+
+    void batchDone(std::unique_ptr<BatchExport::Report> r) {
+        if (r->cancelled) return;
+        if (!r->files || r->failed) {
+            Widget_t *dia = open_message_dialog(w, ERROR_BOX, "loopino",
+                !r->files ? _("Batch export: nothing to render") :
+                            _("Batch export: fail to write some files"), NULL);
+            os_set_transient_for_hint(w, dia);
+        }
+    }
+
     std::string getPathFor(const std::string& name) const {
         return presetDir + name + ".presets";
     }
 
+    // the preset names from the index, sorted, the MIDI program
+    // changes step through them in this order
     void createPrestList() {
-        presetFiles.clear();
-        std::filesystem::path p = std::filesystem::path(presetFile).parent_path().u8string();
-        for (auto &f : std::filesystem::directory_iterator(p)) {
-            if (f.path().extension() == ".presets") {
-                presetFiles.push_back(f.path().stem().string());
-            }
+        // keep pointing at the same preset when the order changed
+        std::string current;
+        if (currentPresetNum >= 0 && currentPresetNum < (int)presetFiles.size())
+            current = presetFiles[currentPresetNum];
+        presetFiles = presetIndex.names();
+        if (!current.empty()) currentPresetNum = presetNum(current);
+    }
+
+    int presetNum(const std::string& name) const {
+        auto it = std::find(presetFiles.begin(), presetFiles.end(), name);
+        return it != presetFiles.end() ? (int)(it - presetFiles.begin()) : -1;
+    }
+
+    // menu entry: name, detected root key and length
+    static std::string presetLabel(const PresetIndex::Entry& e) {
+        std::string label = e.name;
+        const std::string key = PresetIndex::keyName(e.rootkey);
+        if (!key.empty()) label += "   " + key;
+        if (e.seconds() > 0.0f) {
+            char s[16];
+            snprintf(s, sizeof(s), "   %.1f s", e.seconds());
+            label += s;
         }
+        return label;
     }
 
     // pop up a text entry to enter a name for a preset to save
@@ -4168,7 +4740,9 @@ private:
             if(user_data !=NULL && strlen(*(const char**)user_data)) {
                 Loopino *self = static_cast<Loopino*>(w->parent_struct);
                 self->presetName = (*(const char**)user_data);
-                self->savePreset(self->getPathFor(self->presetName));
+                std::string path = self->getPathFor(self->presetName);
+                self->savePreset(path);
+                self->presetIndex.update(path);
                 self->createPrestList();
             }
         };
@@ -4176,12 +4750,22 @@ private:
 
     // save menu callback
     void save() {
-        if (presetName.empty()) saveAs();
-        savePreset(getPathFor(presetName));
+        if (presetName.empty()) {
+            saveAs();
+            return;
+        }
+        std::string path = getPathFor(presetName);
+        savePreset(path);
+        presetIndex.update(path);
     }
 
     void showPresetMenu(Widget_t *w) {
-        createPrestList();
+        // the menu show the index as it is, pick up changes for the next time,
+        // a refresh could replace presetFiles while the menu is open
+        auto index = presetIndex.entries();
+        presetIndex.refresh();
+        menuPresetFiles.clear();
+        for (const auto& e : *index) menuPresetFiles.push_back(e.name);
         Widget_t *menu = create_menu(w, 20);
         menu->parent_struct = (void*)this;
         Widget_t *menuSave = menu_add_item(menu, "Save");
@@ -4190,13 +4774,66 @@ private:
         menuSaveAs->parent_struct = (void*)this;
         Widget_t *loadSub = cmenu_add_submenu(menu, "Load");
         loadSub->parent_struct = (void*)this;
-        for (size_t i = 0; i < presetFiles.size(); ++i) {
-            menu_add_entry(loadSub, presetFiles[i].c_str());
+        for (size_t i = 0; i < index->size(); ++i) {
+            menu_add_entry(loadSub, presetLabel((*index)[i]).c_str());
         }
         Widget_t *def = menu_add_item(menu, "Default");
         def->parent_struct = (void*)this;
         Widget_t *expo = menu_add_item(menu, "Export");
         expo->parent_struct = (void*)this;
+        Widget_t *batchExpo = menu_add_item(menu, "Batch Export");
+        batchExpo->parent_struct = (void*)this;
+        Widget_t *storeSub = cmenu_add_submenu(menu, "Sample Storage");
+        storeSub->parent_struct = (void*)this;
+        menu_add_entry(storeSub, sampleStorage == PresetSamples::FLAC16 ? "* int16 flac" : "int16 flac");
+        menu_add_entry(storeSub, sampleStorage == PresetSamples::INT16 ? "* int16" : "int16");
+        menu_add_entry(storeSub, sampleStorage == PresetSamples::FLOAT32 ? "* float32" : "float32");
+        Widget_t *cacheSub = cmenu_add_submenu(menu, "Key Cache");
+        cacheSub->parent_struct = (void*)this;
+        menu_add_entry(cacheSub, keyCacheFastPass ? "* fast first pass" : "fast first pass");
+        static const int memoryMB[] = {0, 256, 512, 1024, 2048, 4096};
+        static const char* memoryNames[] = {"memory auto", "memory 256 MB", "memory 512 MB",
+                                            "memory 1 GB", "memory 2 GB", "memory 4 GB"};
+        for (int i = 0; i < 6; ++i) {
+            std::string e = (keyCacheMemoryMB == memoryMB[i] ? "* " : "") + std::string(memoryNames[i]);
+            menu_add_entry(cacheSub, e.c_str());
+        }
+        static const int seconds[] = {15, 30, 60, 120, 300};
+        for (int i = 0; i < 5; ++i) {
+            std::string e = (keyCacheSeconds == seconds[i] ? "* time " : "time ") +
+                                                std::to_string(seconds[i]) + " s";
+            menu_add_entry(cacheSub, e.c_str());
+        }
+        static const char* formatNames[] = {"float32", "int16", "half"};
+        for (int i = 0; i < 3; ++i) {
+            std::string e = (keyCacheFormat == i ? "* keys " : "keys ") + std::string(formatNames[i]);
+            menu_add_entry(cacheSub, e.c_str());
+        }
+        for (int i = 0; i < 3; ++i) {
+            std::string e = (sourceFormat == i ? "* root " : "root ") + std::string(formatNames[i]);
+            menu_add_entry(cacheSub, e.c_str());
+        }
+        Widget_t *prefetchSub = cmenu_add_submenu(menu, "Prefetch");
+        prefetchSub->parent_struct = (void*)this;
+        static const int ranges[] = {0, 1, 2, 4};
+        static const char* rangeNames[] = {"off", "1 each side", "2 each side", "4 each side"};
+        for (int i = 0; i < 4; ++i) {
+            std::string e = (prefetchRange == ranges[i] ? "* " : "") + std::string(rangeNames[i]);
+            menu_add_entry(prefetchSub, e.c_str());
+        }
+        Widget_t *indexSub = cmenu_add_submenu(menu, "Preset Index");
+        indexSub->parent_struct = (void*)this;
+        menu_add_entry(indexSub, presetKeyDetect ? "* detect root keys" : "detect root keys");
+        Widget_t *zoneSub = cmenu_add_submenu(menu, "Zones");
+        zoneSub->parent_struct = (void*)this;
+        menu_add_entry(zoneSub, "add zone...");
+        menu_add_entry(zoneSub, "clear zones");
+        for (const auto& z : zones) {
+            std::string e = PresetIndex::keyName(z.rootkey) + "   keys " +
+                PresetIndex::keyName(z.range.loKey) + " - " + PresetIndex::keyName(z.range.hiKey) +
+                "   vel " + std::to_string(z.range.loVel) + " - " + std::to_string(z.range.hiVel);
+            menu_add_entry(zoneSub, e.c_str());
+        }
         menuSave->func.button_release_callback = [](void *w_, void*item_, void *user_data) {
             Widget_t *w = (Widget_t*)w_;
             Loopino *self = static_cast<Loopino*>(w->parent_struct);
@@ -4227,17 +4864,80 @@ private:
             Widget_t *w = (Widget_t*)w_;
             Loopino *self = static_cast<Loopino*>(w->parent_struct);
             int id = (int)w->adj->value;
-            if (id >= 0 && id < (int)self->presetFiles.size()) {
-                self->currentPresetNum = id;
-                std::string name = self->presetFiles[id];
+            if (id >= 0 && id < (int)self->menuPresetFiles.size()) {
+                std::string name = self->menuPresetFiles[id];
+                self->currentPresetNum = self->presetNum(name);
                 std::string path = self->getPathFor(name);
-                self->loadPreset(path);
+                self->startPresetLoad(path);
+            }
+        };
+        storeSub->func.enter_callback = loadSub->func.enter_callback;
+        storeSub->func.value_changed_callback = [](void *w_, void *user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            Loopino *self = static_cast<Loopino*>(w->parent_struct);
+            int id = (int)w->adj->value;
+            if (id >= 0 && id <= PresetSamples::FLOAT32) self->sampleStorage = id;
+            self->writeConfig();
+        };
+        cacheSub->func.enter_callback = loadSub->func.enter_callback;
+        cacheSub->func.value_changed_callback = [](void *w_, void *user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            Loopino *self = static_cast<Loopino*>(w->parent_struct);
+            int id = (int)w->adj->value;
+            static const int memoryMB[] = {0, 256, 512, 1024, 2048, 4096};
+            static const int seconds[] = {15, 30, 60, 120, 300};
+            if (id == 0) {
+                self->keyCacheFastPass = !self->keyCacheFastPass;
+                self->synth.fastFirstPass(self->keyCacheFastPass);
+            } else if (id >= 1 && id <= 6) {
+                self->keyCacheMemoryMB = memoryMB[id - 1];
+                self->setKeyCacheBudget();
+            } else if (id >= 7 && id <= 11) {
+                self->keyCacheSeconds = seconds[id - 7];
+                self->setKeyCacheBudget();
+            } else if (id >= 12 && id <= 14) {
+                self->keyCacheFormat = id - 12;
+                self->synth.setCacheFormat(self->keyCacheFormat);
+                self->setKeyCacheBudget();
+            } else if (id >= 15 && id <= 17) {
+                self->sourceFormat = id - 15;
+                self->synth.setSourceFormat(self->sourceFormat);
             }
+            self->writeConfig();
+        };
+        prefetchSub->func.enter_callback = loadSub->func.enter_callback;
+        prefetchSub->func.value_changed_callback = [](void *w_, void *user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            Loopino *self = static_cast<Loopino*>(w->parent_struct);
+            int id = (int)w->adj->value;
+            if (id < 0 || id > 3) return;
+            static const int ranges[] = {0, 1, 2, 4};
+            self->prefetchRange = ranges[id];
+            self->prefetchNeighbours();
+            self->writeConfig();
+        };
+        indexSub->func.enter_callback = loadSub->func.enter_callback;
+        indexSub->func.value_changed_callback = [](void *w_, void *user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            Loopino *self = static_cast<Loopino*>(w->parent_struct);
+            if ((int)w->adj->value != 0) return;
+            self->presetKeyDetect = !self->presetKeyDetect;
+            self->presetIndex.detectKeys(self->presetKeyDetect);
+            self->writeConfig();
+        };
+        zoneSub->func.enter_callback = loadSub->func.enter_callback;
+        zoneSub->func.value_changed_callback = [](void *w_, void *user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            Loopino *self = static_cast<Loopino*>(w->parent_struct);
+            int id = (int)w->adj->value;
+            if (id == 0) self->showZoneDialog();
+            else if (id == 1) self->clearZones();
         };
         def->func.button_release_callback = [](void *w_, void*item_, void *user_data) {
             Widget_t *w = (Widget_t*)w_;
             Loopino *self = static_cast<Loopino*>(w->parent_struct);
             self->generateSine();
+            self->clearZones();
             self->param.resetParams();
             self->setValuesFromHost();
             std::vector<int> d = {8,9,10,11,12,20,21,22,23,24,25};
@@ -4253,6 +4953,11 @@ private:
             Loopino *self = static_cast<Loopino*>(w->parent_struct);
             self->showExportWindow();
         };
+        batchExpo->func.button_release_callback = [](void *w_, void*item_, void *user_data) {
+            Widget_t *w = (Widget_t*)w_;
+            Loopino *self = static_cast<Loopino*>(w->parent_struct);
+            self->showBatchExportWindow();
+        };
         pop_menu_show(w, menu, 24, true);
 
     }
@@ -4289,14 +4994,48 @@ private:
         if (!std::filesystem::exists(p)) {
             std::filesystem::create_directories(p);
         }
+        af.cache.setDir((p / "decoded").u8string());
+        FFTPlanCache::get().setWisdomFile((p / "fftw.wisdom").u8string());
+        presetIndex.open(presetDir, (p / "presets.index").u8string());
+        readConfig();
+    }
+
+    // settings which belong to the installation, not to a preset,
+    // one "key value" pair per line, unknown keys are skipped
+    void readConfig() {
+        std::ifstream in(configFile);
+        std::string key;
+        int value = 0;
+        while (in >> key >> value) {
+            if (key == "keyCacheFastPass") keyCacheFastPass = value != 0;
+            else if (key == "keyCacheMemoryMB") keyCacheMemoryMB = std::max(0, value);
+            else if (key == "keyCacheSeconds") keyCacheSeconds = std::max(1, value);
+            else if (key == "keyCacheFormat") keyCacheFormat = std::clamp(value, 0, 2);
+            else if (key == "sourceFormat") sourceFormat = std::clamp(value, 0, 2);
+            else if (key == "sampleStorage") sampleStorage = std::clamp(value, 0, (int)PresetSamples::FLOAT32);
+            else if (key == "presetKeyDetect") presetKeyDetect = value != 0;
+            else if (key == "prefetchRange") prefetchRange = std::clamp(value, 0, 4);
+        }
+        presetIndex.detectKeys(presetKeyDetect);
+        synth.fastFirstPass(keyCacheFastPass);
+        synth.setCacheFormat(keyCacheFormat);
+        synth.setSourceFormat(sourceFormat);
+        setKeyCacheBudget();
+    }
+
+    void writeConfig() {
+        std::ofstream out(configFile, std::ios::trunc);
+        if (!out) return;
+        out << "keyCacheFastPass " << keyCacheFastPass << "\n";
+        out << "keyCacheMemoryMB " << keyCacheMemoryMB << "\n";
+        out << "keyCacheSeconds " << keyCacheSeconds << "\n";
+        out << "keyCacheFormat " << keyCacheFormat << "\n";
+        out << "sourceFormat " << sourceFormat << "\n";
+        out << "sampleStorage " << sampleStorage << "\n";
+        out << "presetKeyDetect " << presetKeyDetect << "\n";
+        out << "prefetchRange " << prefetchRange << "\n";
     }
 
-    struct PresetHeader {
-        char magic[8];
-        uint32_t version;
-        uint64_t dataSize;
-    };
-
     // Helper functions
     template <typename O, typename T>
     void writeString(O& out, T& v) {
@@ -4326,42 +5065,15 @@ private:
         adj_set_value(w->adj, v);
     }
 
+    // since version 17 the samples are one coded block (see PresetSamples.h)
     template <typename T>
-    bool writeSampleBuffer(T& out, const float* samples, uint32_t numData) {
-        if (!samples || numData == 0) return false;
-
+    bool writeSampleSection(T& out, const float* samples, uint32_t numData) {
         if (!out) return false;
-
-        writeValue(out, numData);
-
-        float maxVal = 0.0f;
-        for (size_t i = 0; i < numData; ++i) {
-            maxVal = max(maxVal, std::fabs(samples[i]));
-        }
-        if (maxVal < 0.9999f) maxVal = 1.0f;
-
-        for (size_t i = 0; i < numData; ++i) {
-            float normalized = samples[i] / maxVal;
-            int16_t encoded = static_cast<int16_t>(std::round(normalized * 32767.0f));
-            writeValue(out,encoded);
-        }
-        return true;
-    }
-
-    template <typename T>
-    bool readSampleBuffer(T& in, float*& samples, uint32_t& numData) {
-        if (!in) return false;
-
-        readValue(in, numData);
-        if (numData == 0) return false;
-
-        samples = new float[numData];
-        
-        for (size_t i = 0; i < numData; ++i) {
-            int16_t encoded;
-            readValue(in,encoded);
-            samples[i] = static_cast<float>(encoded) / 32767.0f;
-        }
+        const std::vector<uint8_t> block = PresetSamples::encode(samples, numData,
+                                static_cast<PresetSamples::Storage>(sampleStorage));
+        const uint64_t size = block.size();
+        writeValue(out, size);
+        out.write(reinterpret_cast<const char*>(block.data()), size);
         return true;
     }
 
@@ -4375,265 +5087,283 @@ private:
         if (!out) return false;
         PresetHeader header;
         std::memcpy(header.magic, "LOOPINO", 8);
-        header.version = 16; // guard for future proof
-        header.dataSize = af.samplesize;
+        header.version = PresetLoader::VERSION; // guard for future proof
+        // a streamed file is only held as overview, store it in full at the file rate
+        std::vector<float> whole;
+        if (streamSource) whole = streamSource->readAll();
+        const float* data = streamSource ? whole.data() : af.samples;
+        const uint32_t size = streamSource ? (uint32_t)whole.size() : af.samplesize;
+        const uint32_t rate = streamSource ? (uint32_t)streamSource->sampleRate : jack_sr;
+        header.dataSize = size;
         writeString(out, header);
 
-        writeValue(out, currentLoop);
-        writeControllerValue(out, Attack);
-        writeControllerValue(out, Decay);
-        writeControllerValue(out, Sustain);
-        writeControllerValue(out, Release);
-        writeControllerValue(out, Frequency);
-        writeControllerValue(out, setLoop);
-        writeControllerValue(out, setLoopSize);
-        // since version 3
-        writeControllerValue(out, Resonance);
-        writeControllerValue(out, CutOff);
-        // since version 4
-        writeControllerValue(out, Sharp);
-        // since version 5
-        writeControllerValue(out, Saw);
-        // since version 6
-        writeControllerValue(out, FadeOut);
-        // since version 7
-        writeControllerValue(out, PmFreq);
-        writeControllerValue(out, PmDepth);
-        writeValue(out, pmmode);
-        // since version 8
-        writeControllerValue(out, VibDepth);
-        writeControllerValue(out, VibRate);
-        writeControllerValue(out, TremDepth);
-        writeControllerValue(out, TremRate);
-        // since version 9
-        writeControllerValue(out, HpResonance);
-        writeControllerValue(out, HpCutOff);
-        // since version 10
-        writeValue(out, lpkeytracking);
-        writeValue(out, hpkeytracking);
-        writeValue(out, velmode);
-        // since version 11
-        writeControllerValue(out, Volume);
-        writeControllerValue(out, ObfMode);
-        writeValue(out, obfkeytracking);
-        writeControllerValue(out, ObfResonance);
-        writeControllerValue(out, ObfCutOff);
-        writeControllerValue(out, ObfOnOff);
-        writeControllerValue(out, LpOnOff);
-        writeControllerValue(out, HpOnOff);
-        writeControllerValue(out, VibOnOff);
-        writeControllerValue(out, TremOnOff);
-
-        writeControllerValue(out, ChorusOnOff);
-        writeControllerValue(out, ChorusLev);
-        writeControllerValue(out, ChorusDelay);
-        writeControllerValue(out, ChorusDepth);
-        writeControllerValue(out, ChorusFreq);
-        writeControllerValue(out, RevOnOff);
-        writeControllerValue(out, RevRoomSize);
-        writeControllerValue(out, RevDamp);
-        writeControllerValue(out, RevMix);
-        // since version 12
-        writeControllerValue(out, WaspOnOff);
-        writeControllerValue(out, WaspMix);
-        writeControllerValue(out, WaspResonance);
-        writeControllerValue(out, WaspCutOff);
-        writeValue(out, waspkeytracking);
-        // since version 14
-        writeControllerValue(out, TBOnOff);
-        writeControllerValue(out, TBVintage);
-        writeControllerValue(out, TBResonance);
-        writeControllerValue(out, TBCutOff);
-        writeControllerValue(out, Tone);
-
-        writeControllerValue(out, LM_MIR8OnOff);
-        writeControllerValue(out, LM_MIR8Drive);
-        writeControllerValue(out, LM_MIR8Amount);
-        writeControllerValue(out, Emu_12OnOff);
-        writeControllerValue(out, Emu_12Drive);
-        writeControllerValue(out, Emu_12Amount);
-        writeControllerValue(out, LM_CMP12OnOff);
-        writeControllerValue(out, LM_CMP12Drive);
-        writeControllerValue(out, LM_CMP12Ratio);
-        writeControllerValue(out, Studio_16OnOff);
-        writeControllerValue(out, Studio_16Drive);
-        writeControllerValue(out, Studio_16Warmth);
-        writeControllerValue(out, Studio_16HfTilt);
-        writeControllerValue(out, EPSOnOff);
-        writeControllerValue(out, EPSDrive);
-        // since version 15
-        writeControllerValue(out, TMOnOff);
-        writeControllerValue(out, TMTime);
-        writeControllerValue(out, Reverse);
-        for(auto x : filterOrder)
-            writeValue(out, x);
-        for(auto x : machineOrder)
-            writeValue(out, x);
-        // since version 16
-        writeControllerValue(out, GenKeyCache);
-
-        writeSampleBuffer(out, af.samples, af.samplesize);
+        // the controller values, in the order of PresetValues.h
+        for (int id = 0; id < PresetValues::COUNT; ++id)
+            writePresetValue(out, id);
+
+        // since version 17 as coded block
+        writeSampleSection(out, data, size);
         // since version 13
-        writeValue(out, jack_sr);
+        writeValue(out, rate);
+        // since version 18, the zones
+        writeValue(out, (uint32_t)zones.size());
+        for (const auto& z : zones) {
+            writeValue(out, z.range.loKey);
+            writeValue(out, z.range.hiKey);
+            writeValue(out, z.range.loVel);
+            writeValue(out, z.range.hiVel);
+            writeValue(out, z.range.loopStart);
+            writeValue(out, z.range.loopEnd);
+            writeValue(out, (float)z.sample->rootFreq);
+            writeValue(out, (uint32_t)z.sample->sourceRate);
+            writeSampleSection(out, z.sample->data.data(), (uint32_t)z.sample->data.size());
+        }
         out.close();
         std::string tittle = "loopino: " + presetName;
         widget_set_title(w_top, tittle.data());
         return true;
     }
 
-    // Preset  Load
+    // the widget holding a controller value of the preset,
+    // nullptr for the values which aren't plain knobs
+    Widget_t* presetWidget(int id) {
+        switch (id) {
+            case PresetValues::ATTACK: return Attack;
+            case PresetValues::DECAY: return Decay;
+            case PresetValues::SUSTAIN: return Sustain;
+            case PresetValues::RELEASE: return Release;
+            case PresetValues::FREQUENCY: return Frequency;
+            case PresetValues::SETLOOP: return setLoop;
+            case PresetValues::LOOPSIZE: return setLoopSize;
+            case PresetValues::RESONANCE: return Resonance;
+            case PresetValues::CUTOFF: return CutOff;
+            case PresetValues::SHARP: return Sharp;
+            case PresetValues::SAW: return Saw;
+            case PresetValues::FADEOUT: return FadeOut;
+            case PresetValues::PMFREQ: return PmFreq;
+            case PresetValues::PMDEPTH: return PmDepth;
+            case PresetValues::VIBDEPTH: return VibDepth;
+            case PresetValues::VIBRATE: return VibRate;
+            case PresetValues::TREMDEPTH: return TremDepth;
+            case PresetValues::TREMRATE: return TremRate;
+            case PresetValues::HPRESONANCE: return HpResonance;
+            case PresetValues::HPCUTOFF: return HpCutOff;
+            case PresetValues::VOLUME: return Volume;
+            case PresetValues::OBFMODE: return ObfMode;
+            case PresetValues::OBFRESONANCE: return ObfResonance;
+            case PresetValues::OBFCUTOFF: return ObfCutOff;
+            case PresetValues::OBFONOFF: return ObfOnOff;
+            case PresetValues::LPONOFF: return LpOnOff;
+            case PresetValues::HPONOFF: return HpOnOff;
+            case PresetValues::VIBONOFF: return VibOnOff;
+            case PresetValues::TREMONOFF: return TremOnOff;
+            case PresetValues::CHORUSONOFF: return ChorusOnOff;
+            case PresetValues::CHORUSLEV: return ChorusLev;
+            case PresetValues::CHORUSDELAY: return ChorusDelay;
+            case PresetValues::CHORUSDEPTH: return ChorusDepth;
+            case PresetValues::CHORUSFREQ: return ChorusFreq;
+            case PresetValues::REVONOFF: return RevOnOff;
+            case PresetValues::REVROOMSIZE: return RevRoomSize;
+            case PresetValues::REVDAMP: return RevDamp;
+            case PresetValues::REVMIX: return RevMix;
+            case PresetValues::WASPONOFF: return WaspOnOff;
+            case PresetValues::WASPMIX: return WaspMix;
+            case PresetValues::WASPRESONANCE: return WaspResonance;
+            case PresetValues::WASPCUTOFF: return WaspCutOff;
+            case PresetValues::TBONOFF: return TBOnOff;
+            case PresetValues::TBVINTAGE: return TBVintage;
+            case PresetValues::TBRESONANCE: return TBResonance;
+            case PresetValues::TBCUTOFF: return TBCutOff;
+            case PresetValues::TONE: return Tone;
+            case PresetValues::LM_MIR8ONOFF: return LM_MIR8OnOff;
+            case PresetValues::LM_MIR8DRIVE: return LM_MIR8Drive;
+            case PresetValues::LM_MIR8AMOUNT: return LM_MIR8Amount;
+            case PresetValues::EMU_12ONOFF: return Emu_12OnOff;
+            case PresetValues::EMU_12DRIVE: return Emu_12Drive;
+            case PresetValues::EMU_12AMOUNT: return Emu_12Amount;
+            case PresetValues::LM_CMP12ONOFF: return LM_CMP12OnOff;
+            case PresetValues::LM_CMP12DRIVE: return LM_CMP12Drive;
+            case PresetValues::LM_CMP12RATIO: return LM_CMP12Ratio;
+            case PresetValues::STUDIO_16ONOFF: return Studio_16OnOff;
+            case PresetValues::STUDIO_16DRIVE: return Studio_16Drive;
+            case PresetValues::STUDIO_16WARMTH: return Studio_16Warmth;
+            case PresetValues::STUDIO_16HFTILT: return Studio_16HfTilt;
+            case PresetValues::EPSONOFF: return EPSOnOff;
+            case PresetValues::EPSDRIVE: return EPSDrive;
+            case PresetValues::TMONOFF: return TMOnOff;
+            case PresetValues::TMTIME: return TMTime;
+            case PresetValues::REVERSE: return Reverse;
+            case PresetValues::GENKEYCACHE: return GenKeyCache;
+            default: return nullptr;
+        }
+    }
+
+    template <typename T>
+    void writePresetValue(T& out, int id) {
+        switch (id) {
+            case PresetValues::LOOP: writeValue(out, currentLoop); break;
+            case PresetValues::PMMODE: writeValue(out, pmmode); break;
+            case PresetValues::LPKEYTRACKING: writeValue(out, lpkeytracking); break;
+            case PresetValues::HPKEYTRACKING: writeValue(out, hpkeytracking); break;
+            case PresetValues::VELMODE: writeValue(out, velmode); break;
+            case PresetValues::OBFKEYTRACKING: writeValue(out, obfkeytracking); break;
+            case PresetValues::WASPKEYTRACKING: writeValue(out, waspkeytracking); break;
+            case PresetValues::FILTERORDER: writeRackOrder(out, filterOrder, id); break;
+            case PresetValues::MACHINEORDER: writeRackOrder(out, machineOrder, id); break;
+            default: writeControllerValue(out, presetWidget(id)); break;
+        }
+    }
+
+    // exactly as many entries as the layout hold
+    template <typename T>
+    void writeRackOrder(T& out, const std::vector<int>& order, int id) {
+        const size_t n = PresetValues::fields[id].bytes / sizeof(int32_t);
+        for (size_t i = 0; i < n; ++i)
+            writeValue(out, (int32_t)(i < order.size() ? order[i] : -1));
+    }
+
+    template <typename T>
+    void readPresetValue(T& in, int id) {
+        switch (id) {
+            case PresetValues::LOOP:
+                readValue(in, currentLoop);
+                break;
+            case PresetValues::PMMODE:
+                readValue(in, pmmode);
+                radio_box_set_active(PmMode[pmmode]);
+                break;
+            case PresetValues::LPKEYTRACKING:
+                readValue(in, lpkeytracking);
+                wheel_set_value(LpKeyTracking, (lpkeytracking * 2.0f) - 1.0f);
+                synth.setLpKeyTracking(lpkeytracking);
+                expose_widget(LpKeyTracking);
+                break;
+            case PresetValues::HPKEYTRACKING:
+                readValue(in, hpkeytracking);
+                wheel_set_value(HpKeyTracking, (hpkeytracking * 2.0f) - 1.0f);
+                synth.setHpKeyTracking(hpkeytracking);
+                expose_widget(HpKeyTracking);
+                break;
+            case PresetValues::VELMODE:
+                readValue(in, velmode);
+                velocity_box_set_active(VelMode[velmode]);
+                break;
+            case PresetValues::OBFKEYTRACKING:
+                readValue(in, obfkeytracking);
+                wheel_set_value(ObfKeyTracking, (obfkeytracking -0.3) / 0.3);
+                expose_widget(ObfKeyTracking);
+                break;
+            case PresetValues::WASPKEYTRACKING:
+                readValue(in, waspkeytracking);
+                wheel_set_value(WaspKeyTracking, (waspkeytracking * 2.0f) - 1.0f);
+                expose_widget(WaspKeyTracking);
+                break;
+            case PresetValues::FILTERORDER:
+                readRackOrder(in, filterOrder, id);
+                break;
+            case PresetValues::MACHINEORDER:
+                readRackOrder(in, machineOrder, id);
+                break;
+            default:
+                readControllerValue(in, presetWidget(id));
+                break;
+        }
+    }
+
+    template <typename T>
+    void readRackOrder(T& in, std::vector<int>& order, int id) {
+        order.resize(PresetValues::fields[id].bytes / sizeof(int32_t));
+        for (auto& x : order) {
+            int32_t v = -1;
+            readValue(in, v);
+            x = v;
+        }
+    }
+
+    // the controller values behind the header, in the order of
+    // PresetValues.h, the ones a older version doesn't hold are skipped
+    template <typename T>
+    void readPresetValues(T& in, uint32_t version) {
+        for (int id = 0; id < PresetValues::COUNT; ++id)
+            if (PresetValues::has(id, version)) readPresetValue(in, id);
+    }
+
+    // Preset  Load, in the calling thread
     bool loadPreset(const std::string& filename) {
-        std::ifstream in(filename, std::ios::binary);
-        if (!in) return false;
-        PresetHeader header{};
-        readValue(in, header);
-        if (std::strncmp(header.magic, "LOOPINO", 7) != 0) {
-            std::cerr << "Invalid preset file\n";
-            return false;
-        }
-
-        // we need to update the header version when change the preset format
-        // then we could protect new values with a guard by check the header version
-        if (header.version > 16) {
-            std::cerr << "Warning: newer preset version (" << header.version << ")\n";
-            return false;
-        }
-
-        readValue(in, currentLoop);
-        readControllerValue(in, Attack);
-        readControllerValue(in, Decay);
-        readControllerValue(in, Sustain);
-        readControllerValue(in, Release);
-        readControllerValue(in, Frequency);
-        readControllerValue(in, setLoop);
-        readControllerValue(in, setLoopSize);
-        if (header.version > 2) {
-            readControllerValue(in, Resonance);
-            readControllerValue(in, CutOff);
-        }
-        if (header.version > 3) {
-            readControllerValue(in, Sharp);
-        }
-        if (header.version > 4) {
-            readControllerValue(in, Saw);
-        }
-        if (header.version > 5) {
-            readControllerValue(in, FadeOut);
-        }
-        if (header.version > 6) {
-            readControllerValue(in, PmFreq);
-            readControllerValue(in, PmDepth);
-            readValue(in, pmmode);
-            radio_box_set_active(PmMode[pmmode]);
-        }
-        if (header.version > 7) {
-            readControllerValue(in, VibDepth);
-            readControllerValue(in, VibRate);
-            readControllerValue(in, TremDepth);
-            readControllerValue(in, TremRate);
-        }
-        if (header.version > 8) {
-            readControllerValue(in, HpResonance);
-            readControllerValue(in, HpCutOff);
-        }
-        if (header.version > 9) {
-            readValue(in, lpkeytracking);
-            wheel_set_value(LpKeyTracking, (lpkeytracking * 2.0f) - 1.0f);
-            synth.setLpKeyTracking(lpkeytracking);
-            readValue(in, hpkeytracking);
-            wheel_set_value(HpKeyTracking, (hpkeytracking * 2.0f) - 1.0f);
-            synth.setHpKeyTracking(hpkeytracking);
-            readValue(in, velmode);
-            velocity_box_set_active(VelMode[velmode]);
-            expose_widget(LpKeyTracking);
-            expose_widget(HpKeyTracking);
-        }
-        if (header.version > 10) {
-            readControllerValue(in, Volume);
-            readControllerValue(in, ObfMode);
-            readValue(in, obfkeytracking);
-            wheel_set_value(ObfKeyTracking, (obfkeytracking -0.3) / 0.3);
-            readControllerValue(in, ObfResonance);
-            readControllerValue(in, ObfCutOff);
-            readControllerValue(in, ObfOnOff);
-            readControllerValue(in, LpOnOff);
-            readControllerValue(in, HpOnOff);
-            readControllerValue(in, VibOnOff);
-            readControllerValue(in, TremOnOff);
-
-            readControllerValue(in, ChorusOnOff);
-            readControllerValue(in, ChorusLev);
-            readControllerValue(in, ChorusDelay);
-            readControllerValue(in, ChorusDepth);
-            readControllerValue(in, ChorusFreq);
-            readControllerValue(in, RevOnOff);
-            readControllerValue(in, RevRoomSize);
-            readControllerValue(in, RevDamp);
-            readControllerValue(in, RevMix);
-
-            expose_widget(ObfKeyTracking);
-        }
-        if (header.version > 11) {
-            readControllerValue(in, WaspOnOff);
-            readControllerValue(in, WaspMix);
-            readControllerValue(in, WaspResonance);
-            readControllerValue(in, WaspCutOff);
-            readValue(in, waspkeytracking);
-            wheel_set_value(WaspKeyTracking, (waspkeytracking * 2.0f) - 1.0f);
-            expose_widget(WaspKeyTracking);
-        }
-        if (header.version > 13) {
-            readControllerValue(in, TBOnOff);
-            readControllerValue(in, TBVintage);
-            readControllerValue(in, TBResonance);
-            readControllerValue(in, TBCutOff);
-            readControllerValue(in, Tone);
-
-            readControllerValue(in, LM_MIR8OnOff);
-            readControllerValue(in, LM_MIR8Drive);
-            readControllerValue(in, LM_MIR8Amount);
-            readControllerValue(in, Emu_12OnOff);
-            readControllerValue(in, Emu_12Drive);
-            readControllerValue(in, Emu_12Amount);
-            readControllerValue(in, LM_CMP12OnOff);
-            readControllerValue(in, LM_CMP12Drive);
-            readControllerValue(in, LM_CMP12Ratio);
-            readControllerValue(in, Studio_16OnOff);
-            readControllerValue(in, Studio_16Drive);
-            readControllerValue(in, Studio_16Warmth);
-            readControllerValue(in, Studio_16HfTilt);
-            readControllerValue(in, EPSOnOff);
-            readControllerValue(in, EPSDrive);
-        }
-        if (header.version > 14) {
-            readControllerValue(in, TMOnOff);
-            readControllerValue(in, TMTime);
-            readControllerValue(in, Reverse);
-            for(auto& x : filterOrder)
-                readValue(in, x);
-            for(auto& x : machineOrder)
-                readValue(in, x);
-        }
-        if (header.version > 15) {
-            readControllerValue(in, GenKeyCache);
-        }
-
-        readSampleBuffer(in, af.samples, af.samplesize);
-        if (header.version > 12) {
-            uint32_t sampleRate = jack_sr;
-            readValue(in, sampleRate);
-            if (sampleRate != jack_sr) {
-                af.checkSampleRate(&af.samplesize, 1, af.samples, sampleRate, jack_sr);
+        PresetLoader::Request req;
+        req.file = filename;
+        req.rate = jack_sr;
+        return applyPreset(PresetLoader::load(req));
+    }
+
+    // load a preset in background, it get swapped in by updateUI()
+    void startPresetLoad(const std::string& filename) {
+        if (!guiIsCreated || !jack_sr) {
+            loadPreset(filename);
+            return;
+        }
+        PresetLoader::Request req;
+        req.file = filename;
+        req.rate = jack_sr;
+        presetLoader.start(req);
+    }
+
+    // keep the presets next to the current one decoded, so stepping
+    // through them by program change swap in at once
+    void prefetchNeighbours() {
+        std::vector<std::string> files;
+        const int n = (int)presetFiles.size();
+        if (currentPresetNum >= 0 && currentPresetNum < n) {
+            for (int d = 1; d <= std::min(prefetchRange, n / 2); ++d) {
+                files.push_back(getPathFor(presetFiles[(currentPresetNum + d) % n]));
+                files.push_back(getPathFor(presetFiles[((currentPresetNum - d) % n + n) % n]));
             }
         }
-        in.close();
+        presetLoader.prefetch(files, jack_sr);
+    }
+
+    // set a loaded preset in, the samples are already at jack_sr
+    // unless the audio back-end isn't running yet
+    bool applyPreset(std::unique_ptr<PresetLoader::Result> r) {
+        if (!r || !r->ok) return false;
+        std::istringstream in(r->values);
+        readPresetValues(in, r->header.version);
+
+        SampleLoader::Result& s = r->sample;
+        if (s.samples) {
+            delete[] af.samples;
+            af.samples = s.samples;
+            s.samples = nullptr;
+            af.samplesize = s.frames;
+            if (!jack_sr) samplesRate = r->storedRate;
+        }
         adj_set_max_value(wview->adj, (float)af.samplesize);
         adj_set_state(loopMark_L->adj_x, 0.0);
         adj_set_state(loopMark_R->adj_x,1.0);
         loadLoopNew = true;
         //loadNew = true;
        // update_waveview(wview, af.samples, af.samplesize);
-        loadPresetToSynth();
+        loadPresetToSynth(r->analysed ? &s : nullptr);
+
+        zones.clear();
+        for (auto& pz : r->zones) {
+            auto info = std::make_shared<SampleInfo>();
+            info->data = std::move(pz.samples);
+            info->sourceRate = (double)pz.rate;
+            info->rootFreq = (double)pz.rootFreq;
+            ZoneSample z;
+            z.range.loKey = pz.loKey;
+            z.range.hiKey = pz.hiKey;
+            z.range.loVel = pz.loVel;
+            z.range.hiVel = pz.hiVel;
+            z.range.loopStart = pz.loopStart;
+            z.range.loopEnd = pz.loopEnd;
+            z.rootkey = pz.rootFreq > 0.0f ? (uint8_t)std::clamp((int)std::lrint(
+                            69.0f + 12.0f * std::log2(pz.rootFreq / 440.0f)), 0, 127) : 0;
+            z.sample = info;
+            zones.push_back(z);
+        }
+        publishZones();
 
         std::vector<int> rackOrder;
         rackOrder.reserve(filterOrder.size() + machineOrder.size());
@@ -4644,7 +5374,7 @@ private:
         synth.rebuildMachineChain(machineOrder);
         synth.rebuildFilterChain(filterOrder);
 
-        std::filesystem::path p = filename;
+        std::filesystem::path p = r->file;
         presetName = p.stem().string();
         std::string tittle = "loopino: " + presetName;
         widget_set_title(w_top, tittle.data());
@@ -0,0 +1,200 @@
+
+/*
+ * PeakPyramid.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+      PeakPyramid.h - multi resolution min/max/rms summary of
+                      a wave buffer for the wave views.
+                      Built once per buffer in a background
+                      thread, level k hold one peak per
+                      BLOCK << k samples. A redraw read the
+                      level matching the pixels per column,
+                      any zoom range only touch the levels.
+                      A decimated preview can stand in for a
+                      longer buffer, positions are then given
+                      in samples of the long one (span).
+****************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+class PeakPyramid {
+public:
+    static constexpr size_t BLOCK = 16;     // samples per peak on level 0
+
+    struct Peak {
+        float min;
+        float max;
+        float ms;                           // mean square
+    };
+
+    ~PeakPyramid() {
+        generation.fetch_add(1, std::memory_order_relaxed);
+        if (worker.joinable()) worker.join();
+    }
+
+    // GUI thread, copy the buffer and summarise it in the background
+    void build(const float* data, size_t size, size_t span = 0) {
+        const uint32_t gen = generation.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (worker.joinable()) worker.join();
+        {
+            std::lock_guard<std::mutex> g(m);
+            current.reset();
+        }
+        if (!data || !size) return;
+        auto src = std::make_shared<std::vector<float>>(data, data + size);
+        worker = std::thread(&PeakPyramid::run, this, gen, std::move(src), span ? span : size);
+    }
+
+    // true once after a new summary is in place
+    bool takeFresh() {
+        return fresh.exchange(false, std::memory_order_acq_rel);
+    }
+
+    bool ready() const {
+        std::lock_guard<std::mutex> g(m);
+        return current != nullptr;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> g(m);
+        return current ? current->span : 0;
+    }
+
+    // one peak per column for samples from .. to, false when
+    // there is no summary (yet)
+    bool query(size_t from, size_t to, int columns, std::vector<Peak>& out) const {
+        std::shared_ptr<const Levels> l;
+        {
+            std::lock_guard<std::mutex> g(m);
+            l = current;
+        }
+        if (!l || columns <= 0) return false;
+        const size_t n = l->data.size();
+        if (l->span != n) {
+            from = (size_t)((double)from * n / l->span);
+            to = (size_t)std::ceil((double)to * n / l->span);
+        }
+        to = std::min(to, n);
+        if (from >= to) return false;
+        out.assign(columns, Peak{0.0f, 0.0f, 0.0f});
+        const double spc = double(to - from) / double(columns);
+
+        // the coarsest level which still resolve a column
+        int level = -1;
+        size_t block = 1;
+        while (level + 1 < (int)l->levels.size() && double(BLOCK << (level + 1)) <= spc) {
+            ++level;
+            block = BLOCK << level;
+        }
+
+        for (int c = 0; c < columns; ++c) {
+            size_t a = from + (size_t)(c * spc);
+            size_t b = std::max(a + 1, std::min(to, from + (size_t)((c + 1) * spc)));
+            Peak p{ 1.0f, -1.0f, 0.0f };
+            double ms = 0.0;
+            size_t count = 0;
+            if (level < 0) {
+                for (size_t i = a; i < b && i < n; ++i) {
+                    const float v = l->data[i];
+                    p.min = std::min(p.min, v);
+                    p.max = std::max(p.max, v);
+                    ms += (double)v * v;
+                    ++count;
+                }
+            } else {
+                const auto& lv = l->levels[level];
+                const size_t ka = a / block;
+                const size_t kb = std::min(lv.size(), (b + block - 1) / block);
+                for (size_t k = ka; k < kb; ++k) {
+                    p.min = std::min(p.min, lv[k].min);
+                    p.max = std::max(p.max, lv[k].max);
+                    ms += lv[k].ms;
+                    ++count;
+                }
+            }
+            if (!count) continue;
+            p.ms = (float)(ms / count);
+            out[c] = p;
+        }
+        return true;
+    }
+
+private:
+    struct Levels {
+        size_t span = 0;
+        std::vector<float> data;
+        std::vector<std::vector<Peak>> levels;
+    };
+
+    mutable std::mutex m;
+    std::shared_ptr<const Levels> current;
+    std::atomic<uint32_t> generation { 0 };
+    std::atomic<bool> fresh { false };
+    std::thread worker;
+
+    bool stale(uint32_t gen) const {
+        return generation.load(std::memory_order_relaxed) != gen;
+    }
+
+    void run(uint32_t gen, std::shared_ptr<std::vector<float>> src, size_t span) {
+        auto l = std::make_shared<Levels>();
+        l->span = span;
+        l->data = std::move(*src);
+        const size_t n = l->data.size();
+        const float* d = l->data.data();
+
+        std::vector<Peak> base((n + BLOCK - 1) / BLOCK);
+        for (size_t k = 0; k < base.size(); ++k) {
+            if ((k & 4095) == 0 && stale(gen)) return;
+            const size_t a = k * BLOCK;
+            const size_t b = std::min(n, a + BLOCK);
+            Peak p{ d[a], d[a], 0.0f };
+            double ms = 0.0;
+            for (size_t i = a; i < b; ++i) {
+                p.min = std::min(p.min, d[i]);
+                p.max = std::max(p.max, d[i]);
+                ms += (double)d[i] * d[i];
+            }
+            p.ms = (float)(ms / double(b - a));
+            base[k] = p;
+        }
+        l->levels.push_back(std::move(base));
+
+        // every level merge two peaks of the one below
+        while (l->levels.back().size() > 1) {
+            if (stale(gen)) return;
+            const auto& lo = l->levels.back();
+            std::vector<Peak> up((lo.size() + 1) / 2);
+            for (size_t k = 0; k < up.size(); ++k) {
+                const Peak& p0 = lo[2 * k];
+                if (2 * k + 1 < lo.size()) {
+                    const Peak& p1 = lo[2 * k + 1];
+                    up[k] = { std::min(p0.min, p1.min), std::max(p0.max, p1.max),
+                              0.5f * (p0.ms + p1.ms) };
+                } else {
+                    up[k] = p0;
+                }
+            }
+            l->levels.push_back(std::move(up));
+        }
+
+        std::lock_guard<std::mutex> g(m);
+        if (stale(gen)) return;
+        current = std::move(l);
+        fresh.store(true, std::memory_order_release);
+    }
+};
@@ -12,6 +12,8 @@
 
   Find a pair of zero crossing points to match a given frequency
   and get a click-free sample buffer for looping
+  Candidates get ranked by normalised cross correlation of the
+  waveform around start and end, computed with FFTW
 ****************************************************************/
 
 #pragma once
@@ -20,6 +22,9 @@
 #include <cmath>
 #include <limits>
 #include <algorithm>
+#include <thread>
+
+#include "FFTPlanCache.h"
 
 #ifndef LOOPGENERATOR_H
 #define LOOPGENERATOR_H
@@ -40,7 +45,17 @@ public:
         float score;
     };
 
+    enum class Scoring {
+        ZeroCross,      // length error and crossing amplitude only
+        Correlation     // waveform match around start and end
+    };
+
+    // best loop candidates, worst first, the best one last
+    static constexpr size_t MAX_MATCHES = 64;
+    // starts handed over to the correlation stage
+    static constexpr size_t CANDIDATES = 256;
     std::vector<Match> matches;
+    Scoring scoring = Scoring::Correlation;
 
 /****************************************************************
      Generate a clean loop based on zero-crossing matching
@@ -62,9 +77,16 @@ public:
         if (zeros.empty()) return false;
 
         // Find best start/end pair
-        auto best = findBestLoopPair(zeros, targetLength, 0.1f, matches);
+        auto best = findBestLoopPair(zeros, targetLength, 0.1f, matches,
+                        scoring == Scoring::Correlation ? CANDIDATES : MAX_MATCHES);
         if (best.score == std::numeric_limits<float>::max())
             return false;
+        if (scoring == Scoring::Correlation &&
+            rankByCorrelation(inputBuffer, numFrames, numChannels, zeros,
+                                        periodLength, targetLength, matches))
+            best = matches.back();
+        else if (matches.size() > MAX_MATCHES)
+            matches.erase(matches.begin(), matches.end() - MAX_MATCHES);
 
         if (best.start >= best.end || best.end > numFrames)
             return false;
@@ -88,6 +110,7 @@ public:
     bool getNextMatch(const float* inputBuffer, size_t numFrames, uint32_t numChannels, 
             float fundamental, std::vector<float>& outputBuffer, LoopInfo& info, size_t num) {
 
+        if (num >= matches.size()) return false;
         auto best = matches[num];
         if (best.score == std::numeric_limits<float>::max())
             return false;
@@ -146,37 +169,246 @@ private:
 
 /****************************************************************
      Find best zero-crossing pair that matches target loop length
+     zeros are sorted by index, so for each start only the ends
+     around start + targetLength get checked. The best MAX_MATCHES
+     pairs are kept in a bounded heap, matches end up sorted
+     from worst to best, the best pair is the last one.
 ****************************************************************/
 
-    static Match findBestLoopPair(const std::vector<ZeroCross>& zeros, float targetLength, float alpha, std::vector<Match>& matches ) {
+    static Match findBestLoopPair(const std::vector<ZeroCross>& zeros, float targetLength, float alpha,
+                                std::vector<Match>& matches, size_t keep = MAX_MATCHES) {
 
         Match best{0, 0, std::numeric_limits<float>::max()};
         matches.clear();
+        if (zeros.size() < 2) return best;
+
+        // the amplitude term can't move a score by more than this
+        float maxAmp = 0.0f;
+        for (const auto& z : zeros) maxAmp = std::max(maxAmp, std::fabs(z.amplitude));
+        const float slack = alpha * 2.0f * maxAmp;
+
+        // max heap on score, the worst kept pair is on top
+        auto worse = [](const Match& a, const Match& b) { return a.score < b.score; };
+        matches.reserve(keep + 1);
+
+        auto offer = [&](const ZeroCross& s, const ZeroCross& e, float lengthError) {
+            float ampError = std::fabs(s.amplitude) + std::fabs(e.amplitude);
+            float score = lengthError + alpha * ampError;
+            if (matches.size() >= keep && score >= matches.front().score) return;
+            matches.push_back({s.index, e.index, score});
+            std::push_heap(matches.begin(), matches.end(), worse);
+            if (matches.size() > keep) {
+                std::pop_heap(matches.begin(), matches.end(), worse);
+                matches.pop_back();
+            }
+        };
 
-        for (size_t i = 0; i < zeros.size(); ++i) {
+        for (size_t i = 0; i + 1 < zeros.size(); ++i) {
             const auto& s = zeros[i];
 
             // Ideal end location for this start
             float idealEnd = static_cast<float>(s.index) + targetLength;
+            size_t mid = std::lower_bound(zeros.begin() + i + 1, zeros.end(), idealEnd,
+                [](const ZeroCross& z, float v) { return static_cast<float>(z.index) < v; })
+                - zeros.begin();
+
+            // nearest end with the same direction on each side
+            float nearest = std::numeric_limits<float>::max();
+            for (size_t j = mid; j < zeros.size(); ++j) {
+                if (zeros[j].direction != s.direction) continue;
+                nearest = std::fabs(static_cast<float>(zeros[j].index) - idealEnd);
+                break;
+            }
+            for (size_t j = mid; j-- > i + 1;) {
+                if (zeros[j].direction != s.direction) continue;
+                nearest = std::min(nearest, std::fabs(static_cast<float>(zeros[j].index) - idealEnd));
+                break;
+            }
+            if (nearest == std::numeric_limits<float>::max()) continue;
 
-            for (size_t j = i + 1; j < zeros.size(); ++j) {
-                const auto& e = zeros[j];
-                if (e.direction != s.direction) continue;
-
-                float lengthError = std::fabs(static_cast<float>(e.index) - idealEnd);
-                float ampError = std::fabs(s.amplitude) + std::fabs(e.amplitude);
-                float score = lengthError + alpha * ampError;
+            // everything further away than this can't win
+            float limit = nearest + slack;
+            if (matches.size() >= keep) limit = std::min(limit, matches.front().score);
 
-                if (score < best.score) {
-                    best.start = s.index;
-                    best.end = e.index;
-                    best.score = score;
-                    matches.push_back(best);
-                }
+            for (size_t j = mid; j < zeros.size(); ++j) {
+                float lengthError = static_cast<float>(zeros[j].index) - idealEnd;
+                if (lengthError > limit) break;
+                if (zeros[j].direction == s.direction) offer(s, zeros[j], lengthError);
+            }
+            for (size_t j = mid; j-- > i + 1;) {
+                float lengthError = idealEnd - static_cast<float>(zeros[j].index);
+                if (lengthError > limit) break;
+                if (zeros[j].direction == s.direction) offer(s, zeros[j], lengthError);
             }
         }
+
+        // worst first, best last
+        std::sort_heap(matches.begin(), matches.end(), worse);
+        std::reverse(matches.begin(), matches.end());
+        if (!matches.empty()) best = matches.back();
         return best;
     }
+
+/****************************************************************
+     Rank candidates by normalised cross correlation
+     for every distinct start the window around it get correlated
+     with the region around the ideal end in one FFT, every
+     zero crossing in that region is scored by
+     (1 - ncc) + a small length error term.
+     Starts are split over a few threads, the cached FFTW plans
+     run with the new-array execute.
+****************************************************************/
+
+    static bool rankByCorrelation(const float* buffer, size_t numFrames, uint32_t numChannels,
+                                const std::vector<ZeroCross>& zeros, float periodLength,
+                                float targetLength, std::vector<Match>& matches) {
+
+        std::vector<size_t> starts;
+        starts.reserve(matches.size());
+        for (const auto& m : matches) starts.push_back(m.start);
+        std::sort(starts.begin(), starts.end());
+        starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+        if (starts.empty()) return false;
+
+        Corr c;
+        c.W = std::clamp((int)(periodLength * 2.0f), 64, 2048);
+        c.R = std::clamp((int)(periodLength * 0.5f), 8, 1024);
+        const int span = c.W + 2 * c.R;
+        c.N = 1;
+        while (c.N < span + c.W) c.N <<= 1;
+
+        c.fwd = FFTPlanCache::get().plan(FFTPlanCache::R2C, c.N);
+        c.inv = FFTPlanCache::get().plan(FFTPlanCache::C2R, c.N);
+        if (!c.fwd || !c.inv) return false;
+
+        const size_t threads = std::min<size_t>((starts.size() + 15) / 16,
+                        std::max(1u, std::min(8u, std::thread::hardware_concurrency())));
+        std::vector<std::vector<Match>> found(std::max<size_t>(1, threads));
+        auto job = [&](size_t t) {
+            CorrBuffers b(c.N);
+            for (size_t k = t; k < starts.size(); k += found.size())
+                scoreStart(buffer, numFrames, numChannels, zeros, starts[k],
+                            periodLength, targetLength, c, b, found[t]);
+        };
+        if (threads <= 1) {
+            job(0);
+        } else {
+            std::vector<std::thread> pool;
+            for (size_t t = 0; t < threads; ++t) pool.emplace_back(job, t);
+            for (auto& th : pool) th.join();
+        }
+
+        std::vector<Match> ranked;
+        for (auto& f : found) ranked.insert(ranked.end(), f.begin(), f.end());
+        if (ranked.empty()) return false;
+        const size_t keep = std::min(MAX_MATCHES, ranked.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + keep, ranked.end(),
+            [](const Match& a, const Match& b) { return a.score < b.score; });
+        ranked.resize(keep);
+        // worst first, best last
+        std::reverse(ranked.begin(), ranked.end());
+        matches.swap(ranked);
+        return true;
+    }
+
+    struct Corr {
+        int W = 0;          // window around start and end
+        int R = 0;          // search radius around the ideal end
+        int N = 0;          // FFT size
+        fftwf_plan fwd = nullptr;
+        fftwf_plan inv = nullptr;
+    };
+
+    struct CorrBuffers {
+        float* a;
+        float* b;
+        fftwf_complex* A;
+        fftwf_complex* B;
+        std::vector<double> energy;
+        explicit CorrBuffers(int n) {
+            a = (float*)fftwf_malloc(sizeof(float) * n);
+            b = (float*)fftwf_malloc(sizeof(float) * n);
+            A = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * (n / 2 + 1));
+            B = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * (n / 2 + 1));
+        }
+        ~CorrBuffers() {
+            fftwf_free(a);
+            fftwf_free(b);
+            fftwf_free(A);
+            fftwf_free(B);
+        }
+        CorrBuffers(const CorrBuffers&) = delete;
+        CorrBuffers& operator=(const CorrBuffers&) = delete;
+    };
+
+    static inline float sampleAt(const float* buffer, size_t numFrames, uint32_t numChannels, long i) {
+        return (i < 0 || (size_t)i >= numFrames) ? 0.0f : buffer[(size_t)i * numChannels];
+    }
+
+    static void scoreStart(const float* buffer, size_t numFrames, uint32_t numChannels,
+                        const std::vector<ZeroCross>& zeros, size_t start, float periodLength,
+                        float targetLength, const Corr& c, CorrBuffers& b, std::vector<Match>& out) {
+
+        auto sit = std::lower_bound(zeros.begin(), zeros.end(), start,
+            [](const ZeroCross& z, size_t v) { return z.index < v; });
+        if (sit == zeros.end() || sit->index != start) return;
+        const int dir = sit->direction;
+
+        const long idealEnd = (long)std::lround((double)start + targetLength);
+        const long lo = std::max<long>(idealEnd - c.R, (long)start + 1);
+        const long hi = idealEnd + c.R;
+        auto eit = std::lower_bound(sit + 1, zeros.end(), (size_t)lo,
+            [](const ZeroCross& z, size_t v) { return z.index < v; });
+        if (eit == zeros.end() || (long)eit->index > hi) return;
+
+        // template: the window centred on start, time reversed,
+        // so the product of both spectra give the correlation
+        const int half = c.W / 2;
+        double tEnergy = 0.0;
+        std::fill(b.a, b.a + c.N, 0.0f);
+        for (int k = 0; k < c.W; ++k) {
+            float v = sampleAt(buffer, numFrames, numChannels, (long)start - half + k);
+            b.a[c.W - 1 - k] = v;
+            tEnergy += (double)v * v;
+        }
+        if (tEnergy <= 1e-12) return;
+
+        // region: ideal end +- R, plus half a window on both sides
+        const long r0 = idealEnd - c.R - half;
+        const int span = c.W + 2 * c.R;
+        std::fill(b.b, b.b + c.N, 0.0f);
+        b.energy.assign(span + 1, 0.0);
+        for (int k = 0; k < span; ++k) {
+            float v = sampleAt(buffer, numFrames, numChannels, r0 + k);
+            b.b[k] = v;
+            b.energy[k + 1] = b.energy[k] + (double)v * v;
+        }
+
+        fftwf_execute_dft_r2c(c.fwd, b.a, b.A);
+        fftwf_execute_dft_r2c(c.fwd, b.b, b.B);
+        for (int k = 0; k < c.N / 2 + 1; ++k) {
+            const float re = b.A[k][0] * b.B[k][0] - b.A[k][1] * b.B[k][1];
+            const float im = b.A[k][0] * b.B[k][1] + b.A[k][1] * b.B[k][0];
+            b.B[k][0] = re;
+            b.B[k][1] = im;
+        }
+        fftwf_execute_dft_c2r(c.inv, b.B, b.b);
+        const float scale = 1.0f / (float)c.N;
+
+        for (; eit != zeros.end() && (long)eit->index <= hi; ++eit) {
+            if (eit->direction != dir || eit->index >= numFrames) continue;
+            // lag l put the window start on r0 + l
+            const long l = (long)eit->index - half - r0;
+            if (l < 0 || l + c.W > span) continue;
+            const double e = b.energy[l + c.W] - b.energy[l];
+            if (e <= 1e-12) continue;
+            const double xc = (double)b.b[l + c.W - 1] * scale;
+            const float ncc = (float)(xc / std::sqrt(tEnergy * e));
+            const float lengthError = std::fabs((float)eit->index - ((float)start + targetLength));
+            const float score = (1.0f - ncc) + 0.1f * lengthError / periodLength;
+            out.push_back({start, eit->index, score});
+        }
+    }
 };
 
 #endif
@@ -42,7 +42,11 @@ public:
     }
 
     inline void processV(std::vector<float>& s) {
-        for (auto& x : s) x = process(x);
+        processBlock(s.data(), s.size());
+    }
+
+    inline void processBlock(float* s, size_t n) {
+        for (size_t i = 0; i < n; ++i) s[i] = process(s[i]);
     }
 
     inline float process(float x){
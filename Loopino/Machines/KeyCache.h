@@ -13,10 +13,24 @@
                       the Octave spectrum, cache one Key peer Octave (8)
                       to re-pitch the MIDI notes between the Root Keys
                       from there. Max jitter stays below 0.2 ms
+
+                      Keys get refined in tiers: a shared preview of
+                      the processed root is published at once, an
+                      optional fast RubberBand draft follows, and the
+                      finer RubberBand result replace it when ready.
+
+                      The root gets fit into a runtime budget for
+                      memory and build time, long samples get
+                      decimated or truncated for the cache.
+
+                      buildExact() let offline renders get a FINE
+                      build of a exact key from the same workers,
+                      it bypass the cache and the statistics.
 ****************************************************************/
 
 #pragma once
 #include <map>
+#include <set>
 #include <memory>
 #include <atomic>
 #include <vector>
@@ -24,11 +38,68 @@
 #include <thread>
 #include <queue>
 #include <mutex>
+#include <ostream>
+#include <iomanip>
 #include <condition_variable>
 #include <rubberband/RubberBandStretcher.h>
 
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
 #include "machines.h"
 
+/****************************************************************
+        KeyCachePlan - how a root sample fit into the KeyCache budget
+****************************************************************/
+
+struct KeyCachePlan {
+    int decimate = 1;             // cache at 1/decimate of the source rate
+    size_t maxSamples = 0;        // cached part of the source (source rate)
+    size_t bytes = 0;             // estimated memory for all prewarmed keys
+    double seconds = 0.0;         // estimated build time
+    bool truncated = false;
+    bool fits = true;
+};
+
+/****************************************************************
+        KeyCacheStats - snapshot of the KeyCache state
+****************************************************************/
+
+struct KeyCacheStats {
+    struct Entry {
+        int note = 0;
+        int tier = 0;
+        size_t bytes = 0;
+        double buildMs = 0.0;     // whole job
+        double stretchMs = 0.0;   // time spend in RubberBand
+        double machineMs = 0.0;   // time spend in the machine chain
+    };
+    std::vector<Entry> entries;
+    size_t totalBytes = 0;        // shared buffers count once
+    int queueDepth = 0;
+    int building = 0;
+    uint64_t completed = 0;
+    uint64_t cancelled = 0;
+    uint64_t hits = 0;            // getNearest() found the exact key
+    uint64_t nearHits = 0;        // getNearest() returned a neighbour key
+    uint64_t misses = 0;          // getNearest() found nothing
+
+    // share of lookups which found the exact key
+    double hitRate() const {
+        uint64_t all = hits + nearHits + misses;
+        return all ? double(hits) / double(all) : 0.0;
+    }
+
+    // share of lookups which played a stretched neighbour
+    double nearRate() const {
+        uint64_t all = hits + nearHits + misses;
+        return all ? double(nearHits) / double(all) : 0.0;
+    }
+};
+
 class KeyCache
 {
 public:
@@ -37,10 +108,18 @@ public:
             workers.emplace_back([this, i]{ workerLoop(i); });        
     }
     ~KeyCache() { 
-        stop = true;
+        {
+            std::lock_guard<std::mutex> g(qm);
+            stop = true;
+        }
         cv.notify_all();
         for (auto& w : workers)
             w.join();        
+        // nobody wait forever for a exact build
+        while (!exactJobs.empty()) {
+            exactJobs.front()->finish(nullptr);
+            exactJobs.pop();
+        }
     }
 
     Machines machines;
@@ -165,12 +244,113 @@ public:
         sampleToBig = on;
     }
 
+    // run a OptionEngineFaster pass before the finer one
+    void setFastFirstPass(bool const on) {
+        fastFirstPass = on;
+    }
+
+    // memory the prewarmed keys may use, 0 select a default from the RAM size
+    void setMemoryBudget(size_t bytes) {
+        memoryBudget = bytes ? bytes : defaultMemoryBudget();
+    }
+
+    // time the workers may take to build all prewarmed keys
+    void setTimeBudget(double seconds) {
+        timeBudget = seconds;
+    }
+
+    // storage of the stretched keys and of the processed root the voices play
+    void setCacheFormat(SampleFormat f) {
+        cacheFormat = f;
+        rebuild();
+    }
+
+    void setSourceFormat(SampleFormat f) {
+        sourceFormat = f;
+        rebuild();
+    }
+
+    size_t getMemoryBudget() const { return memoryBudget; }
+    double getTimeBudget() const { return timeBudget; }
+
+    // estimate how a sample of length frames with rootFreq fits the budget
+    KeyCachePlan planFor(size_t length, double rootFreq) const {
+        KeyCachePlan plan;
+        plan.maxSamples = length;
+        if (!length || rootFreq <= 0.0) return plan;
+
+        // sum of stretch ratios over all prewarmed keys
+        double ratios = 0.0;
+        for (int note = 24; note <= 108; note += 12) {
+            ratios += midiToFreq(note) / rootFreq;
+            if (note + 7 <= 127) ratios += midiToFreq(note + 7) / rootFreq;
+        }
+        const double rate = stretchRate.load(std::memory_order_relaxed) * WORKERS;
+        const double bps = cacheFormat == SampleFormat::Float32 ? sizeof(float) : sizeof(uint16_t);
+        const double passes = fastFirstPass ? 1.3 : 1.0;
+
+        for (int d = 1; d <= MAX_DECIMATE; d *= 2) {
+            const double len = std::ceil(double(length) / d);
+            // stretched keys + shared preview + decimated root copy
+            plan.decimate = d;
+            plan.bytes = size_t(len * (bps * (ratios + 1.0) + (d > 1 ? sizeof(float) : 0.0)));
+            plan.seconds = len * ratios * passes / rate;
+            if (plan.bytes <= memoryBudget && plan.seconds <= timeBudget)
+                return plan;
+        }
+
+        // still to long, cache only the head of the sample
+        const double byMemory = memoryBudget / (bps * (ratios + 1.0) + sizeof(float));
+        const double byTime = timeBudget * rate / (ratios * passes);
+        const double len = std::min(byMemory, byTime);
+        plan.maxSamples = std::min(length, size_t(len) * MAX_DECIMATE);
+        plan.bytes = size_t(len * (bps * (ratios + 1.0) + sizeof(float)));
+        plan.seconds = len * ratios * passes / rate;
+        plan.truncated = true;
+        plan.fits = plan.maxSamples >= MIN_CACHE_SAMPLES;
+        return plan;
+    }
+
+    KeyCachePlan getPlan() {
+        std::lock_guard<std::mutex> g(qm);
+        return plan;
+    }
+
+    // the root the keys get build from
+    std::shared_ptr<const SampleInfo> getRoot() {
+        std::lock_guard<std::mutex> g(qm);
+        return root;
+    }
+
+    // a FINE build of note from src for a offline render, run by the
+    // workers with there machine chains after the queued keys. The
+    // result is handed to the caller, not to the cache or the stats.
+    // Blocks until done, nullptr when cancelled
+    std::shared_ptr<const SampleInfo> buildExact(int note, std::shared_ptr<const SampleInfo> src,
+                                                const std::atomic<bool>& cancel) {
+        if (!src || src->data.empty()) return nullptr;
+        auto job = std::make_shared<ExactJob>();
+        job->note = note;
+        job->src = std::move(src);
+        job->cancel = &cancel;
+        {
+            std::lock_guard<std::mutex> g(qm);
+            if (stop) return nullptr;
+            exactJobs.push(job);
+        }
+        cv.notify_one();
+        std::unique_lock<std::mutex> lk(job->m);
+        job->cv.wait(lk, [&job]{ return job->done; });
+        return job->result;
+    }
+
     void rebuild() {
         if (!root) return;
         clear();
         if (genCache && !sampleToBig) {
             machines.applyState();
             machines2.applyState();
+            prewarmPreview();
             prewarmOctaves();
             prewarmQuints();
         } else {
@@ -182,32 +362,53 @@ public:
     }
 
     void prewarmOctaves() {
+        if (fastFirstPass)
+            for (int note = 24; note <= 108; note += 12)
+                request(note, DRAFT);
         for (int note = 24; note <= 108; note += 12)
             request(note);
     }
 
     void prewarmQuints() {
-        for (int note = 24; note <= 108; note += 12) {
-            int q = note + 7;
-            if (q >= 0 && q <= 127)
-                request(q);
+        for (int pass = fastFirstPass ? DRAFT : FINE; pass <= FINE; ++pass) {
+            for (int note = 24; note <= 108; note += 12) {
+                int q = note + 7;
+                if (q >= 0 && q <= 127)
+                    request(q, pass);
+            }
         }
     }
 
+    // the preview job publish the processed root for all prewarmed keys
+    void prewarmPreview() {
+        request(PREVIEW_NOTE, PREVIEW);
+    }
+
     void setRoot(std::shared_ptr<const SampleInfo> s) {
+        std::shared_ptr<const SampleInfo> fitted = s;
+        KeyCachePlan p;
+        if (s) {
+            p = planFor(s->data.size(), s->rootFreq);
+            if (p.fits && (p.decimate > 1 || p.truncated))
+                fitted = fitToPlan(s, p);
+        }
         {
             std::lock_guard<std::mutex> g(qm);
-            root = s;
-            while(!jobs.empty()) jobs.pop();
-            pending.clear();
+            source = s;
+            root = fitted;
+            plan = p;
+            cancelJobs();
         }
         {
             std::lock_guard<std::mutex> g2(cacheMutex);
             cache.clear();
+            tiers.clear();
+            timing.clear();
         }
         if (genCache && !sampleToBig) {
             machines.applyState();
             machines2.applyState();
+            prewarmPreview();
             prewarmOctaves();
             prewarmQuints();
         } else {
@@ -217,15 +418,22 @@ public:
     }
 
     void runMachines() {
-        if (!root) return;
+        if (!source) {
+            sample_cache = nullptr;
+            return;
+        }
         auto s = std::make_shared<SampleInfo>();
-        s->data = std::move(root->data);
-        s->rootFreq = root->rootFreq;
-        s->sourceRate = root->sourceRate;
+        s->data = source->data;
+        s->rootFreq = source->rootFreq;
+        s->sourceRate = source->sourceRate;
         if (reverse) std::reverse(s->data.begin(), s->data.end());
         machines.applyState();
         machines.setSampleRate(s->sourceRate);
-        machines.process(s->data);
+        {
+            Reclaimer::Guard g;
+            machines.process(s->data);
+        }
+        s->pack(sourceFormat);
         sample_cache = s;
     }
 
@@ -241,7 +449,11 @@ public:
         s->sourceRate = loop_cache->sourceRate;
         loopMachines.applyState();
         loopMachines.setSampleRate(s->sourceRate);
-        loopMachines.process(s->data);
+        {
+            Reclaimer::Guard g;
+            loopMachines.process(s->data);
+        }
+        s->pack(sourceFormat);
         loop = s;
     }
 
@@ -269,8 +481,15 @@ public:
     std::shared_ptr<const SampleInfo> getNearest(int note) {
         std::lock_guard<std::mutex> g(cacheMutex);
 
-        if (cache.empty()) return nullptr;
+        if (cache.empty()) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
         auto it = cache.lower_bound(note);
+        if (it != cache.end() && it->first == note)
+            hits.fetch_add(1, std::memory_order_relaxed);
+        else
+            nearHits.fetch_add(1, std::memory_order_relaxed);
         if (it == cache.begin()) return it->second;
         if (it == cache.end()) return std::prev(it)->second;
         auto hi = it;
@@ -288,50 +507,241 @@ public:
         return it!=cache.end() ? it->second : nullptr;
     }
 
-    void request(int const note) {
+    // refinement tier of a cached key, -1 when not cached
+    int getTier(int note) {
+        std::lock_guard<std::mutex> g(cacheMutex);
+        auto it = tiers.find(note);
+        return it!=tiers.end() ? it->second : -1;
+    }
+
+    void request(int const note, int const tier = FINE) {
         std::lock_guard<std::mutex> g(qm);
-        if (pending.insert(note).second)
-            jobs.push(note);
+        if (pending.insert({note, tier}).second)
+            jobs.push({note, tier});
         cv.notify_one();
     }
 
     void clear() {
         {
             std::lock_guard<std::mutex> g(qm);
-            while(!jobs.empty()) jobs.pop();
-            pending.clear();
+            cancelJobs();
         }
         {
             std::lock_guard<std::mutex> g2(cacheMutex);
             cache.clear();
+            tiers.clear();
+            timing.clear();
+        }
+    }
+
+    int getKeyCacheState() {
+        std::lock_guard<std::mutex> g(qm);
+        return jobs.size();
+    }
+
+    KeyCacheStats getStats() {
+        KeyCacheStats st;
+        {
+            std::lock_guard<std::mutex> g(qm);
+            st.queueDepth = jobs.size();
+        }
+        st.building = building.load(std::memory_order_relaxed);
+        st.completed = completed.load(std::memory_order_relaxed);
+        st.cancelled = cancelled.load(std::memory_order_relaxed);
+        st.hits = hits.load(std::memory_order_relaxed);
+        st.nearHits = nearHits.load(std::memory_order_relaxed);
+        st.misses = misses.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> g(cacheMutex);
+        std::set<const SampleInfo*> counted;
+        for (auto& c : cache) {
+            KeyCacheStats::Entry e;
+            auto ti = timing.find(c.first);
+            if (ti != timing.end()) e = ti->second;
+            e.note = c.first;
+            e.tier = tiers[c.first];
+            e.bytes = c.second->bytes();
+            if (counted.insert(c.second.get()).second)
+                st.totalBytes += e.bytes;
+            st.entries.push_back(e);
+        }
+        return st;
+    }
+
+    void resetStats() {
+        completed = 0;
+        cancelled = 0;
+        hits = 0;
+        nearHits = 0;
+        misses = 0;
+    }
+
+    void printStats(std::ostream& os) {
+        KeyCacheStats st = getStats();
+        os << "KeyCache: " << st.entries.size() << " keys, "
+           << std::fixed << std::setprecision(1)
+           << st.totalBytes / (1024.0 * 1024.0) << " MB, queue "
+           << st.queueDepth << ", building " << st.building
+           << ", completed " << st.completed << ", cancelled " << st.cancelled
+           << ", hits " << st.hits << "/" << st.nearHits << "/" << st.misses
+           << " (exact/near/miss)\n";
+        for (auto& e : st.entries) {
+            os << "  note " << std::setw(3) << e.note << " tier " << e.tier
+               << std::setw(9) << e.bytes / 1024.0 << " kB"
+               << std::setw(9) << e.buildMs << " ms (rubberband "
+               << e.stretchMs << " ms, machines " << e.machineMs << " ms)\n";
         }
     }
 
-    int getKeyCacheState() { return jobs.size(); }
+    enum Tier { PREVIEW = 0, DRAFT = 1, FINE = 2 };
 
 private:
+    struct Job {
+        int note;
+        int tier;
+    };
+
+    struct ExactJob {
+        int note = 0;
+        std::shared_ptr<const SampleInfo> src;
+        const std::atomic<bool>* cancel = nullptr;
+        std::shared_ptr<const SampleInfo> result;
+        std::mutex m;
+        std::condition_variable cv;
+        bool done = false;
+
+        void finish(std::shared_ptr<const SampleInfo> r) {
+            std::lock_guard<std::mutex> g(m);
+            result = std::move(r);
+            done = true;
+            cv.notify_all();
+        }
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int PREVIEW_NOTE = -1;
+    static constexpr int MAX_DECIMATE = 4;
+    static constexpr size_t MIN_CACHE_SAMPLES = 4096;
+    static constexpr int DECIMATE_TAPS = 32;
     static constexpr int CHUNK = 4096;
     static constexpr auto WORKER_YIELD = std::chrono::microseconds(250);
     static constexpr int WORKERS = 2;
-    std::shared_ptr<const SampleInfo> root;
+    std::shared_ptr<const SampleInfo> source;   // as loaded
+    std::shared_ptr<const SampleInfo> root;     // fit to the budget
+    KeyCachePlan plan;
+    size_t memoryBudget = defaultMemoryBudget();
+    double timeBudget = 60.0;
+    // measured RubberBand output rate per worker (samples/second)
+    std::atomic<double> stretchRate{600000.0};
     std::shared_ptr<const SampleInfo> loop;
     std::shared_ptr<const SampleInfo> loop_cache;
     std::shared_ptr<const SampleInfo> sample_cache;
     std::map<int,std::shared_ptr<SampleInfo>> cache;
-    std::set<int> pending;
+    std::map<int,int> tiers;
+    std::map<int,KeyCacheStats::Entry> timing;
+    std::set<std::pair<int,int>> pending;
 
-    std::queue<int> jobs;
+    std::queue<Job> jobs;
+    std::queue<std::shared_ptr<ExactJob>> exactJobs;
     std::mutex qm;
     std::mutex cacheMutex;
     std::condition_variable cv;
     std::vector<std::thread> workers;
     //std::thread worker;
     std::atomic<bool> stop{false};
+    std::atomic<uint32_t> generation{0};
+    std::atomic<int> building{0};
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> cancelled{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> nearHits{0};
+    std::atomic<uint64_t> misses{0};
     bool reverse = false;
     bool genCache = false;
     bool sampleToBig = false;
+    bool fastFirstPass = false;
+    SampleFormat cacheFormat = SampleFormat::Float32;
+    SampleFormat sourceFormat = SampleFormat::Float32;
+
+    static double msSince(Clock::time_point t) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+    }
+
+    // drop all queued jobs, running jobs notice the new generation
+    // and discard there result. Call with qm locked.
+    void cancelJobs() {
+        cancelled.fetch_add(jobs.size(), std::memory_order_relaxed);
+        while(!jobs.empty()) jobs.pop();
+        pending.clear();
+        generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    static size_t defaultMemoryBudget() {
+        uint64_t ram = 0;
+#if defined(_WIN32)
+        MEMORYSTATUSEX status;
+        status.dwLength = sizeof(status);
+        if (GlobalMemoryStatusEx(&status)) ram = status.ullTotalPhys;
+#else
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long pageSize = sysconf(_SC_PAGE_SIZE);
+        if (pages > 0 && pageSize > 0) ram = uint64_t(pages) * uint64_t(pageSize);
+#endif
+        // use a eighth of the RAM, but at least 128 MB and at max 2 GB
+        constexpr uint64_t MB = 1024 * 1024;
+        if (!ram) return 128 * MB;
+        return size_t(std::clamp<uint64_t>(ram / 8, 128 * MB, 2048 * MB));
+    }
+
+    // lowpass and decimate the root, cut it at maxSamples with a short fade out
+    static std::shared_ptr<const SampleInfo> fitToPlan(
+                std::shared_ptr<const SampleInfo> s, const KeyCachePlan& p) {
+        const size_t length = std::min(s->data.size(), p.maxSamples);
+        const int d = p.decimate;
+        auto r = std::make_shared<SampleInfo>();
+        r->rootFreq = s->rootFreq;
+        r->sourceRate = s->sourceRate / d;
+        r->data.resize(length / d);
+
+        if (d == 1) {
+            std::copy(s->data.begin(), s->data.begin() + length, r->data.begin());
+        } else {
+            // blackman windowed sinc, cut off a bit below the new nyquist
+            float h[DECIMATE_TAPS];
+            const double fc = 0.45 / d;
+            double sum = 0.0;
+            for (int k = 0; k < DECIMATE_TAPS; ++k) {
+                const double m = k - (DECIMATE_TAPS - 1) * 0.5;
+                const double x = 2.0 * M_PI * fc * m;
+                const double sinc = m == 0.0 ? 1.0 : std::sin(x) / x;
+                const double w = 0.42 - 0.5 * std::cos(2.0 * M_PI * k / (DECIMATE_TAPS - 1))
+                                + 0.08 * std::cos(4.0 * M_PI * k / (DECIMATE_TAPS - 1));
+                h[k] = float(sinc * w);
+                sum += h[k];
+            }
+            for (auto& c : h) c /= float(sum);
+            const float* in = s->data.data();
+            const long half = DECIMATE_TAPS / 2;
+            for (size_t i = 0; i < r->data.size(); ++i) {
+                const long c = long(i * d);
+                float acc = 0.0f;
+                for (int k = 0; k < DECIMATE_TAPS; ++k) {
+                    const long j = std::clamp<long>(c + k - half, 0, long(length) - 1);
+                    acc += h[k] * in[j];
+                }
+                r->data[i] = acc;
+            }
+        }
+
+        if (p.truncated) {
+            const size_t fade = std::min<size_t>(r->data.size(), size_t(r->sourceRate * 0.01));
+            for (size_t i = 0; i < fade; ++i)
+                r->data[r->data.size() - 1 - i] *= float(i) / float(fade);
+        }
+        return r;
+    }
 
-    inline double midiToFreq(int midiNote) {
+    static inline double midiToFreq(int midiNote) {
         return  440.0f * std::pow(2.0, (midiNote - 69 ) / 12.0);
     }
 
@@ -341,52 +751,178 @@ private:
 
     void workerLoop(int instance) {
         while(!stop) {
-            int note = 0;
+            Job job{0, FINE};
+            std::shared_ptr<ExactJob> exact;
+            std::shared_ptr<const SampleInfo> src;
+            uint32_t gen = 0;
             {
                 std::unique_lock<std::mutex> lk(qm);
-                cv.wait(lk,[&]{return stop||!jobs.empty();});
+                cv.wait(lk,[&]{return stop||!jobs.empty()||!exactJobs.empty();});
                 if(stop) break;
+                // the keys for the live voices go first
                 if (jobs.size()) {
-                    note=jobs.front(); jobs.pop();
+                    job=jobs.front(); jobs.pop();
+                } else {
+                    exact = exactJobs.front(); exactJobs.pop();
                 }
+                src = root;
+                gen = generation.load(std::memory_order_acquire);
             }
             Machines *m = instance ? &machines : &machines2;
-            if (note)build(note, m);
+            if (exact) {
+                buildExactJob(*exact, m);
+                continue;
+            }
+            if (!src) continue;
+            building.fetch_add(1, std::memory_order_relaxed);
+            if (job.tier == PREVIEW) buildPreview(src, gen, m);
+            else if (job.note) build(job.note, job.tier, src, gen, m);
+            building.fetch_sub(1, std::memory_order_relaxed);
         }
     }
 
-    void build(int note, Machines *m) {
+    bool isCancelled(uint32_t gen) const {
+        return gen != generation.load(std::memory_order_acquire);
+    }
+
+    // store a key unless a better tier is already in place
+    // or the job was cancelled meanwhile
+    void publish(int note, int tier, std::shared_ptr<SampleInfo> s,
+                 uint32_t gen, const KeyCacheStats::Entry& e) {
+        std::lock_guard<std::mutex> g(cacheMutex);
+        if (isCancelled(gen)) return;
+        auto it = tiers.find(note);
+        if (it != tiers.end() && it->second > tier) return;
+        cache[note] = s;
+        tiers[note] = tier;
+        timing[note] = e;
+    }
+
+    void finishJob(int note, int tier, uint32_t gen) {
+        if (isCancelled(gen)) cancelled.fetch_add(1, std::memory_order_relaxed);
+        else completed.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> g(qm);
+        if (!isCancelled(gen)) pending.erase({note, tier});
+    }
 
-        RubberBand::RubberBandStretcher rb(root->sourceRate,1,
+    void buildPreview(std::shared_ptr<const SampleInfo> src, uint32_t gen, Machines *m) {
+        const auto t0 = Clock::now();
+        auto s = std::make_shared<SampleInfo>();
+        s->data = src->data;
+        s->rootFreq = src->rootFreq;
+        s->sourceRate = src->sourceRate;
+        m->setSampleRate(src->sourceRate);
+        {
+            Reclaimer::Guard g;
+            m->processBlock(s->data.data(), s->data.size());
+        }
+        if (reverse) std::reverse(s->data.begin(), s->data.end());
+        s->pack(cacheFormat);
+        KeyCacheStats::Entry e;
+        e.buildMs = e.machineMs = msSince(t0);
+        // one shared buffer, the voices re-pitch it to the key
+        for (int note = 24; note <= 108; note += 12) {
+            publish(note, PREVIEW, s, gen, e);
+            if (note + 7 <= 127) publish(note + 7, PREVIEW, s, gen, e);
+        }
+        finishJob(PREVIEW_NOTE, PREVIEW, gen);
+    }
+
+    void build(int note, int tier, std::shared_ptr<const SampleInfo> src,
+               uint32_t gen, Machines *m) {
+        KeyCacheStats::Entry e;
+        auto s = stretch(note, tier, *src, m, e, [&]{ return isCancelled(gen) || stop; });
+        if (!s) {
+            finishJob(note, tier, gen);
+            return;
+        }
+        if (e.stretchMs > 0.0 && tier == FINE) {
+            // follow the measured speed to keep the budget estimate honest
+            const double r = s->data.size() / (e.stretchMs * 0.001);
+            stretchRate.store(0.75 * stretchRate.load(std::memory_order_relaxed) + 0.25 * r,
+                              std::memory_order_relaxed);
+        }
+        s->pack(cacheFormat);
+        publish(note, tier, s, gen, e);
+        finishJob(note, tier, gen);
+        std::this_thread::sleep_for(WORKER_YIELD);
+    }
+
+    // full float, the export write it out as it is
+    void buildExactJob(ExactJob& job, Machines *m) {
+        KeyCacheStats::Entry e;
+        auto s = stretch(job.note, FINE, *job.src, m, e,
+                [&]{ return stop || job.cancel->load(std::memory_order_relaxed); });
+        job.finish(std::move(s));
+        std::this_thread::sleep_for(WORKER_YIELD);
+    }
+
+    // stretch src to the length of note and run the machine chain,
+    // nullptr when stopped() turn true on the way
+    template <typename Stopped>
+    std::shared_ptr<SampleInfo> stretch(int note, int tier, const SampleInfo& src,
+                                        Machines *m, KeyCacheStats::Entry& e, Stopped stopped) {
+        const auto t0 = Clock::now();
+        double machineMs = 0.0;
+
+        RubberBand::RubberBandStretcher rb(src.sourceRate,1,
             RubberBand::RubberBandStretcher::OptionProcessOffline|
-            RubberBand::RubberBandStretcher::OptionEngineFiner|
+            (tier == DRAFT ?
+                RubberBand::RubberBandStretcher::OptionEngineFaster :
+                RubberBand::RubberBandStretcher::OptionEngineFiner)|
             RubberBand::RubberBandStretcher::OptionFormantPreserved |
             RubberBand::RubberBandStretcher::OptionPhaseIndependent);
 
-        double ratio = midiToFreq(note)/root->rootFreq;
+        double ratio = midiToFreq(note)/src.rootFreq;
         //rb.reset();
         rb.setTimeRatio(ratio);
         rb.setPitchScale(1.0);
-        const float* sin[1] = { root->data.data() };
-        rb.study(sin, root->data.size(), true);
+        const float* sin[1] = { src.data.data() };
+        rb.study(sin, src.data.size(), true);
+
+        rb.setExpectedInputDuration(src.data.size());
+        rb.setMaxProcessSize(src.sourceRate * 4);
+
+        // the destination is allocated once, every retrieved chunk
+        // runs through the machine chain right where it lands
+        auto s = std::make_shared<SampleInfo>();
+        s->rootFreq = src.rootFreq;
+        s->sourceRate = src.sourceRate;
+        std::vector<float>& out = s->data;
+        out.resize(size_t(std::ceil(src.data.size() * ratio)) + CHUNK);
+        size_t written = 0;
+
+        m->setSampleRate(src.sourceRate);
+        // the TimeMachine jitter need the whole buffer, the chain run after the stretch then
+        bool stream;
+        {
+            Reclaimer::Guard g;
+            stream = m->streamable();
+        }
+
+        auto drain = [&](int avail) {
+            if (written + avail > out.size())
+                out.resize(written + avail + CHUNK);
+            float* chans[1] = { out.data() + written };
+            rb.retrieve(chans, avail);
+            if (stream) {
+                const auto tm = Clock::now();
+                Reclaimer::Guard g;
+                m->processBlock(out.data() + written, avail);
+                machineMs += msSince(tm);
+            }
+            written += avail;
+        };
 
-        rb.setExpectedInputDuration(root->data.size());
-        rb.setMaxProcessSize(root->sourceRate * 4);
         const float* in[1];
-        std::vector<float> out;
-        out.reserve(int(root->data.size() * ratio) + 1024);
         int pos = 0;
-        while ((size_t)pos < root->data.size()) {
-            int n = std::min<int>(CHUNK, int(root->data.size() - pos));
-            in[0] = root->data.data() + pos;
+        while ((size_t)pos < src.data.size()) {
+            if (stopped()) return nullptr;
+            int n = std::min<int>(CHUNK, int(src.data.size() - pos));
+            in[0] = src.data.data() + pos;
             rb.process(in, n, false);
             int avail;
-            while ((avail = rb.available()) > 0) {
-                size_t old = out.size();
-                out.resize(old + avail);
-                float* chans[1] = { out.data() + old };
-                rb.retrieve(chans, avail);
-            }
+            while ((avail = rb.available()) > 0) drain(avail);
             pos += n;
         }
         // flush
@@ -396,28 +932,23 @@ private:
             int avail = rb.available();
             if (avail > 0) {
                 idle = 0;
-                size_t old = out.size();
-                out.resize(old + avail);
-                float* chans[1] = { out.data() + old };
-                rb.retrieve(chans, avail);
+                drain(avail);
             }
             else idle++;
         }
-
-        auto s = std::make_shared<SampleInfo>();
-        s->data = std::move(out);
-        s->rootFreq = root->rootFreq;
-        s->sourceRate = root->sourceRate;
-
-        m->setSampleRate(root->sourceRate);
-        m->process(s->data);
-        if (reverse) std::reverse(s->data.begin(), s->data.end());
-        std::lock_guard<std::mutex> g(cacheMutex);
-        cache[note] = s;
-        {
-            std::lock_guard<std::mutex> g(qm);
-            pending.erase(note);
+        out.resize(written);
+        if (!stream) {
+            const auto tm = Clock::now();
+            Reclaimer::Guard g;
+            m->processBlock(out.data(), out.size());
+            machineMs += msSince(tm);
         }
-        std::this_thread::sleep_for(WORKER_YIELD);
+
+        // reverse only the finished buffer
+        if (reverse) std::reverse(out.begin(), out.end());
+        e.buildMs = msSince(t0);
+        e.machineMs = machineMs;
+        e.stretchMs = e.buildMs - machineMs;
+        return s;
     }
 };
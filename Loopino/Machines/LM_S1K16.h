@@ -41,8 +41,12 @@ public:
     }
 
     inline void processV(std::vector<float>& s) {
+        processBlock(s.data(), s.size());
+    }
+
+    inline void processBlock(float* s, size_t n) {
         if (!onOff) return;
-        for (auto& x : s) x = process(x);
+        for (size_t i = 0; i < n; ++i) s[i] = process(s[i]);
     }
 
     inline float process(float x) {
@@ -25,8 +25,11 @@
 struct LP {
     float z = 0;
     void process(std::vector<float>& s, float cutoff) {
+        process(s.data(), s.size(), cutoff);
+    }
+    void process(float* s, size_t n, float cutoff) {
         float a = cutoff * 0.18f;
-        for(auto& x:s){ z += a*(x - z); x = z; }
+        for (size_t i = 0; i < n; ++i) { z += a*(s[i] - z); s[i] = z; }
     }
 };
 
@@ -48,12 +51,23 @@ public:
         onoff = onoffState;
     }
 
+    // the jitter read head wander freely over the whole buffer,
+    // with jitter on a buffer can't be cut in chunks
+    bool streamable() const {
+        return !onoff || jitter < 0.0001f;
+    }
+
     void processV(std::vector<float>& s) {
+        processBlock(s.data(), s.size());
+    }
+
+    // the whole buffer, or a chunk of a stream when streamable()
+    void processBlock(float* s, size_t n) {
         if (!onoff) return;
-        for(auto& x:s) x = sat(x* (1+drive));
-        for(auto& x:s) x = compand(x*grit + x*(1-grit));
-        jitterResample(s, jitter);
-        lp.process(s, cutoff);
+        for (size_t i = 0; i < n; ++i) s[i] = sat(s[i]* (1+drive));
+        for (size_t i = 0; i < n; ++i) s[i] = compand(s[i]*grit + s[i]*(1-grit));
+        jitterResample(s, n, jitter);
+        lp.process(s, n, cutoff);
     }
 private:
     float drive=0.3f, grit=0.4f, jitter=0.4f, cutoff=0.6f;
@@ -76,14 +90,14 @@ private:
         return std::round(x * 2047.f) / 2047.f;
     }
 
-    void jitterResample(std::vector<float>& s, float amount) {
-        if (amount < 0.0001f) return;
+    void jitterResample(float* s, size_t n, float amount) {
+        if (amount < 0.0001f || !n) return;
 
-        std::vector<float> out(s.size());
+        std::vector<float> out(n);
         double p = 0.0;
         double drift = 1.0;
 
-        for (size_t i = 0; i < out.size(); ++i) {
+        for (size_t i = 0; i < n; ++i) {
             drift += ((rand() / float(RAND_MAX)) - 0.5f) * 0.0005 * amount;
             p += drift;
 
@@ -92,13 +106,14 @@ private:
 
             auto S=[&](int x){
                 if(x<0) return s[0];
-                if(x>=int(s.size())) return s.back();
+                if(x>=int(n)) return s[n - 1];
                 return s[x];
             };
 
             float x0=S(ip-1),x1=S(ip),x2=S(ip+1),x3=S(ip+2);
             out[i] = x1 + 0.5f*t*(x2-x0 + t*(2*x0-5*x1+4*x2-x3 + t*(3*(x1-x2)+x3-x0)));
         }
-        s.swap(out);
+        std::copy(out.begin(), out.end(), s);
     }
+
 };
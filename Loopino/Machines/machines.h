@@ -19,6 +19,7 @@
 #include <atomic>
 #include <vector>
 
+#include "Reclaimer.h"
 #include "BrickWall.h"
 #include "LM_CMP12Dac.h"
 #include "LM_MIR8Brk.h"
@@ -32,15 +33,22 @@
 class Machines {
 private:
     using ProcFn = void (*)(void*, std::vector<float>&);
+    using BlockFn = void (*)(void*, float*, size_t);
 
     template<class T>
     static void call(void* obj, std::vector<float>& s) {
         return static_cast<T*>(obj)->processV(s);
     }
 
+    template<class T>
+    static void callBlock(void* obj, float* s, size_t n) {
+        return static_cast<T*>(obj)->processBlock(s, n);
+    }
+
     struct DspSlot {
         void*  instance;
         ProcFn fn;
+        BlockFn block;
     };
 
     struct DspChain {
@@ -59,7 +67,6 @@ public:
     Machines() = default;
     ~Machines() {
         delete activeChain.exchange(nullptr);
-        delete retired.exchange(nullptr);
     }
 
     void setSampleRate(double sr) {
@@ -94,15 +101,15 @@ public:
         auto* newChain = new DspChain;
         newChain->slots.reserve(newOrder.size());
         
-        newChain->slots.push_back({&bw, &call<Brickwall>});
+        newChain->slots.push_back({&bw, &call<Brickwall>, &callBlock<Brickwall>});
         for (int id : newOrder) {
             switch(id) {
-                case 20: newChain->slots.push_back({&mrg, &call<LM_MIR8Brk>}); break;
-                case 21: newChain->slots.push_back({&emu_12, &call<LM_EII12>}); break;
-                case 22: newChain->slots.push_back({&cmp12dac, &call<LM_CMP12Dac>}); break;
-                case 23: newChain->slots.push_back({&studio16, &call<LM_S1K16>}); break;
-                case 24: newChain->slots.push_back({&tm, &call<TimeMachine>}); break;
-                case 25: newChain->slots.push_back({&eps, &call<VFX_EPS_CLASSIC>}); break;
+                case 20: newChain->slots.push_back({&mrg, &call<LM_MIR8Brk>, &callBlock<LM_MIR8Brk>}); break;
+                case 21: newChain->slots.push_back({&emu_12, &call<LM_EII12>, &callBlock<LM_EII12>}); break;
+                case 22: newChain->slots.push_back({&cmp12dac, &call<LM_CMP12Dac>, &callBlock<LM_CMP12Dac>}); break;
+                case 23: newChain->slots.push_back({&studio16, &call<LM_S1K16>, &callBlock<LM_S1K16>}); break;
+                case 24: newChain->slots.push_back({&tm, &call<TimeMachine>, &callBlock<TimeMachine>}); break;
+                case 25: newChain->slots.push_back({&eps, &call<VFX_EPS_CLASSIC>, &callBlock<VFX_EPS_CLASSIC>}); break;
             }
         }
 
@@ -113,17 +120,34 @@ public:
 
 
 
+    // the callers of process(), streamable() and processBlock()
+    // hold a Reclaimer::Guard while they run the chain
     inline void process(std::vector<float>& s) {
         DspChain* c = activeChain.load(std::memory_order_acquire);
         for (auto& m : c->slots)
             m.fn(m.instance, s);
     }
 
+    // false when a machine in the chain need the whole buffer at once
+    inline bool streamable() {
+        DspChain* c = activeChain.load(std::memory_order_acquire);
+        for (auto& m : c->slots)
+            if (m.instance == &tm) return tm.streamable();
+        return true;
+    }
+
+    // process one chunk of a continuous stream in place,
+    // machine state carry over from chunk to chunk
+    inline void processBlock(float* s, size_t n) {
+        DspChain* c = activeChain.load(std::memory_order_acquire);
+        for (auto& m : c->slots)
+            m.block(m.instance, s, n);
+    }
+
 private:
     double sampleRate = 44100.0;
     bool isInitied = false;
     std::atomic<DspChain*> activeChain { nullptr };
-    std::atomic<DspChain*> retired { nullptr };
     std::vector<int> lastActiveOrder;
 
     bool isActive(int id) const {
@@ -148,9 +172,9 @@ private:
         }
     }
 
+    // KeyCache workers may still run the old chain
     void retire(DspChain* old) {
-        DspChain* prev = retired.exchange(old, std::memory_order_acq_rel);
-        delete prev;
+        Reclaimer::get().retire(old);
     }
 
 };
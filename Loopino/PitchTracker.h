@@ -12,15 +12,22 @@
   process only the first channel from a multi channel buffers
   this is meant for running offline (non-rt)
   return the resulting MIDI key
+  the transforms run on power of two sizes with cached plans
+  detectPitch run YIN on short overlapping frames in parallel
+  and return the median pitch with a confidence and the contour
 ****************************************************************/
 
+#pragma once
+
 #include <fftw3.h>
 #include <cmath>
+#include <cstring>
 #include <algorithm>
 #include <vector>
 #include <cstdint>
+#include <thread>
 
-#pragma once
+#include "FFTPlanCache.h"
 
 #ifndef PITCHTRACKER_H
 #define PITCHTRACKER_H
@@ -31,13 +38,149 @@ public:
     ~PitchTracker() = default;
 
     static constexpr float THRESHOLD = 0.99f;
+    static constexpr float YIN_THRESHOLD = 0.15f;
+    // below this getPitch fall back to the spectrum
+    static constexpr float MIN_CONFIDENCE = 0.5f;
+    static constexpr size_t MAX_FRAMES = 512;
+
+    struct PitchResult {
+        float freq = 0.0f;              // median over the voiced frames
+        float confidence = 0.0f;        // 0 .. 1
+        uint8_t midikey = 0;
+        int16_t correction = 0;         // cents
+        size_t hop = 0;                 // frames distance in samples
+        std::vector<float> contour;     // per frame, 0 when unvoiced
+    };
+
+/****************************************************************
+     YIN on frames of the first channel
+****************************************************************/
+
+    static PitchResult detectPitch(const float* buffer, size_t N, uint32_t channels,
+            float sampleRate, float minFreq = 30.0f, float maxFreq = 2000.0f) {
+
+        PitchResult r;
+        if (!buffer || channels == 0 || sampleRate <= 0.0f || minFreq <= 0.0f) return r;
+        const int tauMax = (int)std::ceil(sampleRate / minFreq);
+        const int tauMin = std::max(2, (int)std::floor(sampleRate / maxFreq));
+        const int W = tauMax;               // integration window
+        const int L = W + tauMax + 2;       // samples per frame
+        if (N < (size_t)L || tauMin >= tauMax) return r;
+        const int F = FFTPlanCache::sizeFor((size_t)(W + L));
+        fftwf_plan fwd = FFTPlanCache::get().plan(FFTPlanCache::R2C, F);
+        fftwf_plan inv = FFTPlanCache::get().plan(FFTPlanCache::C2R, F);
+        if (!fwd || !inv) return r;
+
+        float maxAbs = 0.0f;
+        for (size_t i = 0; i < N; ++i) maxAbs = std::max(maxAbs, std::fabs(buffer[i * channels]));
+        if (maxAbs < 1e-4f) return r;
+        // frames quieter than this are skipped as silence
+        const double silence = (double)W * sq(maxAbs * 0.01f);
+
+        r.hop = std::max<size_t>(W / 2, (N - L) / MAX_FRAMES + 1);
+        const size_t frames = (N - L) / r.hop + 1;
+        r.contour.assign(frames, 0.0f);
+        std::vector<float> conf(frames, 0.0f);
+        std::vector<uint8_t> sounding(frames, 0);
+
+        auto job = [&](size_t t, size_t step) {
+            FFTWorkspace& ws = FFTWorkspace::local();
+            if (!ws.reserve(F)) return;
+            std::vector<double> energy(L + 1);
+            std::vector<float> d(tauMax + 1);
+            for (size_t f = t; f < frames; f += step) {
+                const float* x = buffer + f * r.hop * channels;
+                energy[0] = 0.0;
+                for (int j = 0; j < L; ++j) {
+                    const float v = x[(size_t)j * channels];
+                    ws.a[j] = j < W ? v : 0.0f;
+                    ws.b[j] = v;
+                    energy[j + 1] = energy[j] + (double)v * v;
+                }
+                const double e0 = energy[W];
+                if (e0 < silence) continue;
+                sounding[f] = 1;
+                std::memset(ws.a + L, 0, (F - L) * sizeof(float));
+                std::memset(ws.b + L, 0, (F - L) * sizeof(float));
+                // r(tau) = sum x[j] * x[j + tau], j < W
+                fftwf_execute_dft_r2c(fwd, ws.a, ws.spec);
+                fftwf_execute_dft_r2c(fwd, ws.b, ws.spec2);
+                for (int k = 0; k < F / 2 + 1; ++k) {
+                    const float re = ws.spec[k][0] * ws.spec2[k][0] + ws.spec[k][1] * ws.spec2[k][1];
+                    const float im = ws.spec[k][0] * ws.spec2[k][1] - ws.spec[k][1] * ws.spec2[k][0];
+                    ws.spec2[k][0] = re;
+                    ws.spec2[k][1] = im;
+                }
+                fftwf_execute_dft_c2r(inv, ws.spec2, ws.b);
+                const float scale = 1.0f / (float)F;
+
+                // cumulative mean normalised difference
+                d[0] = 1.0f;
+                double running = 0.0;
+                for (int tau = 1; tau <= tauMax; ++tau) {
+                    const double diff = e0 + (energy[tau + W] - energy[tau])
+                                      - 2.0 * (double)ws.b[tau] * scale;
+                    running += std::max(0.0, diff);
+                    d[tau] = running > 0.0 ? (float)(std::max(0.0, diff) * tau / running) : 1.0f;
+                }
+                int tau = tauMin;
+                while (tau < tauMax && d[tau] >= YIN_THRESHOLD) ++tau;
+                if (tau >= tauMax) continue;
+                while (tau + 1 < tauMax && d[tau + 1] < d[tau]) ++tau;
+                float x0 = (float)tau;
+                if (tau > 1 && tau < tauMax)
+                    parabolaTurningPoint(d[tau - 1], d[tau], d[tau + 1], (float)tau, &x0);
+                if (x0 <= 0.0f) continue;
+                r.contour[f] = sampleRate / x0;
+                conf[f] = std::clamp(1.0f - d[tau], 0.0f, 1.0f);
+            }
+            ws.trim();
+        };
+        const size_t threads = std::min<size_t>((frames + 31) / 32,
+                        std::max(1u, std::min(8u, std::thread::hardware_concurrency())));
+        if (threads <= 1) {
+            job(0, 1);
+        } else {
+            std::vector<std::thread> pool;
+            for (size_t t = 0; t < threads; ++t) pool.emplace_back(job, t, threads);
+            for (auto& th : pool) th.join();
+        }
+
+        std::vector<float> voiced;
+        double confSum = 0.0;
+        size_t loud = 0;
+        for (size_t f = 0; f < frames; ++f) {
+            loud += sounding[f];
+            if (r.contour[f] <= 0.0f) continue;
+            voiced.push_back(r.contour[f]);
+            confSum += conf[f];
+        }
+        if (voiced.empty()) return r;
+        std::nth_element(voiced.begin(), voiced.begin() + voiced.size() / 2, voiced.end());
+        r.freq = voiced[voiced.size() / 2];
+        // how clear the voiced frames are, weighted by how many sounding frames are voiced
+        r.confidence = (float)(confSum / voiced.size()) * (float)voiced.size() / (float)std::max<size_t>(1, loud);
+        r.midikey = toMidi(r.freq, &r.correction);
+        return r;
+    }
 
     // this works best with arbitrary sample buffers, while the next formula works better with loop buffers
+    // a confident frame based detection win over the spectrum of the whole buffer
     static uint8_t getPitch( const float* buffer, size_t N, uint32_t channels,
             float sampleRate, int16_t* pitchCorrection = nullptr,
             float* frequency = nullptr, float minFreq = 20.0f,
             float maxFreq = 5000.0f) {
 
+        if (N >= 2 && channels > 0) {
+            PitchResult y = detectPitch(buffer, N, channels, sampleRate,
+                                        std::max(minFreq, 30.0f), std::min(maxFreq, 2000.0f));
+            if (y.confidence >= MIN_CONFIDENCE) {
+                if (pitchCorrection) *pitchCorrection = y.correction;
+                if (frequency) *frequency = y.freq;
+                return y.midikey;
+            }
+        }
+
         if (N < 2 || channels <= 0) {
             if (pitchCorrection) *pitchCorrection = 0;
             if (frequency) *frequency = 0.0f;
@@ -59,10 +202,18 @@ public:
             return 0;
         }
 
-        // Okay, we get something to work with, now allocate FFTW buffers
-        fftwf_complex* out = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * (N/2 + 1));
-        float* in = (float*) fftwf_malloc(sizeof(float) * N);
-        fftwf_plan plan = fftwf_plan_dft_r2c_1d(N, in, out, FFTW_ESTIMATE);
+        // Okay, we get something to work with, get a plan and buffers
+        // for the next power of two, the tail is zero padded
+        const size_t F = FFTPlanCache::sizeFor(N);
+        FFTWorkspace& ws = FFTWorkspace::local();
+        fftwf_plan plan = FFTPlanCache::get().plan(FFTPlanCache::R2C, (int)F);
+        if (!plan || !ws.reserve((int)F)) {
+            if (pitchCorrection) *pitchCorrection = 0;
+            if (frequency) *frequency = 0.0f;
+            return 0;
+        }
+        float* in = ws.a;
+        fftwf_complex* out = ws.spec;
 
         // Normalize & apply Hann window
         float gain = 1.0f / maxAbs;
@@ -70,16 +221,17 @@ public:
             float w = 0.5f - 0.5f * std::cos(2.0f * M_PI * i / (N - 1));
             in[i] = buffer[i * channels] * gain * w;
         }
+        std::memset(in + N, 0, (F - N) * sizeof(float));
 
         // Execute FFT
-        fftwf_execute(plan);
+        fftwf_execute_dft_r2c(plan, in, out);
 
         // Limit Frequency range
-        size_t minBin = std::max<size_t>(1, static_cast<size_t>(std::floor(minFreq * N / sampleRate)));
-        size_t maxBin = std::min<size_t>(N/2, static_cast<size_t>(std::ceil(maxFreq * N / sampleRate)));
+        size_t minBin = std::max<size_t>(1, static_cast<size_t>(std::floor(minFreq * F / sampleRate)));
+        size_t maxBin = std::min<size_t>(F/2, static_cast<size_t>(std::ceil(maxFreq * F / sampleRate)));
 
         // Magnitude spectrum
-        std::vector<float> mags(N/2 + 1);
+        std::vector<float> mags(F/2 + 1);
         for (size_t k = minBin; k <= maxBin; ++k) {
             float re = out[k][0];
             float im = out[k][1];
@@ -111,7 +263,7 @@ public:
 
         // Parabolic interpolation around peak
         float interpolatedIndex = static_cast<float>(peakIndex);
-        if (peakIndex > 0 && peakIndex < N/2) {
+        if (peakIndex > 0 && peakIndex < F/2) {
             float alpha = std::log(hps[peakIndex - 1] + 1e-12f);
             float beta  = std::log(hps[peakIndex]     + 1e-12f);
             float gamma = std::log(hps[peakIndex + 1] + 1e-12f);
@@ -120,19 +272,25 @@ public:
         }
 
         // Convert peak bin to frequency
-        float freq = interpolatedIndex * sampleRate / N;
+        float freq = interpolatedIndex * sampleRate / F;
+        ws.trim();
 
         // Output frequency
         if (frequency) *frequency = freq;
         if (freq <= 0.0f) {
-            fftwf_destroy_plan(plan);
-            fftwf_free(in);
-            fftwf_free(out);
             if (pitchCorrection) *pitchCorrection = 0;
             return 0;
         }
 
-        // Frequency -> MIDI note
+        int16_t correction = 0;
+        uint8_t midiNote = toMidi(freq, &correction);
+        if (pitchCorrection) *pitchCorrection = correction;
+
+        return midiNote;
+    }
+
+    // Frequency -> MIDI note, and the pitch correction in cents
+    static uint8_t toMidi(float freq, int16_t* correctionOut) {
         float midiFloat = 69.0f + 12.0f * std::log2(freq / 440.0f);
         int midiNote = static_cast<int>(std::floor(midiFloat + 0.5f));
         midiNote = std::clamp(midiNote, 0, 127);
@@ -153,12 +311,7 @@ public:
 
         int16_t correction = static_cast<int16_t>(std::lround(cents));
         correction = std::clamp<int16_t>(correction, -50, 50);
-        if (pitchCorrection) *pitchCorrection = correction;
-
-        // Cleanup
-        fftwf_destroy_plan(plan);
-        fftwf_free(in);
-        fftwf_free(out);
+        if (correctionOut) *correctionOut = correction;
 
         return static_cast<uint8_t>(midiNote);
     }
@@ -181,26 +334,20 @@ public:
             buffer[i] *= gain ;
         }
 
-        int fftSize = 1;
-        while (fftSize < bufferSize) fftSize <<= 1;
-
-        float* fftwBufferTime = (float*)fftwf_malloc(fftSize * sizeof(float));
-        float* fftwBufferFreq = (float*)fftwf_malloc(fftSize * sizeof(float));
-        if (!fftwBufferTime || !fftwBufferFreq)
+        const int fftSize = FFTPlanCache::sizeFor(bufferSize);
+        FFTWorkspace& ws = FFTWorkspace::local();
+        fftwf_plan fftPlan = FFTPlanCache::get().plan(FFTPlanCache::R2HC, fftSize);
+        fftwf_plan ifftPlan = FFTPlanCache::get().plan(FFTPlanCache::HC2R, fftSize);
+        if (!fftPlan || !ifftPlan || !ws.reserve(fftSize))
             return 0.0f;
-
-        fftwf_plan fftPlan = fftwf_plan_r2r_1d(
-            fftSize, fftwBufferTime, fftwBufferFreq,
-            FFTW_R2HC, FFTW_ESTIMATE);
-        fftwf_plan ifftPlan = fftwf_plan_r2r_1d(
-            fftSize, fftwBufferFreq, fftwBufferTime,
-            FFTW_HC2R, FFTW_ESTIMATE);
+        float* fftwBufferTime = ws.a;
+        float* fftwBufferFreq = ws.b;
 
         memcpy(fftwBufferTime, buffer, bufferSize * sizeof(float));
         if (fftSize > bufferSize)
             memset(fftwBufferTime + bufferSize, 0, (fftSize - bufferSize) * sizeof(float));
 
-        fftwf_execute(fftPlan);
+        fftwf_execute_r2r(fftPlan, fftwBufferTime, fftwBufferFreq);
 
         for (int k = 1; k < fftSize/2; ++k) {
             fftwBufferFreq[k] = sq(fftwBufferFreq[k]) + sq(fftwBufferFreq[fftSize-k]);
@@ -209,7 +356,7 @@ public:
         fftwBufferFreq[0]        = sq(fftwBufferFreq[0]);
         fftwBufferFreq[fftSize/2]= sq(fftwBufferFreq[fftSize/2]);
 
-        fftwf_execute(ifftPlan);
+        fftwf_execute_r2r(ifftPlan, fftwBufferFreq, fftwBufferTime);
 
         double sumSq = 2.0 * static_cast<double>(fftwBufferTime[0]) / static_cast<double>(fftSize);
         for (int k = 0; k < fftSize - bufferSize; k++)
@@ -236,17 +383,9 @@ public:
                 outFreq = 0.0f;
         }
 
-        if (outFreq < 0.0f) {
-            float midiFloat = 69.0f + 12.0f * std::log2(outFreq / 440.0f);
-            int midiNote = static_cast<int>(std::floor(midiFloat + 0.5f));
-            midikey = std::clamp(midiNote, 0, 127);
-        }
-
-        fftwf_destroy_plan(fftPlan);
-        fftwf_destroy_plan(ifftPlan);
-        fftwf_free(fftwBufferTime);
-        fftwf_free(fftwBufferFreq);
+        if (outFreq > 0.0f) midikey = toMidi(outFreq, nullptr);
 
+        ws.trim();
         return outFreq;
     }
 
@@ -310,7 +449,6 @@ private:
                 return indices[j];
         return -1;
     }
-
 };
 
 #endif
@@ -0,0 +1,296 @@
+
+/*
+ * Reclaimer.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** Reclaimer - epoch based deferred reclamation
+ *
+ *  Objects which may still be in use by a other thread (the
+ *  audio thread in first place) never get freed in place.
+ *  They get retired into a lock free queue instead, and a
+ *  background thread free them once all readers, which may
+ *  have seen them, have left there read section.
+ *
+ *  retire() is lock free and doesn't allocate, so it is save
+ *  to call it from the real-time thread. When the queue is full
+ *  a shared reference get parked in a small spare list, the next
+ *  retire() and the background thread take it from there. Only
+ *  when that is full too the reference get dropped in place,
+ *  this is counted in droppedCount().
+ *
+ *  usage:
+ *      // reader side, hold the guard while using shared pointers
+ *      {
+ *          Reclaimer::Guard g;
+ *          Chain* c = active.load(std::memory_order_acquire);
+ *          c->process();
+ *      }
+ *      // writer side, unlink the object first, then retire it
+ *      Chain* old = active.exchange(newChain);
+ *      Reclaimer::get().retire(old);
+ *      // or hand over the last reference of a shared_ptr
+ *      Reclaimer::get().retire(std::move(owner));
+ ****************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+#ifndef RECLAIMER_H_
+#define RECLAIMER_H_
+
+class Reclaimer {
+public:
+    static constexpr int MAX_READERS = 32;
+    static constexpr size_t QUEUE_SIZE = 4096;  // power of two
+    static constexpr int SPARE_SIZE = 64;
+
+    // one instance serves all synth instances in the process
+    static Reclaimer& get() {
+        static Reclaimer r;
+        return r;
+    }
+
+    // RAII read section, claims a free reader slot, never blocks.
+    // The audio thread takes one per block, not one per sample.
+    class Guard {
+    public:
+        Guard() : slot(Reclaimer::get().enter()) {}
+        ~Guard() { Reclaimer::get().leave(slot); }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    private:
+        int slot;
+    };
+
+    // retire a raw pointer, delete it later
+    // not meant for the real-time thread, it waits when the queue is full
+    template<class T>
+    void retire(T* p) {
+        if (!p) return;
+        Entry e;
+        e.ptr = const_cast<void*>(static_cast<const void*>(p));
+        e.del = [](void* q) { delete static_cast<T*>(q); };
+        while (!push(std::move(e)))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // retire a reference of a shared object, the last reference
+    // then get dropped by the background thread.
+    // false when the reference had to be dropped in place
+    template<class T>
+    bool retire(std::shared_ptr<T>&& p) {
+        if (!p) return true;
+        Entry e;
+        e.owner = std::shared_ptr<const void>(std::move(p));
+        // the parked ones go first
+        if (parked.load(std::memory_order_acquire)) unpark();
+        if (push(std::move(e)) || park(std::move(e))) {
+            pending.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // objects waiting to be freed
+    size_t pendingCount() const {
+        return pending.load(std::memory_order_relaxed);
+    }
+
+    // references the queue and the spare list couldn't take
+    uint64_t droppedCount() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    ~Reclaimer() {
+        run.store(false, std::memory_order_release);
+        if (worker.joinable()) worker.join();
+        drain();
+        for (auto& e : waiting) release(e);
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<const void> owner;
+        void* ptr = nullptr;
+        void (*del)(void*) = nullptr;
+        uint64_t epoch = 0;
+    };
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        Entry e;
+    };
+
+    enum { SPARE_FREE = 0, SPARE_BUSY, SPARE_FULL };
+
+    struct Spare {
+        std::atomic<int> state { SPARE_FREE };
+        Entry e;
+    };
+
+    std::atomic<uint64_t> globalEpoch { 1 };
+    std::atomic<uint64_t> readers[MAX_READERS];
+    std::atomic<int> overflow { 0 };            // readers without a slot
+    Cell cells[QUEUE_SIZE];
+    std::atomic<size_t> head { 0 };
+    std::atomic<size_t> tail { 0 };
+    std::atomic<size_t> pending { 0 };
+    Spare spares[SPARE_SIZE];
+    std::atomic<int> parked { 0 };
+    std::atomic<uint64_t> dropped { 0 };
+    std::atomic<bool> run { true };
+    std::vector<Entry> waiting;
+    std::thread worker;
+
+    Reclaimer() {
+        for (auto& r : readers) r.store(0);
+        for (size_t i = 0; i < QUEUE_SIZE; ++i) cells[i].seq.store(i);
+        waiting.reserve(QUEUE_SIZE + SPARE_SIZE);
+        worker = std::thread([this]() {
+            while (run.load(std::memory_order_acquire)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                collect();
+            }
+        });
+    }
+
+    int enter() {
+        const uint64_t e = globalEpoch.load(std::memory_order_seq_cst);
+        for (int i = 0; i < MAX_READERS; ++i) {
+            uint64_t expected = 0;
+            if (readers[i].compare_exchange_strong(expected, e, std::memory_order_seq_cst))
+                return i;
+        }
+        // all slots taken, count the reader instead of waiting for a slot,
+        // nothing get freed while such readers are around
+        overflow.fetch_add(1, std::memory_order_seq_cst);
+        return -1;
+    }
+
+    void leave(int slot) {
+        if (slot < 0) overflow.fetch_sub(1, std::memory_order_release);
+        else readers[slot].store(0, std::memory_order_release);
+    }
+
+    // bounded MPMC queue (D. Vyukov), only one consumer here
+    bool push(Entry&& e) {
+        // the object is unlinked already, every reader entering
+        // after this epoch can't see it anymore
+        e.epoch = globalEpoch.load(std::memory_order_seq_cst);
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& c = cells[pos & (QUEUE_SIZE - 1)];
+            const size_t seq = c.seq.load(std::memory_order_acquire);
+            const intptr_t dif = intptr_t(seq) - intptr_t(pos);
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.e = std::move(e);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                // queue full
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // the queue is full, keep the entry in a free spare
+    bool park(Entry&& e) {
+        e.epoch = globalEpoch.load(std::memory_order_seq_cst);
+        for (auto& s : spares) {
+            int expected = SPARE_FREE;
+            if (s.state.compare_exchange_strong(expected, SPARE_BUSY, std::memory_order_acquire)) {
+                s.e = std::move(e);
+                s.state.store(SPARE_FULL, std::memory_order_release);
+                parked.fetch_add(1, std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // move parked entries into the queue, stop when it is full again
+    void unpark() {
+        for (auto& s : spares) {
+            int expected = SPARE_FULL;
+            if (!s.state.compare_exchange_strong(expected, SPARE_BUSY, std::memory_order_acquire))
+                continue;
+            if (!push(std::move(s.e))) {
+                s.state.store(SPARE_FULL, std::memory_order_release);
+                return;
+            }
+            parked.fetch_sub(1, std::memory_order_relaxed);
+            s.state.store(SPARE_FREE, std::memory_order_release);
+        }
+    }
+
+    bool pop(Entry& e) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Cell& c = cells[pos & (QUEUE_SIZE - 1)];
+        const size_t seq = c.seq.load(std::memory_order_acquire);
+        if (intptr_t(seq) - intptr_t(pos + 1) < 0) return false;
+        e = std::move(c.e);
+        head.store(pos + 1, std::memory_order_relaxed);
+        c.seq.store(pos + QUEUE_SIZE, std::memory_order_release);
+        return true;
+    }
+
+    // only the background thread, it take the parked ones directly
+    void drain() {
+        Entry e;
+        while (pop(e)) waiting.push_back(std::move(e));
+        if (!parked.load(std::memory_order_acquire)) return;
+        for (auto& s : spares) {
+            int expected = SPARE_FULL;
+            if (!s.state.compare_exchange_strong(expected, SPARE_BUSY, std::memory_order_acquire))
+                continue;
+            waiting.push_back(std::move(s.e));
+            parked.fetch_sub(1, std::memory_order_relaxed);
+            s.state.store(SPARE_FREE, std::memory_order_release);
+        }
+    }
+
+    void release(Entry& e) {
+        if (e.del) e.del(e.ptr);
+        e.owner.reset();
+        pending.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void collect() {
+        drain();
+        if (waiting.empty()) return;
+        globalEpoch.fetch_add(1, std::memory_order_seq_cst);
+        // a reader without slot may have seen any of them, try again later
+        if (overflow.load(std::memory_order_seq_cst)) return;
+        // oldest epoch a active reader may still work in
+        uint64_t oldest = UINT64_MAX;
+        for (auto& r : readers) {
+            const uint64_t v = r.load(std::memory_order_seq_cst);
+            if (v && v < oldest) oldest = v;
+        }
+        size_t keep = 0;
+        for (size_t i = 0; i < waiting.size(); ++i) {
+            if (waiting[i].epoch < oldest) release(waiting[i]);
+            else if (keep++ != i) waiting[keep - 1] = std::move(waiting[i]);
+        }
+        waiting.resize(keep);
+    }
+};
+
+#endif
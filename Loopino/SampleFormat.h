@@ -0,0 +1,180 @@
+
+/*
+ * SampleFormat.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+
+/****************************************************************
+        SampleFormat.h  - compact storage formats for sample data
+                          int16 (peak scaled) or IEEE half float,
+                          widen 4 taps at once with SSE2, and
+                          with F16C when the CPU has it (checked
+                          at runtime, the build don't enable it)
+****************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cstddef>
+
+#ifdef __SSE2__
+ #include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+ #include <immintrin.h>
+ #define SAMPLECODEC_F16C 1
+#endif
+
+#ifndef SAMPLEFORMAT_H
+#define SAMPLEFORMAT_H
+
+enum class SampleFormat : uint8_t {
+    Float32 = 0,
+    Int16   = 1,
+    Half    = 2
+};
+
+namespace SampleCodec {
+
+inline uint16_t floatToHalf(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, 4);
+    const uint32_t sign = (x >> 16) & 0x8000;
+    int32_t exp = int32_t((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+    if (exp >= 31) return uint16_t(sign | 0x7c00);          // overflow -> inf
+    if (exp <= 0) {                                          // subnormal or zero
+        if (exp < -10) return uint16_t(sign);
+        mant |= 0x800000;
+        const uint32_t shift = uint32_t(14 - exp);
+        uint32_t h = mant >> shift;
+        if ((mant >> (shift - 1)) & 1) h++;                  // round
+        return uint16_t(sign | h);
+    }
+    uint32_t h = sign | (uint32_t(exp) << 10) | (mant >> 13);
+    if (mant & 0x1000) h++;                                  // round, may carry into exp
+    return uint16_t(h);
+}
+
+inline float halfToFloat(uint16_t h) {
+    const uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0) {
+        if (!mant) {
+            x = sign;
+        } else {                                             // normalise subnormal
+            exp = 127 - 15 + 1;
+            while (!(mant & 0x400)) { mant <<= 1; exp--; }
+            mant &= 0x3ff;
+            x = sign | (exp << 23) | (mant << 13);
+        }
+    } else if (exp == 31) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, 4);
+    return f;
+}
+
+#ifdef SAMPLECODEC_F16C
+__attribute__((target("f16c")))
+inline void halfToFloat4F16C(const uint16_t* p, float* out) {
+    __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+    _mm_storeu_ps(out, _mm_cvtph_ps(v));
+}
+
+inline const bool haveF16C = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("f16c") != 0;
+}();
+#endif
+
+// scale factor to fit the peak of a buffer into int16
+inline float int16Scale(const float* in, size_t n) {
+    float peak = 0.0f;
+    for (size_t i = 0; i < n; ++i) peak = std::fmax(peak, std::fabs(in[i]));
+    return peak > 0.0f ? peak / 32767.0f : 1.0f;
+}
+
+// float -> int16 with saturation, 8 samples at once with SSE2
+inline void toInt16(const float* in, int16_t* out, size_t n, float scale) {
+    const float g = 1.0f / scale;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 vg = _mm_set1_ps(g);
+    for (; i + 8 <= n; i += 8) {
+        const __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), vg));
+        const __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), vg));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(a, b));
+    }
+#endif
+    for (; i < n; ++i) {
+        long v = std::lrint(in[i] * g);
+        v = v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+        out[i] = int16_t(v);
+    }
+}
+
+// int16 -> float, 8 samples at once with SSE2
+inline void fromInt16(const int16_t* in, float* out, size_t n, float scale) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 vs = _mm_set1_ps(scale);
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vs));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vs));
+    }
+#endif
+    for (; i < n; ++i) out[i] = float(in[i]) * scale;
+}
+
+inline void encode(const float* in, uint16_t* out, size_t n, SampleFormat f, float scale) {
+    if (f == SampleFormat::Int16) {
+        toInt16(in, reinterpret_cast<int16_t*>(out), n, scale);
+    } else {
+        for (size_t i = 0; i < n; ++i) out[i] = floatToHalf(in[i]);
+    }
+}
+
+inline float decode1(uint16_t v, SampleFormat f, float scale) {
+    if (f == SampleFormat::Int16) return float(int16_t(v)) * scale;
+    return halfToFloat(v);
+}
+
+// widen 4 consecutive packed samples to float
+inline void decode4(const uint16_t* p, float* out, SampleFormat f, float scale) {
+    if (f == SampleFormat::Int16) {
+#ifdef __SSE2__
+        __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+        v = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        _mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(scale)));
+#else
+        for (int k = 0; k < 4; ++k) out[k] = float(int16_t(p[k])) * scale;
+#endif
+    } else {
+#ifdef SAMPLECODEC_F16C
+        if (haveF16C) {
+            halfToFloat4F16C(p, out);
+            return;
+        }
+#endif
+        for (int k = 0; k < 4; ++k) out[k] = halfToFloat(p[k]);
+    }
+}
+
+} // namespace SampleCodec
+
+#endif
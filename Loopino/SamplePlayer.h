@@ -21,6 +21,9 @@
 #include "Tone.h"
 #include "filters.h"
 #include "ScalaFactory.h"
+#include "SampleFormat.h"
+#include "Reclaimer.h"
+#include "DiskStream.h"
 
 
 #ifndef SAMPLEPLAYER_H
@@ -47,6 +50,18 @@ public:
 
     void setSampleRate(double sr) {sampleRate = sr;}
 
+    // times and rate of an other envelope, the state stay idle
+    void copyParams(const ADSR& o) {
+        sampleRate = o.sampleRate;
+        attack = o.attack;
+        decay = o.decay;
+        sustain = o.sustain;
+        release = o.release;
+        attackCoef = o.attackCoef;
+        decayCoef = o.decayCoef;
+        releaseCoef = o.releaseCoef;
+    }
+
     void setAttack(float a) {
         attack = std::max(a, 0.001f);
         attackCoef = recalcCoef(attack);
@@ -70,6 +85,11 @@ public:
 
     void noteOn() {state = ATTACK;}
 
+    void reset() {
+        state = IDLE;
+        level = 0.0f;
+    }
+
     void noteOff() {state = RELEASE;}
 
     float process() {
@@ -135,30 +155,186 @@ private:
 
 /****************************************************************
             SampleBank: store Samples & Metadata
+            a fixed number of slots, a new sample get published
+            by swapping the slot generation, the replaced one
+            get retired to the Reclaimer.
+            Each slot covers a key/velocity zone, a flat
+            128x128 table map key and velocity to the slot
 ****************************************************************/
 
 struct SampleInfo : public std::enable_shared_from_this<SampleInfo> {
     std::vector<float> data;
+    std::vector<uint16_t> packed;   // used instead of data when format isn't Float32
+    SampleFormat format = SampleFormat::Float32;
+    float scale = 1.0f;             // int16 to float
     double sourceRate = 44100.0;
     double rootFreq = 440.0;
+    std::shared_ptr<const StreamSource> stream;    // data hold only the head then
+
+    size_t size() const {
+        return format == SampleFormat::Float32 ? data.size() : packed.size();
+    }
+
+    // playable length, including the part streamed from disk
+    size_t length() const {
+        return stream ? (size_t)stream->frames : size();
+    }
+
+    size_t bytes() const {
+        return data.capacity() * sizeof(float) + packed.capacity() * sizeof(uint16_t);
+    }
+
+    inline float at(size_t i) const {
+        if (format == SampleFormat::Float32) return data[i];
+        return SampleCodec::decode1(packed[i], format, scale);
+    }
+
+    // fetch the interpolation taps i-1 .. i+2, clamped at the edges
+    inline void fetch4(size_t i, float* out) const {
+        const size_t n = size();
+        if (i >= 1 && i + 2 < n) {
+            if (format == SampleFormat::Float32)
+                std::memcpy(out, &data[i - 1], 4 * sizeof(float));
+            else
+                SampleCodec::decode4(&packed[i - 1], out, format, scale);
+            return;
+        }
+        out[0] = at(i == 0 ? 0 : i - 1);
+        out[1] = at(i);
+        out[2] = at(i + 1 < n ? i + 1 : n - 1);
+        out[3] = at(i + 2 < n ? i + 2 : n - 1);
+    }
+
+    // move the float data into the compact storage
+    void pack(SampleFormat f) {
+        if (f == format || format != SampleFormat::Float32) return;
+        if (f == SampleFormat::Int16) scale = SampleCodec::int16Scale(data.data(), data.size());
+        packed.resize(data.size());
+        SampleCodec::encode(data.data(), packed.data(), data.size(), f, scale);
+        format = f;
+        std::vector<float>().swap(data);
+    }
+};
+
+class KeyCache;
+
+// key/velocity range and loop of a slot
+struct SampleZone {
+    uint8_t loKey = 0;
+    uint8_t hiKey = 127;
+    uint8_t loVel = 0;
+    uint8_t hiVel = 127;
+    uint32_t loopStart = 0;         // no zone loop when loopEnd <= loopStart
+    uint32_t loopEnd = 0;
+    KeyCache* cache = nullptr;      // stretch cache serving this zone, may be null
+
+    bool covers(int key, int velocity) const {
+        return key >= loKey && key <= hiKey && velocity >= loVel && velocity <= hiVel;
+    }
+    bool hasLoop() const { return loopEnd > loopStart; }
 };
 
 class SampleBank {
 public:
-    void addSample(std::shared_ptr<const SampleInfo> s) {
-        samples.push_back(std::move(s));
+    static constexpr size_t CAPACITY = 16;
+    static constexpr uint8_t NO_ZONE = 0xff;
+
+    struct Zone {
+        std::shared_ptr<const SampleInfo> sample;
+        SampleZone range;
+        uint64_t gen;
+        uint8_t index;
+    };
+
+    SampleBank() = default;
+    ~SampleBank() {
+        for (auto& s : slots) delete s.exchange(nullptr);
+        delete map.exchange(nullptr);
     }
+    SampleBank(const SampleBank&) = delete;
+    SampleBank& operator=(const SampleBank&) = delete;
 
+    // publish a sample into a slot, replace what was there.
+    // on overlapping zones the higher slot wins, so slot 0 with
+    // the default zone is the fallback for the whole keyboard
+    bool publish(std::shared_ptr<const SampleInfo> s, size_t index = 0,
+                                        const SampleZone& zone = SampleZone()) {
+        if (index >= CAPACITY) return false;
+        auto* z = new Zone{ std::move(s), zone,
+                    generation.fetch_add(1, std::memory_order_relaxed) + 1, uint8_t(index) };
+        Reclaimer::get().retire(slots[index].exchange(z, std::memory_order_acq_rel));
+        rebuildMap();
+        return true;
+    }
+
+    void clear(size_t index) {
+        if (index >= CAPACITY) return;
+        Reclaimer::get().retire(slots[index].exchange(nullptr, std::memory_order_acq_rel));
+        rebuildMap();
+    }
+
+    // readers on other threads than the publisher hold a Reclaimer::Guard
     std::shared_ptr<const SampleInfo> getSample(size_t index) const {
-        if (index >= samples.size())
+        const Zone* z = getZone(index);
+        return z ? z->sample : nullptr;
+    }
+
+    const Zone* getZone(size_t index) const {
+        if (index >= CAPACITY)
             return nullptr;
-        return samples[index];
+        return slots[index].load(std::memory_order_acquire);
     }
 
-    size_t size() const { return samples.size(); }
+    // constant time zone lookup for noteOn, hold a Reclaimer::Guard
+    const Zone* findZone(int key, int velocity) const {
+        const ZoneMap* m = map.load(std::memory_order_acquire);
+        if (!m) return nullptr;
+        const uint8_t idx = m->slot[std::clamp(key, 0, 127)][std::clamp(velocity, 0, 127)];
+        if (idx == NO_ZONE) return nullptr;
+        return slots[idx].load(std::memory_order_acquire);
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (auto& s : slots) if (s.load(std::memory_order_acquire)) n++;
+        return n;
+    }
+
+    // count of publishes so far
+    uint64_t getGeneration() const { return generation.load(std::memory_order_relaxed); }
+
+    // memory held by the published samples
+    size_t bytes() const {
+        size_t b = 0;
+        for (auto& s : slots) {
+            const Zone* z = s.load(std::memory_order_acquire);
+            if (z && z->sample) b += z->sample->bytes();
+        }
+        return b;
+    }
 
 private:
-    std::vector<std::shared_ptr<const SampleInfo>> samples;
+    struct ZoneMap {
+        uint8_t slot[128][128];
+    };
+    std::atomic<const Zone*> slots[CAPACITY] = {};
+    std::atomic<const ZoneMap*> map { nullptr };
+    std::atomic<uint64_t> generation { 0 };
+
+    // only called by the publisher
+    void rebuildMap() {
+        auto* m = new ZoneMap;
+        std::memset(m->slot, NO_ZONE, sizeof(m->slot));
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            const Zone* z = slots[i].load(std::memory_order_acquire);
+            if (!z || !z->sample) continue;
+            const SampleZone& r = z->range;
+            for (int k = r.loKey; k <= std::min<int>(r.hiKey, 127); ++k)
+                std::memset(&m->slot[k][r.loVel], uint8_t(i),
+                    std::max(0, std::min<int>(r.hiVel, 127) - r.loVel + 1));
+        }
+        Reclaimer::get().retire(map.exchange(m, std::memory_order_acq_rel));
+    }
 };
 
 #include "KeyCache.h"
@@ -171,6 +347,7 @@ class SamplePlayer {
 public:
     std::atomic<const SampleInfo*> sample { nullptr };
     std::shared_ptr<const SampleInfo> currentSampleOwner;
+    StreamVoice stream;
     double pmPhase = 0.0;
     double pmFreq = 0.0;
     double pmDepthNorm = 0.0;
@@ -190,12 +367,31 @@ public:
 
     void setSampleRate(double sr) {srOut = sr;}
 
+    // the modulation settings of an other player
+    void copyModulation(const SamplePlayer& o) {
+        srOut = o.srOut;
+        pmFreq = o.pmFreq;
+        pmDepthNorm = o.pmDepthNorm;
+        pmShape = o.pmShape;
+        vibRate = o.vibRate;
+        vibDepth = o.vibDepth;
+        vibonoff = o.vibonoff;
+        tremRate = o.tremRate;
+        tremDepth = o.tremDepth;
+        tremonoff = o.tremonoff;
+    }
+
     void setSample(std::shared_ptr<const SampleInfo> s, double sourceRate) {
+        std::shared_ptr<const SampleInfo> old = std::move(currentSampleOwner);
         currentSampleOwner = s;
         sample.store(s.get(), std::memory_order_release);
+        stream.start(s ? s->stream.get() : nullptr);
+        // never drop the last reference on the audio thread,
+        // and retire it only after it is unlinked
+        Reclaimer::get().retire(std::move(old));
         srIn = sourceRate;
         const SampleInfo* p = sample.load(std::memory_order_acquire);
-        if (p) loopEnd = p->data.size() > 0 ? p->data.size() - 1 : 0;
+        if (p) loopEnd = p->length() > 0 ? p->length() - 1 : 0;
         phase = 0.0;
         pmPhase = 0.0f;
         driftState = 0.0f;
@@ -306,11 +502,10 @@ public:
 
     float process() {
         const SampleInfo* p = sample.load(std::memory_order_acquire);
-        if (!p || p->data.empty())
+        if (!p)
             return 0.0f;
 
-        const auto& s = p->data;
-        const size_t size = s.size();
+        const size_t size = p->length();
         if (size == 0) return 0.0f;
         float pm = 0.0f;
 
@@ -358,7 +553,9 @@ public:
 
         if (looping) {
             double loopLen = std::max(1.0, (double)(loopEnd - loopStart));
-            while (readPos <  loopStart) readPos += loopLen;
+            // the part before a zone loop play once
+            if (phase < loopStart) readPos = std::max(readPos, 0.0);
+            else while (readPos <  loopStart) readPos += loopLen;
             while (readPos >= loopEnd)   readPos -= loopLen;
         } else {
             readPos = std::clamp(readPos, 0.0, (double)size - 1.0);
@@ -366,10 +563,13 @@ public:
 
         size_t i = (size_t)readPos;
         float frac = readPos - (double)i;
-        size_t i_m1 = (i == 0 ? 0 : i - 1);
-        size_t i_p1 = (i + 1 < size ? i + 1 : size - 1);
-        size_t i_p2 = (i + 2 < size ? i + 2 : size - 1);
-        float tmp[4] = {s[i_m1], s[i], s[i_p1], s[i_p2]};
+        float tmp[4];
+        if (p->stream) {
+            stream.fetch4(p->stream.get(), i, tmp);
+            stream.release(i);
+        } else {
+            p->fetch4(i, tmp);
+        }
         float val = hermite_interpolation(&tmp[1], frac);
         phase += phaseIncMod;
 
@@ -390,22 +590,22 @@ public:
 
     void processSave(int duration, std::vector<float>& abuf) {
         const SampleInfo* p = sample.load(std::memory_order_acquire);
-        if (!p || p->data.empty())
+        if (!p)
             return;
 
-        const auto& s = p->data;
-        const size_t size = s.size();
+        const size_t size = p->size();
         if (size == 0) return;
         int roll = duration;
 
         while(roll > 0) {
             size_t i0 = static_cast<size_t>(phase);
             size_t i1 = std::min(i0 + 1, size - 1);
-            i0 = std::clamp<size_t>(i0, 0, s.size() -1);
-            i1 = std::clamp<size_t>(i1, 0, s.size() -1);
+            i0 = std::clamp<size_t>(i0, 0, size -1);
+            i1 = std::clamp<size_t>(i1, 0, size -1);
             double frac = phase - (double)i0;
 
-            float val = static_cast<float>(s[i0] + frac * (s[i1] - s[i0]));
+            const float s0 = p->at(i0);
+            float val = static_cast<float>(s0 + frac * (p->at(i1) - s0));
 
             phase += phaseInc;
 
@@ -463,9 +663,8 @@ class SampleVoice {
 public:
     SampleVoice(double sr = 44100.0)
         : env(sr) {}
-    KeyCache *rb = nullptr;
     Filters filter;
-    const Scala::TuningTable *tuning = nullptr;
+    const std::atomic<const Scala::TuningTable*> *tuning = nullptr;
     // Attack, Decay, Sustain, Release 
     void setADSR(float a, float d, float s, float r) {
         env.setParams(a, d, s, r);
@@ -605,45 +804,58 @@ public:
     }
 
     void setUseCache(bool o) { useCache = o; }
-
+    // noteOn() would pick a stretched key from the KeyCache
+    bool playsKeys() const { return useCache && !sampleToBig; }
+
+    // a fresh voice playing like o, for offline renders
+    void copySettings(const SampleVoice& o) {
+        sampleRate = o.sampleRate;
+        env.copyParams(o.env);
+        player.copyModulation(o.player);
+        filter.copySettings(o.filter);
+        tuning = o.tuning;
+        sampleToBig = o.sampleToBig;
+        useCache = o.useCache;
+        velmode = o.velmode;
+        velComp = o.velComp;
+        freq = o.freq;
+        age = o.age;
+    }
+
+    // cache is the KeyCache serving the zone, without one the
+    // zone sample get played as it is, with the zone loop if any
     void noteOn(int midiNote, float velocity,
                 std::shared_ptr<const SampleInfo> sampleData,
-                double sourceRate, double rootFreq_, bool looping = true) {
+                double sourceRate, double rootFreq_, bool looping = true,
+                KeyCache* cache = nullptr, uint32_t loopStart = 0, uint32_t loopEnd = 0) {
 
         this->midiNote = midiNote;
         rootFreq = rootFreq_;
         active = true;
         vel = velocityCurve(velocity);
 
-        if (!looping) {
-            if (useCache && !sampleToBig) {
-                auto s = rb->getNearest(midiNote);
-                if (s) {
-                    sampleData = s;
-                    sourceRate = s->sourceRate;
-                    rootFreq   = s->rootFreq;
-                }
+        std::shared_ptr<const SampleInfo> s;
+        // streamed samples play from disk as they are
+        if (cache && !sampleData->stream) {
+            if (!looping) {
+                s = (useCache && !sampleToBig) ? cache->getNearest(midiNote) : cache->getSample();
             } else {
-                auto s = rb->getSample();
-                if (s) {
-                    sampleData = s;
-                    sourceRate = s->sourceRate;
-                    rootFreq   = s->rootFreq;
-                }
-            }
-        } else {
-            auto s = rb->getLoop();
-            if (s) {
-                sampleData = s;
-                sourceRate = s->sourceRate;
-                rootFreq   = s->rootFreq;
+                s = cache->getLoop();
             }
         }
+        if (s) {
+            sampleData = s;
+            sourceRate = s->sourceRate;
+            rootFreq   = s->rootFreq;
+        }
 
         double targetFreq = midiToFreq(midiNote);
         player.setSample(sampleData, sourceRate);
         player.setFrequency(targetFreq, rootFreq);
-        player.setLoop(0, sampleData->data.size() - 1, looping);
+        if (!s && looping && !sampleData->stream && loopEnd > loopStart && loopEnd < sampleData->size())
+            player.setLoop(loopStart, loopEnd, true);
+        else
+            player.setLoop(0, sampleData->length() - 1, looping && !sampleData->stream);
         player.reset();
         filter.noteOn(targetFreq);
         env.noteOn();
@@ -693,7 +905,7 @@ public:
 
         player.setSample(sampleData, sourceRate);
         player.setFrequency(440.0, rootFreq);
-        player.setLoop(0, sampleData->data.size() - 1, true);
+        player.setLoop(0, sampleData->size() - 1, true);
         player.reset();
         for (int i = 0; i < frames; i++) {
             abuf[i] = player.process();
@@ -706,7 +918,7 @@ public:
 
         player.setSample(sampleData, sourceRate);
         player.setFrequency(midiToFreq(midiNote), rootFreq);
-        player.setLoop(0, sampleData->data.size() - 1, loop);
+        player.setLoop(0, sampleData->size() - 1, loop);
         player.reset();
         player.processSave(duration, abuf);
         for (uint32_t i = 0; i < abuf.size(); i++) {
@@ -716,6 +928,13 @@ public:
 
     bool isActive() const { return active; }
 
+    // silence at once, for offline voices cut before the release end
+    // and for the live ones at a preset swap
+    void reset() {
+        env.reset();
+        active = false;
+    }
+
 private:
     SamplePlayer player;
     ADSR env;
@@ -735,19 +954,21 @@ private:
 
     inline double midiToFreq(int midiNote) {
         if (midiNote < 0 || midiNote > 127 || !tuning) return 0.0;
+        const Scala::TuningTable* t = tuning->load(std::memory_order_acquire);
+        if (!t) return 0.0;
 
         const double pitchRangeSemi = 2.0;
         const double pitchCents = pitch * pitchRangeSemi * 100.0;
-        const int degree = tuning->keymap[midiNote];
+        const int degree = t->keymap[midiNote];
         // 12-TET fallback
-        if (degree < 0 || degree >= (int)tuning->cents.size()) {
+        if (degree < 0 || degree >= (int)t->cents.size()) {
             const double cents = (midiNote - 69) * 100.0 + pitchCents;
             return freq * std::pow(2.0, cents * 0.000833333); // / 1200.0);
         }
         // micro tune table
-        const int rel = midiNote - tuning->rootMidi;
-        const int octave = (rel - degree) / tuning->periodSteps;
-        const double cents = octave * 1200.0 + tuning->cents[degree] + pitchCents;
+        const int rel = midiNote - t->rootMidi;
+        const int octave = (rel - degree) / t->periodSteps;
+        const double cents = octave * 1200.0 + t->cents[degree] + pitchCents;
         return freq * std::pow(2.0, cents * 0.000833333); // / 1200.0);
     }
 /*
@@ -784,8 +1005,10 @@ private:
 class PolySynth {
 public:
     PolySynth() {}
+    ~PolySynth() { delete activeTuning.exchange(nullptr); }
     KeyCache rb;
     Scala::TuningTable tuning;
+    std::atomic<const Scala::TuningTable*> activeTuning { nullptr };
     bool isInited = false;
 
     void init(double sr, size_t maxVoices = 48) {
@@ -795,6 +1018,7 @@ public:
             voices.push_back(std::make_unique<SampleVoice>());
         sampleRate = sr;
         Scala::makeEqual12(tuning);
+        publishTuning();
         masterGain = (1.0f / std::sqrt((float)maxVoices));
         playLoop = false;
         chorus.setSampleRate(sr);
@@ -806,18 +1030,25 @@ public:
         for (auto& v : voices) {
             v->setADSR(0.01f, 0.2f, 0.7f, 0.4f); // Attack, Decay, Sustain, Release (in Seconds)
             v->setSampleRate(sr);
-            v->rb = &rb;
-            v->tuning = &tuning;
+            v->tuning = &activeTuning;
         }
         isInited = true;
     }
 
     float getMidiFreq(int key) { return voices[voices.size() - 1]->getMidiFreq(key); }
 
+    // the working copy, call publishTuning() after editing it
     Scala::TuningTable& getScalaTable() { return tuning; }
 
     void setScalaTuning(Scala::TuningTable& t) {
         tuning = t;
+        publishTuning();
+    }
+
+    // hand a copy of the working table to the voices
+    void publishTuning() {
+        auto* t = new Scala::TuningTable(tuning);
+        Reclaimer::get().retire(activeTuning.exchange(t, std::memory_order_acq_rel));
     }
 
     void rebuildMachineChain(const std::vector<int>& order) {
@@ -881,6 +1112,12 @@ public:
         updateAllVoices(&SampleVoice::setUseCache, intToBool(o));
     }
 
+    void fastFirstPass(int o) { rb.setFastFirstPass(intToBool(o)); }
+
+    // storage of the played buffers: 0 = float, 1 = int16, 2 = half
+    void setCacheFormat(int f)  { rb.setCacheFormat(static_cast<SampleFormat>(std::clamp(f, 0, 2))); }
+    void setSourceFormat(int f) { rb.setSourceFormat(static_cast<SampleFormat>(std::clamp(f, 0, 2))); }
+
     void setReverse(int o) { rb.setReverse(intToBool(o)); }
 
     void setLoop(bool loop) {
@@ -895,7 +1132,9 @@ public:
 
     void setBank(const SampleBank* sbank) {
         sampleBank = sbank;
-        rb.setRoot(sampleBank->getSample(0));
+        const auto s = sampleBank->getSample(0);
+        // nothing to cache for a sample streamed from disk
+        rb.setRoot(s && s->stream ? nullptr : s);
     }
 
     void getAnalyseBuffer(float *abuf, int frames) {
@@ -906,6 +1145,8 @@ public:
     void getSaveBuffer(bool loop, std::vector<float>& abuf, uint8_t rootKey, uint32_t duration) {
         auto s = sampleBank->getSample(0);
         if (loop) s = loopBank->getSample(0);
+        // render from the whole file, offline
+        if (s && s->stream) s = wholeFile(s);
         voices[voices.size() - 1]->getSaveBuffer(loop, abuf, rootKey, duration, s, s->sourceRate, s->rootFreq);
     }
 
@@ -919,7 +1160,10 @@ public:
 
     void setRootFreq(float freq)     { updateAllVoices(&SampleVoice::setRootFreq, freq); }
 
-    void setPitchWheel(float f)      { updateAllVoices(&SampleVoice::setPitchWheel, f); }
+    void setPitchWheel(float f) {
+        Reclaimer::Guard g;
+        updateAllVoices(&SampleVoice::setPitchWheel, f);
+    }
 
     void setCutoffLP(float value)    { updateAllVoices(&SampleVoice::setCutoffLP, value); }
     void setResoLP(float value)      { updateAllVoices(&SampleVoice::setResoLP, value); }
@@ -1012,28 +1256,130 @@ public:
         updateAllVoices(static_cast<void (SampleVoice::*)()>(&SampleVoice::noteOff));
     }
 
-    void noteOn(int midiNote, float velocity, size_t sampleIndex = 0) {
-        if (playLoop ? !loopBank : !sampleBank) return;
-        const auto s = playLoop ? loopBank->getSample(sampleIndex) : sampleBank->getSample(sampleIndex);
-        if (!s) return;
-
+    void noteOn(int midiNote, float velocity) {
+        Reclaimer::Guard g;
+        SampleVoice* voice = voices[0].get();
         for (auto& v : voices) {
             if (!v->isActive()) {
-                v->noteOn(midiNote, velocity, s, s->sourceRate, s->rootFreq, playLoop);
-                return;
+                voice = v.get();
+                break;
             }
         }
-        voices[0]->noteOn(midiNote, velocity, s, s->sourceRate, s->rootFreq, playLoop);
+        startVoice(*voice, midiNote, velocity);
+    }
+
+    // a voice outside the pool with the settings of the live ones,
+    // make it on the GUI thread, the settings are read unguarded
+    std::unique_ptr<SampleVoice> makeOfflineVoice() {
+        auto v = std::make_unique<SampleVoice>(sampleRate);
+        v->copySettings(*voices[voices.size() - 1]);
+        return v;
+    }
+
+    // what the offline voices play, taken once on the GUI thread,
+    // so a render never follow later changes of the live state
+    struct OfflineSource {
+        std::shared_ptr<const SampleInfo> sample;       // slot 0 of the playing bank
+        std::shared_ptr<const SampleInfo> processed;    // the machine chain output
+        std::shared_ptr<const SampleInfo> root;         // for exact keys
+        std::vector<SampleBank::Zone> zones;            // the zones above slot 0
+        bool looping = false;
+        bool streamed = false;
+    };
+
+    OfflineSource getOfflineSource() {
+        OfflineSource o;
+        Reclaimer::Guard g;
+        o.looping = playLoop;
+        const SampleBank* bank = playLoop ? loopBank : sampleBank;
+        o.sample = bank ? bank->getSample(0) : nullptr;
+        o.streamed = o.sample && o.sample->stream;
+        o.processed = playLoop ? rb.getLoop() : rb.getSample();
+        o.root = rb.getRoot();
+        for (size_t i = 1; sampleBank && i < SampleBank::CAPACITY; ++i)
+            if (const SampleBank::Zone* z = sampleBank->getZone(i))
+                if (z->sample) o.zones.push_back(*z);
+        return o;
+    }
+
+    // the main sample read into memory when it is streamed from disk,
+    // offline voices render faster than the stream could follow
+    static void readStreamed(OfflineSource& o) {
+        if (o.streamed && o.sample->stream) o.sample = wholeFile(o.sample);
+    }
+
+    // start a offline voice, any thread. Keys of the KeyCache get a
+    // exact FINE build, never a preview or a neighbour, and the live
+    // lookup statistics stay untouched
+    bool offlineNoteOn(SampleVoice& voice, int midiNote, float velocity,
+                       const OfflineSource& o, const std::atomic<bool>& cancel) {
+        // like the zone table, the higher slot wins
+        const int vel = (int)std::lrint(velocity * 127.0f);
+        for (auto z = o.zones.rbegin(); z != o.zones.rend(); ++z) {
+            if (!z->range.covers(midiNote, vel)) continue;
+            // a zone cache get a exact key as well
+            if (z->range.cache && !(o.looping && z->range.hasLoop()) && voice.playsKeys()) {
+                auto s = z->range.cache->buildExact(midiNote, z->sample, cancel);
+                if (!s) return false;
+                voice.noteOn(midiNote, velocity, s, s->sourceRate, s->rootFreq, false);
+            } else {
+                startZone(voice, midiNote, velocity, *z, o.looping, nullptr);
+            }
+            return true;
+        }
+        if (!o.sample) return false;
+        std::shared_ptr<const SampleInfo> s = o.sample;
+        // streamed samples play as they are on disk
+        if (!o.streamed) {
+            if (!o.looping && voice.playsKeys()) {
+                s = rb.buildExact(midiNote, o.root, cancel);
+                if (!s) return false;
+            } else if (o.processed) {
+                s = o.processed;
+            }
+        }
+        voice.noteOn(midiNote, velocity, s, s->sourceRate, s->rootFreq, o.looping);
+        return true;
     }
 
+    double getSampleRate() const { return sampleRate; }
+
+    // ramp the voices down for a preset swap, once isMuted() the
+    // voices are stopped and the new state could be set in
+    // muted is cleared first, a stale true from the last swap is never seen
+    void fadeOut() {
+        muted.store(false, std::memory_order_relaxed);
+        fadeDown.store(true, std::memory_order_release);
+    }
+    void fadeIn() { fadeDown.store(false, std::memory_order_relaxed); }
+    bool isMuted() const { return muted.load(std::memory_order_acquire); }
+    // samples rendered so far, stand still when the audio doesn't run
+    uint64_t renderedFrames() const { return rendered.load(std::memory_order_relaxed); }
+
+    // one output sample, the caller hold a Reclaimer::Guard for the whole block
     float process() {
         float mix = 0.0f;
         float fSlow0 = 0.0010000000000000009 * gain;
+        rendered.store(rendered.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (fadeDown.load(std::memory_order_acquire)) {
+            if (fadeGain > 0.0f) fadeGain = std::max(0.0f, fadeGain - fadeStep());
+            // also when the fade out start from silence
+            if (fadeGain <= 0.0f && !muted.load(std::memory_order_relaxed)) {
+                // effects keep their tails, only the voices go
+                for (auto& v : voices)
+                    if (v->isActive()) v->reset();
+                muted.store(true, std::memory_order_release);
+            }
+        } else if (fadeGain < 1.0f) {
+            muted.store(false, std::memory_order_relaxed);
+            fadeGain = std::min(1.0f, fadeGain + fadeStep());
+        }
         for (auto& v : voices) {
             if (v->isActive()) {
                 mix += v->process();
             }
         }
+        mix *= fadeGain;
 
         fRec0[0] = fSlow0 + 0.999 * fRec0[1];
         mix = dcblocker.process(mix);
@@ -1049,8 +1395,47 @@ public:
 private:
     std::vector<std::unique_ptr<SampleVoice>> voices;
 
+    // find the zone for note and velocity, caller hold a Reclaimer::Guard.
+    // the zones live in the sample bank, slot 0 hold the main sample,
+    // served by our KeyCache, in loop mode from the loop bank
+    bool startVoice(SampleVoice& voice, int midiNote, float velocity) {
+        if (sampleBank) {
+            const SampleBank::Zone* z = sampleBank->findZone(midiNote, (int)std::lrint(velocity * 127.0f));
+            if (z && z->index != 0) {
+                startZone(voice, midiNote, velocity, *z, playLoop, z->range.cache);
+                return true;
+            }
+        }
+        const SampleBank* bank = playLoop ? loopBank : sampleBank;
+        if (!bank) return false;
+        const auto s = bank->getSample(0);
+        if (!s) return false;
+        voice.noteOn(midiNote, velocity, s, s->sourceRate, s->rootFreq, playLoop, &rb);
+        return true;
+    }
+
+    // a zone play its own sample, in loop mode with its own loop,
+    // a zone without loop play as one shot
+    static void startZone(SampleVoice& voice, int midiNote, float velocity,
+                          const SampleBank::Zone& z, bool playLoop, KeyCache* cache) {
+        const SampleInfo& s = *z.sample;
+        voice.noteOn(midiNote, velocity, z.sample, s.sourceRate, s.rootFreq,
+                     playLoop && z.range.hasLoop(), cache, z.range.loopStart, z.range.loopEnd);
+    }
+
     constexpr bool intToBool(int v) noexcept { return v != 0; }
 
+    // 10 ms ramp
+    float fadeStep() const { return float(100.0 / sampleRate); }
+
+    static std::shared_ptr<const SampleInfo> wholeFile(const std::shared_ptr<const SampleInfo>& s) {
+        auto full = std::make_shared<SampleInfo>();
+        full->data = s->stream->readAll();
+        full->sourceRate = s->sourceRate;
+        full->rootFreq = s->rootFreq;
+        return full;
+    }
+
     template<typename Fn, typename... Args>
     void updateAllVoices(Fn fn, Args&&... args) {
         for (auto& v : voices) {
@@ -1070,6 +1455,10 @@ private:
     float masterGain;
     float gain = std::pow(1e+01, 0.05 * 0.0);
     float fRec0[2] = {0.0f};
+    float fadeGain = 1.0f;
+    std::atomic<bool> fadeDown { false };
+    std::atomic<bool> muted { false };
+    std::atomic<uint64_t> rendered { 0 };
     bool playLoop;
     bool isDragFilterOn = false;
     bool sampleToBig = true;
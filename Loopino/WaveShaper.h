@@ -0,0 +1,311 @@
+
+/*
+ * WaveShaper.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  WaveShaper - the offline sharp (square), saw tooth and fade out
+               processors for the sample and loop buffers
+
+  sharp use a rational tanh, four samples at once with SSE,
+  fade out multiply a running gain instead of calling exp per
+  sample, the saw snap envelope use a fast pow.
+  ShapeRenderer run a full resolution render in a background
+  thread, a new start() cancel the running one.
+****************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __SSE__
+ #include <xmmintrin.h>
+#endif
+
+#ifndef WAVESHAPER_H
+#define WAVESHAPER_H
+
+struct ShapeParams {
+    float sharp = 0.0f;
+    float saw = 0.0f;
+    float fadeout = 0.0f;
+};
+
+class WaveShaper {
+public:
+    static constexpr size_t CHUNK = 1 << 16;   // samples between cancel checks
+
+    // tanh as [7/6] pade approximation, exact to about 1e-4 (9.6e-5 at the clamp)
+    static inline float tanhApprox(float x) {
+        if (x > 4.97f) return 1.0f;
+        if (x < -4.97f) return -1.0f;
+        const float x2 = x * x;
+        const float p = x * (135135.0f + x2 * (17325.0f + x2 * (378.0f + x2)));
+        const float q = 135135.0f + x2 * (62370.0f + x2 * (3150.0f + x2 * 28.0f));
+        return p / q;
+    }
+
+    // pow for 0 <= t <= 1
+    static inline float powApprox(float t, float e) {
+        if (t <= 0.0f) return 0.0f;
+        return std::exp2(e * std::log2(t));
+    }
+
+    // x + sharp * (tanh(x * drive) - x), with make up gain
+    static bool sharpen(float* buf, size_t n, float sharp,
+                        const std::atomic<bool>* cancel = nullptr) {
+        const float drive = 1.0f + sharp * 25.0f;
+        const float compensation = std::pow(10.0f, (sharp * 6.0f) / 20.0f);
+        size_t i = 0;
+        while (i < n) {
+            if (cancel && cancel->load(std::memory_order_relaxed)) return false;
+            const size_t end = std::min(n, i + CHUNK);
+#ifdef __SSE__
+            const __m128 vd = _mm_set1_ps(drive);
+            const __m128 vs = _mm_set1_ps(sharp);
+            const __m128 vc = _mm_set1_ps(compensation);
+            const __m128 lim = _mm_set1_ps(4.97f);
+            const __m128 nlim = _mm_set1_ps(-4.97f);
+            const __m128 c0 = _mm_set1_ps(135135.0f);
+            for (; i + 4 <= end; i += 4) {
+                const __m128 x = _mm_loadu_ps(buf + i);
+                __m128 y = _mm_min_ps(lim, _mm_max_ps(nlim, _mm_mul_ps(x, vd)));
+                const __m128 y2 = _mm_mul_ps(y, y);
+                __m128 p = _mm_add_ps(_mm_set1_ps(378.0f), y2);
+                p = _mm_add_ps(_mm_set1_ps(17325.0f), _mm_mul_ps(y2, p));
+                p = _mm_mul_ps(y, _mm_add_ps(c0, _mm_mul_ps(y2, p)));
+                __m128 q = _mm_add_ps(_mm_set1_ps(3150.0f), _mm_mul_ps(y2, _mm_set1_ps(28.0f)));
+                q = _mm_add_ps(_mm_set1_ps(62370.0f), _mm_mul_ps(y2, q));
+                q = _mm_add_ps(c0, _mm_mul_ps(y2, q));
+                // the pade value at the clamp edge is 0.99990, snap it to 1
+                __m128 t = _mm_div_ps(p, q);
+                t = _mm_or_ps(_mm_andnot_ps(_mm_cmpge_ps(y, lim), t),
+                              _mm_and_ps(_mm_cmpge_ps(y, lim), _mm_set1_ps(1.0f)));
+                t = _mm_or_ps(_mm_andnot_ps(_mm_cmple_ps(y, nlim), t),
+                              _mm_and_ps(_mm_cmple_ps(y, nlim), _mm_set1_ps(-1.0f)));
+                const __m128 r = _mm_add_ps(x, _mm_mul_ps(vs, _mm_sub_ps(t, x)));
+                _mm_storeu_ps(buf + i, _mm_mul_ps(r, vc));
+            }
+#endif
+            for (; i < end; ++i) {
+                const float x = buf[i];
+                buf[i] = (x + sharp * (tanhApprox(x * drive) - x)) * compensation;
+            }
+        }
+        return true;
+    }
+
+    // exp(-3 t) over the last part of the buffer, as a running product
+    static void fadeout(float* buf, size_t n, float amount) {
+        if (!n || amount <= 0.0f) return;
+        const float maxFraction = 5.0f / 6.0f;
+        const size_t fadeSamples = size_t(maxFraction * amount * n);
+        if (fadeSamples < 1) return;
+        const size_t start = n - fadeSamples;
+        const double k = std::exp(-3.0 / double(fadeSamples));
+        double gain = 1.0;
+        for (size_t i = start; i < n; ++i) {
+            buf[i] *= (float)gain;
+            gain *= k;
+        }
+    }
+
+    // turn each half wave into a ramp with a snap at its end
+    static bool saw(float* out, size_t N, float saw,
+                    const std::atomic<bool>* cancel = nullptr) {
+        if (!N) return true;
+        if (std::abs(saw) <= 0.0001f) return true;
+
+        float sawAmount = std::abs(saw);
+        bool reverseSaw = (saw < 0.0f);
+
+        const float snapTime = 0.003f * sawAmount;
+        const float alpha = 0.25f + sawAmount * 0.35f;
+        const float beta  = 1.20f + sawAmount * 0.50f;
+        size_t start = 0;
+        size_t check = 0;
+
+        while (start < N - 1) {
+            if (start >= check) {
+                if (cancel && cancel->load(std::memory_order_relaxed)) return false;
+                check = start + CHUNK;
+            }
+
+            while (start < N - 1 && out[start] == 0.0f)
+                start++;
+            if (start >= N - 1) break;
+
+            float sgn = (out[start] >= 0.0f ? 1.0f : -1.0f);
+            size_t end = start + 1;
+
+            while (end < N && (out[end] * sgn) >= 0.0f)
+                end++;
+
+            size_t len = end - start;
+            if (len < 3) { start = end; continue; }
+
+            float mn = out[start], mx = out[start];
+            for (size_t i = start; i < end; ++i) {
+                mn = std::min<float>(mn, out[i]);
+                mx = std::max<float>(mx, out[i]);
+            }
+
+            // linear ramp (forward / reverse)
+            float from, to;
+            if (!reverseSaw) {
+                from = sgn > 0.0f ? mn : mx;
+                to   = sgn > 0.0f ? mx : mn;
+            } else {
+                from = sgn > 0.0f ? mx : mn;
+                to   = sgn > 0.0f ? mn : mx;
+            }
+            const float inc = (to - from) / float(len - 1);
+            for (size_t i = 0; i < len; ++i) {
+                float linear = from + float(i) * inc;
+                float x = (1.0f - sawAmount) * out[start + i] + sawAmount * linear;
+                out[start + i] = (std::abs(x) < 1e-15f) ? 0.0f : x;
+            }
+
+            // snap
+            size_t snapSamples = size_t(snapTime * float(len));
+            snapSamples = std::clamp(snapSamples, size_t(1), len / 3);
+
+            float snapTarget;
+            if (!reverseSaw)
+                snapTarget = (sgn > 0.0f ? mn : mx);
+            else
+                snapTarget = (sgn > 0.0f ? mx : mn);
+
+            for (size_t i = 0; i < snapSamples; ++i) {
+                float t = float(i) / float(snapSamples - 1);
+                float snapEnv = powApprox(t, alpha) * powApprox(1.0f - t, beta);
+
+                size_t idx = reverseSaw ? (start + i) : (end - 1 - i);
+                float x = out[idx] * (1.0f - snapEnv) + snapTarget * snapEnv;
+                out[idx] = (std::abs(x) < 1e-15f) ? 0.0f : x;
+            }
+
+            start = end;
+        }
+        return true;
+    }
+
+    static void normalize(float* buf, size_t n, float range) {
+        float maxAbs = 0.0f;
+        for (size_t i = 0; i < n; ++i) maxAbs = std::max(maxAbs, std::fabs(buf[i]));
+        if (maxAbs <= 0.0f) return;
+        const float gain = range / maxAbs;
+        for (size_t i = 0; i < n; ++i) buf[i] *= gain;
+    }
+
+    // the whole chain, the loop buffer get no fade out
+    static bool render(const float* src, float* dst, size_t n, const ShapeParams& p,
+                    bool withFade, const std::atomic<bool>* cancel = nullptr) {
+        std::memcpy(dst, src, n * sizeof(float));
+        if (!sharpen(dst, n, p.sharp, cancel)) return false;
+        if (!saw(dst, n, p.saw, cancel)) return false;
+        if (withFade) fadeout(dst, n, p.fadeout);
+        if (cancel && cancel->load(std::memory_order_relaxed)) return false;
+        normalize(dst, n, 0.6f);
+        return true;
+    }
+
+    // a cheap look at the result, every step-th sample of src
+    static std::vector<float> preview(const float* src, size_t n, size_t points,
+                                            const ShapeParams& p, bool withFade) {
+        const size_t step = std::max<size_t>(1, n / std::max<size_t>(1, points));
+        std::vector<float> d(n / step);
+        for (size_t i = 0; i < d.size(); ++i) d[i] = src[i * step];
+        std::vector<float> out(d.size());
+        render(d.data(), out.data(), d.size(), p, withFade);
+        return out;
+    }
+};
+
+/****************************************************************
+  ShapeRenderer - full resolution render in the background
+****************************************************************/
+
+class ShapeRenderer {
+public:
+    struct Result {
+        std::shared_ptr<const std::vector<float>> source;   // what it was made from
+        ShapeParams params;
+        std::vector<float> data;
+    };
+
+    ~ShapeRenderer() {
+        cancelRunning();
+        if (worker.joinable()) worker.join();
+    }
+
+    // GUI thread
+    void start(std::shared_ptr<const std::vector<float>> src, const ShapeParams& p) {
+        cancelRunning();
+        if (worker.joinable()) worker.join();
+        {
+            std::lock_guard<std::mutex> g(m);
+            result.reset();
+        }
+        if (!src || src->empty()) return;
+        auto flag = std::make_shared<std::atomic<bool>>(false);
+        {
+            std::lock_guard<std::mutex> g(m);
+            cancel = flag;
+            running = true;
+        }
+        worker = std::thread(&ShapeRenderer::run, this, std::move(src), p, std::move(flag));
+    }
+
+    void cancelRunning() {
+        std::lock_guard<std::mutex> g(m);
+        if (cancel) cancel->store(true, std::memory_order_relaxed);
+        cancel.reset();
+        running = false;
+    }
+
+    bool busy() const {
+        std::lock_guard<std::mutex> g(m);
+        return running;
+    }
+
+    std::unique_ptr<Result> take() {
+        std::lock_guard<std::mutex> g(m);
+        return std::move(result);
+    }
+
+private:
+    mutable std::mutex m;
+    std::shared_ptr<std::atomic<bool>> cancel;
+    std::unique_ptr<Result> result;
+    std::thread worker;
+    bool running = false;
+
+    void run(std::shared_ptr<const std::vector<float>> src, ShapeParams p,
+                                    std::shared_ptr<std::atomic<bool>> flag) {
+        auto r = std::make_unique<Result>();
+        r->data.resize(src->size());
+        r->params = p;
+        const bool ok = WaveShaper::render(src->data(), r->data.data(), src->size(),
+                                                            p, true, flag.get());
+        r->source = std::move(src);
+        std::lock_guard<std::mutex> g(m);
+        if (!ok || flag->load(std::memory_order_relaxed)) return;
+        result = std::move(r);
+        running = false;
+    }
+};
+
+#endif
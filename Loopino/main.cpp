@@ -100,6 +100,7 @@ int main(int argc, char *argv[]){
     float scaling = cmd.opts.scaling.value_or(1.0f);
     int bufferSize = cmd.opts.bufferSize.value_or(256);
     int sampleRate = cmd.opts.sampleRate.value_or(48000);
+    ui.af.downmixMode = cmd.opts.downmix.value_or(Downmix::Left);
 
     Xputty app;
     JackBackend jb(&ui);
@@ -142,6 +143,7 @@ int main(int argc, char *argv[]){
     main_run(&app);
 
     ui.pa.stop();
+    if (cmd.opts.keyCacheStats) ui.synth.rb.printStats(std::cout);
 
     jb.stop();
     rawmidi.stop();
@@ -36,14 +36,22 @@ struct VstStreamOut : StreamOut {
 };
 
 struct VstStreamIn : StreamIn {
-    std::istringstream ss;
+    mutable std::istringstream ss;
+
+    size_t total;
 
     VstStreamIn(const void* data, size_t size)
-        : ss(std::string(reinterpret_cast<const char*>(data), size)) {}
+        : ss(std::string(reinterpret_cast<const char*>(data), size)), total(size) {}
 
     void read(void* data, size_t size) override {
         ss.read(reinterpret_cast<char*>(data), size);
     }
+
+    size_t remaining() const override {
+        // a failed stream has nothing left
+        const std::streamoff p = ss.tellg();
+        return p < 0 ? 0 : total - (size_t)p;
+    }
 };
 
 #define PLUGIN_UID 'LOPI'
@@ -171,6 +179,7 @@ static void processReplacing(AEffect* effect, float** inputs, float** outputs, i
         fRec0[1] = fRec0[0] = 0.0f;
         plug->r->position = plug->r->loopPoint_l;
     }
+    Reclaimer::Guard g;
     for (int32_t i = 0; i < nframes; i++) {
         // process synth
         float out = plug->r->synth.process();